@@ -1,15 +1,19 @@
 #include <stdio.h>
 #include <psptypes.h>
-#include <psprtc.h>
 #include <pspkernel.h>
 #include <pspgu.h>
+#include <psprtc.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "pl_psp.h"
 #include "ctrl.h"
 #include "video.h"
 #include "pl_snd.h"
+#include "pl_pace.h"
 #include "pl_perf.h"
+#include "pl_rewind.h"
+#include "pl_movie.h"
 
 #include "supervision.h"
 
@@ -26,19 +30,42 @@ extern struct ButtonConfig ActiveConfig;
 
 static int ScreenX, ScreenY, ScreenW, ScreenH;
 static int ClearScreen;
-static u32 TicksPerUpdate;
-static u32 TicksPerSecond;
-static u64 LastTick;
-static u64 CurrentTick;
 static int Frame;
 
+/* Audio queue; 4096 samples ~ 93ms */
+#define PACE_BUFFER_SIZE    4096
+#define PACE_LATENCY_FRAMES 2
+static pl_pace Pace;
+
 static pl_perf_counter FpsCounter;
 
+/* Rewind history, in one fixed allocation */
+#define REWIND_BUDGET (4 * 1024 * 1024)
+static pl_rewind Rewinder;
+static int RewindEnabled;
+static int Rewinding;
+
+/* Run-ahead: state to return to, and what running ahead costs */
+static void *RunAheadState;
+static u64 RunAheadTicks;
+static int RunAheadCount;
+
+/* Movie being recorded or played back */
+pl_movie Movie;
+
 static int  ParseInput();
 static void RenderVideo();
 static void psp_audio_callback(pl_snd_sample* buf,
                                unsigned int samples,
                                void *userdata);
+static void psp_render_audio(pl_snd_sample* buf,
+                             unsigned int samples,
+                             void *userdata);
+static int psp_save_state(void *buf);
+static int psp_load_state(void *buf);
+static int psp_get_state_size();
+static void psp_replay_frame(unsigned char input);
+static void RunAhead();
 
 int InitEmulator()
 {
@@ -50,8 +77,16 @@ int InitEmulator()
 
   Screen->Viewport.Width = 160;
 
+  pl_movie_init(&Movie);
+
+  if (!pl_pace_init(&Pace, PACE_BUFFER_SIZE))
+    return 0;
+
   pl_snd_set_callback(0, psp_audio_callback, NULL);
 
+  /* Run-ahead is unavailable without it */
+  RunAheadState = malloc(supervision_state_size());
+
   return 1;
 }
 
@@ -85,16 +120,29 @@ void RunEmulator()
   /* Init performance counter */
   pl_perf_init_counter(&FpsCounter);
 
-  /* Recompute update frequency */
-  TicksPerSecond = sceRtcGetTickResolution();
-  if (Options.UpdateFreq)
-  {
-    TicksPerUpdate = TicksPerSecond
-      / (Options.UpdateFreq / (Options.Frameskip + 1));
-    sceRtcGetCurrentTick(&LastTick);
-  }
+  /* Recompute update frequency; audio output paces the emulation */
+  pl_pace_reset(&Pace, SV_SAMPLE_RATE,
+    (Options.UpdateFreq) ? Options.UpdateFreq : 60, PACE_LATENCY_FRAMES);
   Frame = 0;
   ClearScreen = 1;
+  RunAheadTicks = 0;
+  RunAheadCount = 0;
+
+  /* Rewind history starts over; the backend may have changed. Rewinding */
+  /* is optional - run without it if memory is short */
+  if (RewindEnabled
+    && Rewinder.mode == Options.RewindMode
+    && Rewinder.key_interval == Options.RewindKeyInterval)
+    pl_rewind_reset(&Rewinder);
+  else
+  {
+    if (RewindEnabled)
+      pl_rewind_destroy(&Rewinder);
+    RewindEnabled = pl_rewind_init_ex(&Rewinder, REWIND_BUDGET,
+      Options.RewindMode, Options.RewindKeyInterval,
+      psp_save_state, psp_load_state, psp_get_state_size,
+      psp_replay_frame);
+  }
 
   /* Resume sound */
   pl_snd_resume(0);
@@ -108,7 +156,33 @@ void RunEmulator()
     /* Check input */
     if (ParseInput()) break;
 
-    supervision_exec_ex((uint16*)Screen->Pixels, Screen->Width);
+    /* Step back, then record the frame - the one run right after a */
+    /* step back too, or the history would be a frame off on resume */
+    if (RewindEnabled)
+    {
+      if (Rewinding)
+      {
+        pl_rewind_restore(&Rewinder);
+        /* Replaying leaves the input of the last replayed frame */
+        supervision_set_input(controls_state);
+      }
+      pl_rewind_save(&Rewinder, controls_state);
+    }
+
+    if (Options.RunAhead && RunAheadState && !Rewinding)
+    {
+      /* The frame is heard, but the one run ahead is seen */
+      supervision_exec_ex(NULL, 0);
+      pl_pace_write_frame(&Pace, psp_render_audio, NULL, Options.UpdateFreq);
+      RunAhead();
+    }
+    else
+    {
+      supervision_exec_ex((uint16*)Screen->Pixels, Screen->Width);
+
+      /* Queue the frame's audio; blocks if the frame limiter is on */
+      pl_pace_write_frame(&Pace, psp_render_audio, NULL, Options.UpdateFreq);
+    }
 
     /* Run the system emulation for a frame */
     if (++Frame > Options.Frameskip)
@@ -126,6 +200,17 @@ void TrashEmulator()
 {
 	supervision_done(); //shuts down the system
 
+  pl_snd_set_callback(0, NULL, NULL);
+  pl_pace_destroy(&Pace);
+
+  if (RewindEnabled)
+    pl_rewind_destroy(&Rewinder);
+
+  free(RunAheadState);
+
+  /* Write out any recording in progress */
+  pl_movie_stop(&Movie);
+
   if (Screen)
     pspImageDestroy(Screen);
 }
@@ -134,6 +219,7 @@ static int ParseInput()
 {
   /* Reset input */
 	controls_state = 0;
+  Rewinding = 0;
 
   static SceCtrlData pad;
   static int autofire_status = 0;
@@ -171,10 +257,23 @@ static int ParseInput()
         case SPC_MENU:
           if (on) return 1;
           break;
+        case SPC_REWIND:
+          if (on) Rewinding = 1;
+          break;
         }
       }
     }
   }
+
+  /* A movie logs the input, or supplies it. Rewinding would put the */
+  /* log out of step with the emulated frames */
+  if (Movie.mode != PL_MOVIE_IDLE)
+  {
+    Rewinding = 0;
+    if (!pl_movie_update(&Movie, &controls_state))
+      pl_movie_stop(&Movie);
+  }
+
   supervision_set_input(controls_state);
   return 0;
 }
@@ -199,9 +298,23 @@ static void RenderVideo()
   /* Show FPS counter */
   if (Options.ShowFps)
   {
-    static char fps_display[32];
+    static char fps_display[64];
     sprintf(fps_display, " %3.02f", pl_perf_update_counter(&FpsCounter));
 
+    /* Average cost of running ahead */
+    if (RunAheadCount)
+      sprintf(fps_display + strlen(fps_display), " A:%.0fus",
+        (float)RunAheadTicks / (float)RunAheadCount
+          * 1000000.0f / (float)sceRtcGetTickResolution());
+
+    /* Rewind capacity, average cost of save, worst-case cost of restore */
+    if (RewindEnabled)
+      sprintf(fps_display + strlen(fps_display), " R:%.0fs (%.0f/%.0fus)",
+        pl_rewind_get_capacity_seconds(&Rewinder,
+          (Options.UpdateFreq) ? Options.UpdateFreq : 60),
+        pl_rewind_get_save_time(&Rewinder),
+        pl_rewind_get_seek_latency(&Rewinder));
+
     int width = pspFontGetTextWidth(&PspStockFont, fps_display);
     int height = pspFontGetLineHeight(&PspStockFont);
 
@@ -211,14 +324,6 @@ static void RenderVideo()
 
   pspVideoEnd();
 
-  /* Wait if needed */
-  if (Options.UpdateFreq)
-  {
-    do { sceRtcGetCurrentTick(&CurrentTick); }
-    while (CurrentTick - LastTick < TicksPerUpdate);
-    LastTick = CurrentTick;
-  }
-
   /* Wait for VSync signal */
   if (Options.VSync) 
     pspVideoWaitVSync();
@@ -231,16 +336,56 @@ static void psp_audio_callback(pl_snd_sample* buf,
                                unsigned int samples,
                                void *userdata)
 {
-  int length = samples << 1; /* 2 bits per sample */
+  pl_pace_read(&Pace, buf, samples);
+}
 
-  static u8 bufU8[SOUND_BUFFER_SIZE * 4];
+static void psp_render_audio(pl_snd_sample* buf,
+                             unsigned int samples,
+                             void *userdata)
+{
+  /* 4 bytes per stereo sample */
+  supervision_update_sound_s16((int16*)buf, samples << 2);
+}
 
-  supervision_update_sound(bufU8, length);
-  u8* b = bufU8;
-  int i;
-  for (i = 0; i < (int)samples; i++) {
-    buf[i].stereo.l = *(b++) << (8 + 1);
-    buf[i].stereo.r = *(b++) << (8 + 1);
-  }
+static int psp_save_state(void *buf)
+{
+  return supervision_serialize(buf, supervision_state_size());
+}
+
+static int psp_load_state(void *buf)
+{
+  return supervision_unserialize(buf, supervision_state_size());
+}
+
+static int psp_get_state_size()
+{
+  return supervision_state_size();
+}
+
+static void psp_replay_frame(unsigned char input)
+{
+  supervision_set_input(input);
+  supervision_exec_ex(NULL, 0);
 }
 
+/* Emulate Options.RunAhead frames without sound, show the last one, */
+/* then return to the present */
+static void RunAhead()
+{
+  u64 start_tick, end_tick;
+  sceRtcGetCurrentTick(&start_tick);
+
+  uint32 size = supervision_state_size();
+  supervision_serialize(RunAheadState, size);
+
+  int i;
+  for (i = 1; i < Options.RunAhead; i++)
+    supervision_exec_ex(NULL, 0);
+  supervision_exec_ex((uint16*)Screen->Pixels, Screen->Width);
+
+  supervision_unserialize(RunAheadState, size);
+
+  sceRtcGetCurrentTick(&end_tick);
+  RunAheadTicks += end_tick - start_tick;
+  RunAheadCount++;
+}
@@ -20,6 +20,10 @@ typedef struct
   int Frameskip;
   int AutoFire;
   int ColorScheme;
+  int RewindMode;
+  int RewindKeyInterval;
+  int RunAhead;
+  int Ghosting;
 } EmulatorOptions;
 
 #define JOY 0x100
@@ -29,6 +33,7 @@ typedef struct
 #define CODE_MASK(x) ((x) & 0xff)
 
 #define SPC_MENU               1
+#define SPC_REWIND             2
 
 #define MAP_BUTTONS            18
 
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gamedb.h"
+
+#define DB_MAGIC       "SVGD"
+#define DB_VERSION     1
+#define DB_RECORD_SIZE 12
+
+/* CRCs are already well mixed; the low bits make a fine hash */
+#define SLOT(db, crc) ((crc) & (db)->SlotMask)
+
+static int Rehash(GameDb *db, int capacity)
+{
+  int slot_count = 16, i;
+  u32 j;
+
+  /* Keep the table at most half full */
+  while (slot_count < capacity * 2)
+    slot_count *= 2;
+
+  int *slots = (int*)calloc(slot_count, sizeof(int));
+  if (!slots)
+    return 0;
+
+  free(db->Slots);
+  db->Slots = slots;
+  db->SlotMask = slot_count - 1;
+
+  for (i = 0; i < db->Count; i++)
+  {
+    for (j = SLOT(db, db->Configs[i].Crc); db->Slots[j];
+         j = (j + 1) & db->SlotMask);
+    db->Slots[j] = i + 1;
+  }
+
+  return 1;
+}
+
+void InitGameDb(GameDb *db)
+{
+  db->Configs = NULL;
+  db->Count = 0;
+  db->Capacity = 0;
+  db->Slots = NULL;
+  db->SlotMask = 0;
+  db->Dirty = 0;
+}
+
+void TrashGameDb(GameDb *db)
+{
+  free(db->Configs);
+  free(db->Slots);
+  InitGameDb(db);
+}
+
+GameConfig* FindGameConfig(const GameDb *db, u32 crc)
+{
+  u32 j;
+
+  if (!db->Slots)
+    return NULL;
+
+  for (j = SLOT(db, crc); db->Slots[j]; j = (j + 1) & db->SlotMask)
+    if (db->Configs[db->Slots[j] - 1].Crc == crc)
+      return &db->Configs[db->Slots[j] - 1];
+
+  return NULL;
+}
+
+GameConfig* AddGameConfig(GameDb *db, u32 crc)
+{
+  GameConfig *config;
+  u32 j;
+
+  if ((config = FindGameConfig(db, crc)))
+    return config;
+
+  if (db->Count >= db->Capacity)
+  {
+    int capacity = (db->Capacity) ? db->Capacity * 2 : 32;
+    GameConfig *configs = (GameConfig*)realloc(db->Configs,
+      capacity * sizeof(GameConfig));
+    if (!configs)
+      return NULL;
+    db->Configs = configs;
+    if (!Rehash(db, capacity))
+      return NULL;
+    db->Capacity = capacity;
+  }
+
+  config = &db->Configs[db->Count];
+  memset(config, 0, sizeof(GameConfig));
+  config->Crc = crc;
+
+  for (j = SLOT(db, crc); db->Slots[j]; j = (j + 1) & db->SlotMask);
+  db->Slots[j] = ++db->Count;
+  db->Dirty = 1;
+
+  return config;
+}
+
+void RemoveGameConfig(GameDb *db, u32 crc)
+{
+  GameConfig *config;
+
+  if (!(config = FindGameConfig(db, crc)))
+    return;
+
+  /* Fill the hole with the last config; removal is rare, just rehash */
+  *config = db->Configs[--db->Count];
+  Rehash(db, db->Capacity);
+  db->Dirty = 1;
+}
+
+int LoadGameDb(GameDb *db, const char *path)
+{
+  FILE *file;
+  unsigned char header[12], *data = NULL, *p;
+  u32 version, count, i;
+
+  TrashGameDb(db);
+
+  if (!(file = fopen(path, "r")))
+    return 0;
+
+  /* Header, then all records in one read */
+  if (fread(header, sizeof(header), 1, file) != 1
+    || strncmp((char*)header, DB_MAGIC, 4) != 0)
+    goto error;
+
+  version = header[4] | (header[5] << 8) | (header[6] << 16)
+    | ((u32)header[7] << 24);
+  count = header[8] | (header[9] << 8) | (header[10] << 16)
+    | ((u32)header[11] << 24);
+
+  if (version != DB_VERSION || count > 0xffff)
+    goto error;
+
+  if (count > 0)
+  {
+    if (!(data = (unsigned char*)malloc(count * DB_RECORD_SIZE))
+      || fread(data, count * DB_RECORD_SIZE, 1, file) != 1)
+      goto error;
+
+    for (i = 0, p = data; i < count; i++, p += DB_RECORD_SIZE)
+    {
+      GameConfig *config = AddGameConfig(db,
+        p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24));
+      if (!config)
+        goto error;
+
+      config->Fields = p[4] | (p[5] << 8);
+      config->ClockFreq = p[6] | (p[7] << 8);
+      config->Frameskip = p[8];
+      config->ColorScheme = p[9];
+      config->Ghosting = p[10];
+      config->RunAhead = p[11];
+    }
+
+    free(data);
+  }
+
+  fclose(file);
+  db->Dirty = 0;
+  return 1;
+
+error:
+  free(data);
+  fclose(file);
+  TrashGameDb(db);
+  return 0;
+}
+
+int SaveGameDb(GameDb *db, const char *path)
+{
+  FILE *file;
+  unsigned char *data, *p;
+  int i, size = 12 + db->Count * DB_RECORD_SIZE, status;
+
+  if (!(data = (unsigned char*)malloc(size)))
+    return 0;
+
+  memcpy(data, DB_MAGIC, 4);
+  p = data + 4;
+  *p++ = DB_VERSION; *p++ = 0; *p++ = 0; *p++ = 0;
+  *p++ = db->Count; *p++ = db->Count >> 8; *p++ = 0; *p++ = 0;
+
+  for (i = 0; i < db->Count; i++)
+  {
+    const GameConfig *config = &db->Configs[i];
+    *p++ = config->Crc; *p++ = config->Crc >> 8;
+    *p++ = config->Crc >> 16; *p++ = config->Crc >> 24;
+    *p++ = config->Fields; *p++ = config->Fields >> 8;
+    *p++ = config->ClockFreq; *p++ = config->ClockFreq >> 8;
+    *p++ = config->Frameskip;
+    *p++ = config->ColorScheme;
+    *p++ = config->Ghosting;
+    *p++ = config->RunAhead;
+  }
+
+  status = 0;
+  if ((file = fopen(path, "w")))
+  {
+    status = fwrite(data, size, 1, file) == 1;
+    fclose(file);
+  }
+
+  free(data);
+  if (status)
+    db->Dirty = 0;
+  return status;
+}
@@ -0,0 +1,45 @@
+#ifndef _PSP_GAMEDB_H
+#define _PSP_GAMEDB_H
+
+#include <psptypes.h>
+
+/* Settings a game config can override */
+#define GAMECFG_CLOCK_FREQ 0x01
+#define GAMECFG_FRAMESKIP  0x02
+#define GAMECFG_COLORS     0x04
+#define GAMECFG_GHOSTING   0x08
+#define GAMECFG_RUN_AHEAD  0x10
+#define GAMECFG_ALL        0x1f
+
+typedef struct
+{
+  u32 Crc;     /* of the ROM */
+  u16 Fields;  /* GAMECFG_*, which of the values below are set */
+  u16 ClockFreq;
+  u8  Frameskip;
+  u8  ColorScheme;
+  u8  Ghosting;
+  u8  RunAhead;
+} GameConfig;
+
+typedef struct
+{
+  GameConfig *Configs;
+  int Count;
+  int Capacity;
+  int *Slots;   /* hash of CRCs; config index + 1, 0 - free */
+  u32 SlotMask;
+  int Dirty;
+} GameDb;
+
+void InitGameDb(GameDb *db);
+void TrashGameDb(GameDb *db);
+int  LoadGameDb(GameDb *db, const char *path);
+int  SaveGameDb(GameDb *db, const char *path);
+/* Pointers are valid until the next add or remove */
+GameConfig* FindGameConfig(const GameDb *db, u32 crc);
+/* Returns the existing config, or a new one with no fields set */
+GameConfig* AddGameConfig(GameDb *db, u32 crc);
+void RemoveGameConfig(GameDb *db, u32 crc);
+
+#endif // _PSP_GAMEDB_H
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pspkernel.h>
+
+#include "iconcache.h"
+
+/* Below the menu thread, so decoding only uses the time it spends */
+/* waiting for vertical sync */
+#define ICON_THREAD_PRIORITY 0x30
+
+#define LOCK(cache)   sceKernelWaitSema((cache)->Lock, 1, NULL)
+#define UNLOCK(cache) sceKernelSignalSema((cache)->Lock, 1)
+
+static void FreeEntry(IconEntry *entry)
+{
+  if (entry->Icon) pspImageDestroy(entry->Icon);
+  free(entry->Path);
+  memset(entry, 0, sizeof(IconEntry));
+}
+
+/* Entries that are loading belong to the loader until it's done */
+static void DropEntry(IconEntry *entry)
+{
+  if (entry->State == ICON_LOADING)
+    entry->Discard = 1;
+  else
+    FreeEntry(entry);
+}
+
+static IconEntry* FindEntry(IconCache *cache, const char *path)
+{
+  IconEntry *entry;
+  int i;
+
+  for (i = 0, entry = cache->Entries; i < ICON_CACHE_SIZE; i++, entry++)
+    if (entry->State != ICON_FREE && !entry->Discard
+      && strcmp(entry->Path, path) == 0)
+      return entry;
+
+  return NULL;
+}
+
+static IconEntry* AllocEntry(IconCache *cache, const char *path,
+                             const ScePspDateTime *modified)
+{
+  IconEntry *entry, *lru = NULL;
+  char *path_copy;
+  int i;
+
+  for (i = 0, entry = cache->Entries; i < ICON_CACHE_SIZE; i++, entry++)
+  {
+    if (entry->State == ICON_FREE)
+    {
+      lru = entry;
+      break;
+    }
+
+    /* Evict the least recently used icon no one is looking at */
+    if (!entry->Pinned && entry->State != ICON_LOADING
+      && (!lru || entry->LastUsed < lru->LastUsed))
+      lru = entry;
+  }
+
+  if (!lru || !(path_copy = strdup(path)))
+    return NULL;
+
+  FreeEntry(lru);
+  lru->Path = path_copy;
+  if (modified) lru->Modified = *modified;
+
+  return lru;
+}
+
+/* Loads the most urgent queued icon; returns 0 if there were none */
+static int LoadNext(IconCache *cache)
+{
+  IconEntry *entry, *next = NULL;
+  PspImage *icon;
+  int i;
+
+  LOCK(cache);
+  for (i = 0, entry = cache->Entries; i < ICON_CACHE_SIZE; i++, entry++)
+    if (entry->State == ICON_QUEUED
+      && (!next || entry->Priority < next->Priority))
+      next = entry;
+  if (next)
+    next->State = ICON_LOADING;
+  UNLOCK(cache);
+
+  if (!next)
+    return 0;
+
+  /* The path stays put while the entry is loading */
+  icon = cache->Loader(next->Path);
+
+  LOCK(cache);
+  next->Icon = icon;
+  next->State = ICON_READY;
+  if (next->Discard)
+    FreeEntry(next);
+  UNLOCK(cache);
+
+  return 1;
+}
+
+static int IconThread(SceSize args, void *argp)
+{
+  IconCache *cache = *(IconCache**)argp;
+
+  while (!cache->Quit)
+  {
+    sceKernelWaitSema(cache->Wake, 1, NULL);
+    while (!cache->Quit && LoadNext(cache));
+  }
+
+  sceKernelExitThread(0);
+  return 0;
+}
+
+int InitIconCache(IconCache *cache, IconLoader loader)
+{
+  memset(cache->Entries, 0, sizeof(cache->Entries));
+  cache->Loader = loader;
+  cache->Quit = 0;
+  cache->Clock = 0;
+  cache->Thread = -1;
+  cache->Wake = -1;
+
+  if ((cache->Lock = sceKernelCreateSema("icons", 0, 1, 1, NULL)) < 0)
+    return 0;
+
+  /* Without a thread, icons load when they're requested */
+  if ((cache->Wake = sceKernelCreateSema("icons_wake", 0, 0, 1, NULL)) >= 0
+    && (cache->Thread = sceKernelCreateThread("icons", IconThread,
+          ICON_THREAD_PRIORITY, 0x10000, 0, NULL)) >= 0)
+  {
+    IconCache *cache_ptr = cache;
+    if (sceKernelStartThread(cache->Thread, sizeof(cache_ptr),
+                             &cache_ptr) < 0)
+    {
+      sceKernelDeleteThread(cache->Thread);
+      cache->Thread = -1;
+    }
+  }
+
+  return 1;
+}
+
+void TrashIconCache(IconCache *cache)
+{
+  int i;
+
+  if (cache->Thread >= 0)
+  {
+    cache->Quit = 1;
+    sceKernelSignalSema(cache->Wake, 1);
+    sceKernelWaitThreadEnd(cache->Thread, NULL);
+    sceKernelDeleteThread(cache->Thread);
+  }
+
+  if (cache->Wake >= 0) sceKernelDeleteSema(cache->Wake);
+  sceKernelDeleteSema(cache->Lock);
+
+  for (i = 0; i < ICON_CACHE_SIZE; i++)
+    FreeEntry(&cache->Entries[i]);
+}
+
+IconEntry* RequestIcon(IconCache *cache, const char *path,
+                       const ScePspDateTime *modified)
+{
+  IconEntry *entry;
+  int queued = 0;
+
+  LOCK(cache);
+
+  /* An icon for an older version of the file is no good */
+  if ((entry = FindEntry(cache, path))
+    && memcmp(&entry->Modified, modified, sizeof(ScePspDateTime)) != 0)
+  {
+    DropEntry(entry);
+    entry = NULL;
+  }
+
+  if (!entry && (entry = AllocEntry(cache, path, modified)))
+  {
+    entry->State = ICON_QUEUED;
+    entry->Priority = 0;
+    queued = 1;
+  }
+
+  if (entry)
+  {
+    entry->Pinned = 1;
+    entry->LastUsed = ++cache->Clock;
+  }
+
+  UNLOCK(cache);
+
+  if (queued)
+  {
+    if (cache->Thread >= 0)
+      sceKernelSignalSema(cache->Wake, 1);
+    else
+      while (LoadNext(cache));
+  }
+
+  return entry;
+}
+
+void PrioritizeIcon(IconCache *cache, IconEntry *entry, int priority)
+{
+  LOCK(cache);
+  entry->Priority = priority;
+  UNLOCK(cache);
+}
+
+int PollIcon(IconCache *cache, IconEntry *entry, PspImage **icon)
+{
+  int ready;
+
+  LOCK(cache);
+  if ((ready = (entry->State == ICON_READY)))
+    *icon = entry->Icon;
+  UNLOCK(cache);
+
+  return ready;
+}
+
+PspImage* StoreIcon(IconCache *cache, const char *path,
+                    const ScePspDateTime *modified, PspImage *icon)
+{
+  IconEntry *entry;
+
+  LOCK(cache);
+
+  if ((entry = FindEntry(cache, path)))
+    DropEntry(entry);
+
+  if ((entry = AllocEntry(cache, path, modified)))
+  {
+    entry->Icon = icon;
+    entry->State = ICON_READY;
+    entry->Pinned = 1;
+    entry->LastUsed = ++cache->Clock;
+  }
+
+  UNLOCK(cache);
+
+  if (!entry)
+  {
+    pspImageDestroy(icon);
+    return NULL;
+  }
+
+  return icon;
+}
+
+void DropIcon(IconCache *cache, const char *path)
+{
+  IconEntry *entry;
+
+  LOCK(cache);
+  if ((entry = FindEntry(cache, path)))
+    DropEntry(entry);
+  UNLOCK(cache);
+}
+
+void ReleaseIcons(IconCache *cache)
+{
+  int i;
+
+  LOCK(cache);
+  for (i = 0; i < ICON_CACHE_SIZE; i++)
+    cache->Entries[i].Pinned = 0;
+  UNLOCK(cache);
+}
@@ -0,0 +1,60 @@
+#ifndef _PSP_ICONCACHE_H
+#define _PSP_ICONCACHE_H
+
+#include <psptypes.h>
+
+#include "image.h"
+
+#define ICON_CACHE_SIZE 32
+
+#define ICON_FREE    0
+#define ICON_QUEUED  1
+#define ICON_LOADING 2
+#define ICON_READY   3 /* Icon is NULL if it couldn't be loaded */
+
+typedef PspImage* (*IconLoader)(const char *path);
+
+/* An icon, keyed by the path and date of the file it's loaded from */
+typedef struct
+{
+  char *Path;
+  ScePspDateTime Modified;
+  PspImage *Icon;
+  int State;
+  int Priority; /* lowest loads first */
+  int Pinned;   /* requested since the last release; not evicted */
+  int Discard;  /* dropped while loading */
+  u32 LastUsed;
+} IconEntry;
+
+/* Decoded icons, loaded on a background thread; unpinned icons are */
+/* kept until evicted, least recently used first */
+typedef struct
+{
+  IconEntry Entries[ICON_CACHE_SIZE];
+  IconLoader Loader;
+  SceUID Lock;
+  SceUID Wake;
+  SceUID Thread;  /* < 0 - icons load on the calling thread */
+  volatile int Quit;
+  u32 Clock;
+} IconCache;
+
+int  InitIconCache(IconCache *cache, IconLoader loader);
+void TrashIconCache(IconCache *cache);
+/* Queues the icon unless it's cached, and pins it; NULL if full */
+IconEntry* RequestIcon(IconCache *cache, const char *path,
+                       const ScePspDateTime *modified);
+void PrioritizeIcon(IconCache *cache, IconEntry *entry, int priority);
+/* Returns nonzero once the icon's loaded */
+int  PollIcon(IconCache *cache, IconEntry *entry, PspImage **icon);
+/* Caches (and takes over) an icon that's already in memory, replacing */
+/* any for the same path; returns the icon, or NULL if it didn't fit */
+PspImage* StoreIcon(IconCache *cache, const char *path,
+                    const ScePspDateTime *modified, PspImage *icon);
+/* Forgets any icon for the path; it must no longer be displayed */
+void DropIcon(IconCache *cache, const char *path);
+/* Unpins all icons; they must no longer be displayed */
+void ReleaseIcons(IconCache *cache);
+
+#endif // _PSP_ICONCACHE_H
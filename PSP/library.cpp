@@ -0,0 +1,671 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pspkernel.h>
+#include <psprtc.h>
+
+#include "pl_file.h"
+#include "pl_util.h"
+#include "unzip.h"
+
+#include "library.h"
+
+#define INDEX_MAGIC   "SVLB"
+#define INDEX_VERSION 1
+
+#define MAGNUM_MIN_SIZE (128 * 1024 + 1)
+
+/* Below the menu thread, so a background scan only uses the time the */
+/* menu spends waiting for vertical sync */
+#define SCAN_THREAD_PRIORITY 0x30
+
+/* A file to (re)index; jobs are picked up by the scanning threads */
+typedef struct
+{
+  char *Path;
+  u32 FileSize;
+  u64 Modified;
+  int IsArchive;
+  LibraryEntry *Entries; /* results */
+  int Count;
+} ScanJob;
+
+typedef struct
+{
+  ScanJob *Jobs;
+  int JobCount;
+  int NextJob;
+  SceUID Lock;
+  const char **Filter;
+} ScanQueue;
+
+/* A growable array of entries */
+typedef struct
+{
+  LibraryEntry *Entries;
+  int Count;
+  int Capacity;
+} EntryList;
+
+static int AppendEntry(EntryList *list, const LibraryEntry *entry)
+{
+  if (list->Count >= list->Capacity)
+  {
+    int capacity = (list->Capacity) ? list->Capacity * 2 : 64;
+    LibraryEntry *entries = (LibraryEntry*)realloc(list->Entries,
+      capacity * sizeof(LibraryEntry));
+    if (!entries)
+      return 0;
+    list->Entries = entries;
+    list->Capacity = capacity;
+  }
+
+  list->Entries[list->Count++] = *entry;
+  return 1;
+}
+
+static void FreeEntry(LibraryEntry *entry)
+{
+  free(entry->Path);
+  free(entry->Entry);
+}
+
+static int CompareEntries(const void *a, const void *b)
+{
+  const LibraryEntry *ea = (const LibraryEntry*)a;
+  const LibraryEntry *eb = (const LibraryEntry*)b;
+  int cmp;
+
+  if ((cmp = strcmp(ea->Path, eb->Path)) != 0)
+    return cmp;
+  if (!ea->Entry || !eb->Entry)
+    return (ea->Entry != NULL) - (eb->Entry != NULL);
+  return strcmp(ea->Entry, eb->Entry);
+}
+
+/* Index of the first entry of path, or of where it would be */
+static int FindFirst(const Library *lib, const char *path)
+{
+  int lo = 0, hi = lib->Count;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (strcmp(lib->Entries[mid].Path, path) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static u32 GetType(u32 size)
+{
+  return (size >= MAGNUM_MIN_SIZE) ? LIBRARY_TYPE_MAGNUM
+    : LIBRARY_TYPE_STANDARD;
+}
+
+static int MatchesFilter(const char *name, const char **filter)
+{
+  for (; *filter; filter++)
+    if (pl_file_is_of_type(name, *filter))
+      return 1;
+  return 0;
+}
+
+void InitLibrary(Library *lib)
+{
+  lib->Entries = NULL;
+  lib->Count = 0;
+}
+
+void TrashLibrary(Library *lib)
+{
+  int i;
+  for (i = 0; i < lib->Count; i++)
+    FreeEntry(&lib->Entries[i]);
+  free(lib->Entries);
+  InitLibrary(lib);
+}
+
+const LibraryEntry* FindLibraryEntry(const Library *lib, const char *path,
+                                     const char *entry)
+{
+  int i;
+  for (i = FindFirst(lib, path);
+       i < lib->Count && strcmp(lib->Entries[i].Path, path) == 0; i++)
+    if (lib->Entries[i].Type != LIBRARY_TYPE_NONE
+      && (!entry || (lib->Entries[i].Entry
+        && strcmp(lib->Entries[i].Entry, entry) == 0)))
+      return &lib->Entries[i];
+  return NULL;
+}
+
+/* Index file */
+
+static int WriteU32(FILE *f, u32 value)
+{
+  unsigned char b[4] = { value, value >> 8, value >> 16, value >> 24 };
+  return fwrite(b, 4, 1, f) == 1;
+}
+
+static int ReadU32(FILE *f, u32 *value)
+{
+  unsigned char b[4];
+  if (fread(b, 4, 1, f) != 1)
+    return 0;
+  *value = b[0] | (b[1] << 8) | (b[2] << 16) | ((u32)b[3] << 24);
+  return 1;
+}
+
+static int WriteString(FILE *f, const char *str)
+{
+  u32 len = (str) ? strlen(str) : 0;
+  return WriteU32(f, len) && (len == 0 || fwrite(str, len, 1, f) == 1);
+}
+
+/* Empty strings are read as NULL */
+static int ReadString(FILE *f, char **str)
+{
+  u32 len;
+  *str = NULL;
+  if (!ReadU32(f, &len) || len >= PL_FILE_MAX_PATH_LEN)
+    return 0;
+  if (len == 0)
+    return 1;
+  if (!(*str = (char*)malloc(len + 1)))
+    return 0;
+  if (fread(*str, len, 1, f) != 1)
+    return 0;
+  (*str)[len] = '\0';
+  return 1;
+}
+
+int SaveLibraryIndex(const Library *lib, const char *path)
+{
+  FILE *f;
+  int i, ok;
+
+  if (!(f = fopen(path, "w")))
+    return 0;
+
+  ok = fwrite(INDEX_MAGIC, 4, 1, f) == 1
+    && WriteU32(f, INDEX_VERSION)
+    && WriteU32(f, lib->Count);
+
+  for (i = 0; ok && i < lib->Count; i++)
+  {
+    const LibraryEntry *e = &lib->Entries[i];
+    ok = WriteString(f, e->Path) && WriteString(f, e->Entry)
+      && WriteU32(f, e->Size) && WriteU32(f, e->FileSize)
+      && WriteU32(f, (u32)e->Modified) && WriteU32(f, (u32)(e->Modified >> 32))
+      && WriteU32(f, e->Crc) && WriteU32(f, e->Type);
+  }
+
+  fclose(f);
+  return ok;
+}
+
+int LoadLibraryIndex(Library *lib, const char *path)
+{
+  FILE *f;
+  char magic[4];
+  u32 version, count, i, lo, hi;
+  EntryList list = { NULL, 0, 0 };
+  LibraryEntry e;
+
+  TrashLibrary(lib);
+
+  if (!(f = fopen(path, "r")))
+    return 0;
+
+  if (fread(magic, 4, 1, f) != 1 || strncmp(magic, INDEX_MAGIC, 4) != 0
+    || !ReadU32(f, &version) || version != INDEX_VERSION
+    || !ReadU32(f, &count))
+    goto error;
+
+  for (i = 0; i < count; i++)
+  {
+    e.Path = e.Entry = NULL;
+
+    int ok = ReadString(f, &e.Path) && ReadString(f, &e.Entry);
+    ok = ok && e.Path && ReadU32(f, &e.Size) && ReadU32(f, &e.FileSize)
+      && ReadU32(f, &lo) && ReadU32(f, &hi)
+      && ReadU32(f, &e.Crc) && ReadU32(f, &e.Type);
+    e.Modified = ((u64)hi << 32) | lo;
+
+    if (!ok || !AppendEntry(&list, &e))
+    {
+      FreeEntry(&e);
+      goto error;
+    }
+  }
+
+  fclose(f);
+
+  /* Written sorted, but don't rely on it */
+  if (list.Count > 0)
+    qsort(list.Entries, list.Count, sizeof(LibraryEntry), CompareEntries);
+
+  lib->Entries = list.Entries;
+  lib->Count = list.Count;
+  return 1;
+
+error:
+  fclose(f);
+  lib->Entries = list.Entries;
+  lib->Count = list.Count;
+  TrashLibrary(lib);
+  return 0;
+}
+
+/* Scanning */
+
+static int AddFile(EntryList *list, const char *path, const char *entry,
+                   u32 size, u32 file_size, u64 modified, u32 crc)
+{
+  LibraryEntry e;
+  e.Path = strdup(path);
+  e.Entry = (entry) ? strdup(entry) : NULL;
+  e.Size = size;
+  e.FileSize = file_size;
+  e.Modified = modified;
+  e.Crc = crc;
+  e.Type = GetType(size);
+
+  if (!e.Path || (entry && !e.Entry) || !AppendEntry(list, &e))
+  {
+    FreeEntry(&e);
+    return 0;
+  }
+  return 1;
+}
+
+/* Runs on a scanning thread; touches nothing but the job */
+static void ScanFile(ScanJob *job, const char **filter)
+{
+  EntryList list = { NULL, 0, 0 };
+
+  if (job->IsArchive)
+  {
+    /* CRCs of archived files come with the central directory */
+    unzFile zipfile;
+    const unz_dir_entry *entries;
+    uLong count, i;
+
+    if ((zipfile = unzOpen(job->Path)))
+    {
+      if (unzCacheCentralDir(zipfile) == UNZ_OK
+        && unzGetDirIndex(zipfile, &entries, &count) == UNZ_OK)
+      {
+        for (i = 0; i < count; i++)
+          if (MatchesFilter(entries[i].filename, filter))
+            AddFile(&list, job->Path, entries[i].filename,
+              entries[i].uncompressed_size, job->FileSize, job->Modified,
+              entries[i].crc);
+      }
+      unzClose(zipfile);
+    }
+  }
+  else if (pl_file_is_of_type(job->Path, "GZ"))
+  {
+    /* The gzip trailer holds the CRC and size of the uncompressed data */
+    unsigned char header[2], trailer[8];
+    FILE *file;
+
+    if ((file = fopen(job->Path, "rb")))
+    {
+      if (fread(header, sizeof(header), 1, file) == 1
+        && header[0] == 0x1f && header[1] == 0x8b
+        && fseek(file, -8, SEEK_END) == 0
+        && fread(trailer, sizeof(trailer), 1, file) == 1)
+        AddFile(&list, job->Path, NULL,
+          trailer[4] | (trailer[5] << 8) | (trailer[6] << 16)
+            | ((u32)trailer[7] << 24),
+          job->FileSize, job->Modified,
+          trailer[0] | (trailer[1] << 8) | (trailer[2] << 16)
+            | ((u32)trailer[3] << 24));
+      fclose(file);
+    }
+  }
+  else
+  {
+    FILE *file;
+    uint32_t crc;
+
+    if ((file = fopen(job->Path, "rb")))
+    {
+      if (pl_util_compute_crc32_fd(file, &crc) == 0)
+        AddFile(&list, job->Path, NULL, job->FileSize, job->FileSize,
+          job->Modified, crc);
+      fclose(file);
+    }
+  }
+
+  /* Nothing found; remember the file so it isn't read again */
+  if (list.Count == 0
+    && AddFile(&list, job->Path, NULL, 0, job->FileSize, job->Modified, 0))
+    list.Entries[0].Type = LIBRARY_TYPE_NONE;
+
+  job->Entries = list.Entries;
+  job->Count = list.Count;
+}
+
+static ScanJob* TakeJob(ScanQueue *queue)
+{
+  ScanJob *job = NULL;
+
+  sceKernelWaitSema(queue->Lock, 1, NULL);
+  if (queue->NextJob < queue->JobCount)
+    job = &queue->Jobs[queue->NextJob++];
+  sceKernelSignalSema(queue->Lock, 1);
+
+  return job;
+}
+
+static void RunJobs(ScanQueue *queue)
+{
+  ScanJob *job;
+  while ((job = TakeJob(queue)))
+    ScanFile(job, queue->Filter);
+}
+
+static int ScanThread(SceSize args, void *argp)
+{
+  RunJobs(*(ScanQueue**)argp);
+  sceKernelExitThread(0);
+  return 0;
+}
+
+/* Lists the files under dir, along with their size and date */
+static int ListFiles(const char *dir, const char **filter, int recursive,
+                     ScanJob **jobs, int *count, int *capacity)
+{
+  SceUID fd;
+  SceIoDirent dirent;
+  pl_file_path path;
+  int ok = 1;
+
+  if ((fd = sceIoDopen(dir)) < 0)
+    return 0;
+
+  memset(&dirent, 0, sizeof(dirent));
+  while (ok && sceIoDread(fd, &dirent) > 0)
+  {
+    if (dirent.d_name[0] == '.')
+      continue;
+
+    snprintf(path, sizeof(path), "%s%s", dir, dirent.d_name);
+
+    if (dirent.d_stat.st_attr & FIO_SO_IFDIR)
+    {
+      if (recursive)
+      {
+        strncat(path, "/", sizeof(path) - strlen(path) - 1);
+        ListFiles(path, filter, recursive, jobs, count, capacity);
+      }
+      continue;
+    }
+
+    /* The filter applies to what's inside an archive */
+    int is_archive = pl_file_is_of_type(dirent.d_name, "ZIP");
+    if (!is_archive && !pl_file_is_of_type(dirent.d_name, "GZ")
+      && !MatchesFilter(dirent.d_name, filter))
+      continue;
+
+    if (*count >= *capacity)
+    {
+      int new_capacity = (*capacity) ? *capacity * 2 : 64;
+      ScanJob *new_jobs = (ScanJob*)realloc(*jobs,
+        new_capacity * sizeof(ScanJob));
+      if (!new_jobs)
+      {
+        ok = 0;
+        break;
+      }
+      *jobs = new_jobs;
+      *capacity = new_capacity;
+    }
+
+    ScanJob *job = &(*jobs)[*count];
+    if (!(job->Path = strdup(path)))
+    {
+      ok = 0;
+      break;
+    }
+
+    job->FileSize = (u32)dirent.d_stat.st_size;
+    job->Modified = 0;
+    sceRtcGetTick(&dirent.d_stat.st_mtime, &job->Modified);
+    job->IsArchive = is_archive;
+    job->Entries = NULL;
+    job->Count = 0;
+    (*count)++;
+  }
+
+  sceIoDclose(fd);
+  return ok;
+}
+
+/* Whether path is under dir (directly, unless recursive) */
+static int InScope(const char *path, const char *dir, int dir_len,
+                   int recursive)
+{
+  return strncmp(path, dir, dir_len) == 0
+    && (recursive || !strchr(path + dir_len, '/'));
+}
+
+int ScanLibrary(Library *lib, const char *dir, const char **filter,
+                int recursive)
+{
+  ScanQueue queue, *queue_ptr = &queue;
+  ScanJob *jobs = NULL;
+  int job_count = 0, job_capacity = 0;
+  EntryList list = { NULL, 0, 0 };
+  SceUID threads[LIBRARY_THREADS];
+  pl_file_path root;
+  char *keep;
+  int i, j, ok;
+
+  /* Scope is everything starting with "dir/" */
+  snprintf(root, sizeof(root), "%s", dir);
+  if (root[0] && root[strlen(root) - 1] != '/')
+    strncat(root, "/", sizeof(root) - strlen(root) - 1);
+  int root_len = strlen(root);
+
+  if (!(keep = (char*)calloc(lib->Count + 1, 1)))
+    return 0;
+
+  ok = ListFiles(root, filter, recursive, &jobs, &job_count, &job_capacity);
+
+  /* Keep the entries of unchanged files; queue the rest for indexing */
+  for (i = 0; ok && i < job_count; i++)
+  {
+    ScanJob *job = &jobs[i];
+    int first = FindFirst(lib, job->Path), last;
+
+    for (last = first; last < lib->Count
+         && strcmp(lib->Entries[last].Path, job->Path) == 0; last++)
+      if (lib->Entries[last].FileSize != job->FileSize
+        || lib->Entries[last].Modified != job->Modified)
+        break;
+
+    if (last > first && (last == lib->Count
+        || strcmp(lib->Entries[last].Path, job->Path) != 0))
+    {
+      for (j = first; j < last; j++)
+        keep[j] = 1;
+
+      free(job->Path);
+      jobs[i--] = jobs[--job_count];
+    }
+  }
+
+  if (ok && job_count > 0)
+  {
+    queue.Jobs = jobs;
+    queue.JobCount = job_count;
+    queue.NextJob = 0;
+    queue.Filter = filter;
+
+    if ((queue.Lock = sceKernelCreateSema("library", 0, 1, 1, NULL)) < 0)
+      ok = 0;
+    else
+    {
+      /* Reading one file overlaps hashing another. The helpers run at */
+      /* the caller's priority, so a background scan stays there */
+      for (i = 0; i < LIBRARY_THREADS; i++)
+      {
+        threads[i] = sceKernelCreateThread("library", ScanThread,
+          sceKernelGetThreadCurrentPriority(), 0x10000, 0, NULL);
+        if (threads[i] >= 0
+          && sceKernelStartThread(threads[i], sizeof(queue_ptr),
+                                  &queue_ptr) < 0)
+        {
+          sceKernelDeleteThread(threads[i]);
+          threads[i] = -1;
+        }
+      }
+
+      /* Help out; this also covers threads that failed to start */
+      RunJobs(&queue);
+
+      for (i = 0; i < LIBRARY_THREADS; i++)
+      {
+        if (threads[i] >= 0)
+        {
+          sceKernelWaitThreadEnd(threads[i], NULL);
+          sceKernelDeleteThread(threads[i]);
+        }
+      }
+
+      sceKernelDeleteSema(queue.Lock);
+    }
+  }
+
+  /* Collect the results */
+  for (i = 0; i < job_count; i++)
+  {
+    for (j = 0; j < jobs[i].Count; j++)
+      if (!ok || !(ok = AppendEntry(&list, &jobs[i].Entries[j])))
+        FreeEntry(&jobs[i].Entries[j]);
+    free(jobs[i].Entries);
+    free(jobs[i].Path);
+  }
+  free(jobs);
+
+  /* Make room for what's kept, so that moving it can't fail */
+  if (ok && list.Count + lib->Count > list.Capacity)
+  {
+    LibraryEntry *entries = (LibraryEntry*)realloc(list.Entries,
+      (list.Count + lib->Count + 1) * sizeof(LibraryEntry));
+    if ((ok = (entries != NULL)))
+    {
+      list.Entries = entries;
+      list.Capacity = list.Count + lib->Count + 1;
+    }
+  }
+
+  if (!ok)
+  {
+    /* The library is left as it was */
+    for (i = 0; i < list.Count; i++)
+      FreeEntry(&list.Entries[i]);
+    free(list.Entries);
+    free(keep);
+    return 0;
+  }
+
+  /* Keep unchanged files and everything outside the scanned directory; */
+  /* files that are gone are dropped */
+  for (i = 0; i < lib->Count; i++)
+  {
+    LibraryEntry *e = &lib->Entries[i];
+    if (keep[i] || !InScope(e->Path, root, root_len, recursive))
+      list.Entries[list.Count++] = *e;
+    else
+      FreeEntry(e);
+  }
+
+  free(keep);
+  free(lib->Entries);
+
+  if (list.Count > 0)
+    qsort(list.Entries, list.Count, sizeof(LibraryEntry), CompareEntries);
+
+  lib->Entries = list.Entries;
+  lib->Count = list.Count;
+  return 1;
+}
+
+/* Background scan */
+
+static int BackgroundScanThread(SceSize args, void *argp)
+{
+  LibraryScan *scan = *(LibraryScan**)argp;
+  scan->Result = ScanLibrary(scan->Lib, scan->Dir, scan->Filter,
+    scan->Recursive);
+  scan->Done = 1;
+  sceKernelExitThread(0);
+  return 0;
+}
+
+void InitLibraryScan(LibraryScan *scan)
+{
+  scan->Lib = NULL;
+  scan->Dir = NULL;
+  scan->Result = 0;
+  scan->Done = 1;
+  scan->Thread = -1;
+}
+
+void StartLibraryScan(LibraryScan *scan, Library *lib, const char *dir,
+                      const char **filter, int recursive)
+{
+  FinishLibraryScan(scan);
+
+  scan->Lib = lib;
+  scan->Filter = filter;
+  scan->Recursive = recursive;
+  scan->Result = 0;
+  scan->Done = 0;
+
+  /* The caller's copy of the path may change during the scan */
+  if (!(scan->Dir = strdup(dir)))
+    return;
+
+  if ((scan->Thread = sceKernelCreateThread("library_scan",
+        BackgroundScanThread, SCAN_THREAD_PRIORITY, 0x10000, 0, NULL)) >= 0)
+  {
+    LibraryScan *scan_ptr = scan;
+    if (sceKernelStartThread(scan->Thread, sizeof(scan_ptr), &scan_ptr) >= 0)
+      return;
+
+    sceKernelDeleteThread(scan->Thread);
+    scan->Thread = -1;
+  }
+
+  scan->Result = ScanLibrary(lib, scan->Dir, filter, recursive);
+  scan->Done = 1;
+}
+
+int FinishLibraryScan(LibraryScan *scan)
+{
+  if (scan->Thread >= 0)
+  {
+    sceKernelWaitThreadEnd(scan->Thread, NULL);
+    sceKernelDeleteThread(scan->Thread);
+    scan->Thread = -1;
+  }
+
+  free(scan->Dir);
+  scan->Dir = NULL;
+
+  return scan->Result;
+}
+
+int PollLibraryScan(LibraryScan *scan)
+{
+  if (scan->Thread >= 0 && !scan->Done)
+    return 0;
+
+  FinishLibraryScan(scan);
+  return 1;
+}
@@ -0,0 +1,70 @@
+#ifndef _PSP_LIBRARY_H
+#define _PSP_LIBRARY_H
+
+#include <psptypes.h>
+
+#define LIBRARY_TYPE_STANDARD 0
+#define LIBRARY_TYPE_MAGNUM   1 /* > 128KB, banked through 0x2021 */
+/* Nothing to load: an archive without ROMs, or a file that couldn't */
+/* be read. Recorded so that a rescan skips the file until it changes */
+#define LIBRARY_TYPE_NONE     2
+
+#define LIBRARY_THREADS 2
+
+/* A ROM, either a file or a member of a ZIP archive */
+typedef struct
+{
+  char *Path;
+  char *Entry;  /* archive member; NULL - plain file */
+  u32 Size;     /* uncompressed */
+  u32 FileSize; /* of the file (the archive) */
+  u64 Modified; /* of the file, in RTC ticks */
+  u32 Crc;
+  u32 Type;
+} LibraryEntry;
+
+typedef struct
+{
+  LibraryEntry *Entries; /* sorted by path, then entry */
+  int Count;
+} Library;
+
+void InitLibrary(Library *lib);
+void TrashLibrary(Library *lib);
+int  LoadLibraryIndex(Library *lib, const char *path);
+int  SaveLibraryIndex(const Library *lib, const char *path);
+/* Indexes the ROMs under dir (and its subdirectories if recursive); */
+/* only new files, or files whose size or date changed, are read. */
+/* filter lists ROM extensions; ZIP and gzip files are always looked */
+/* into, and the filter applies to the members of a ZIP */
+int  ScanLibrary(Library *lib, const char *dir, const char **filter,
+                 int recursive);
+/* entry - the archive member; NULL - the first ROM of path. Entries of */
+/* type NONE aren't returned */
+const LibraryEntry* FindLibraryEntry(const Library *lib, const char *path,
+                                     const char *entry);
+
+/* A ScanLibrary() running on a background thread; the library must */
+/* not be touched until the scan is finished */
+typedef struct
+{
+  Library *Lib;
+  char *Dir;
+  const char **Filter;
+  int Recursive;
+  int Result;
+  volatile int Done; /* set by the thread once the scan has ended */
+  SceUID Thread; /* < 0 - not running */
+} LibraryScan;
+
+void InitLibraryScan(LibraryScan *scan);
+/* Scans on the calling thread if a thread can't be started */
+void StartLibraryScan(LibraryScan *scan, Library *lib, const char *dir,
+                      const char **filter, int recursive);
+/* Waits for the scan to end; returns the result of ScanLibrary() */
+int  FinishLibraryScan(LibraryScan *scan);
+/* Nonzero if no scan is running (finishing one that has ended); */
+/* doesn't wait */
+int  PollLibraryScan(LibraryScan *scan);
+
+#endif // _PSP_LIBRARY_H
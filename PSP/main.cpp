@@ -7,6 +7,7 @@
 #include "pl_snd.h"
 #include "video.h"
 #include "pl_psp.h"
+#include "pl_file.h"
 #include "ctrl.h"
 
 #include "menu.h"
@@ -19,6 +20,12 @@ static void ExitCallback(void* arg)
   ExitPSP = 1;
 }
 
+static void MediaCallback(void* arg)
+{
+  /* The stick may have been swapped */
+  pl_file_invalidate_file_lists();
+}
+
 int main(int argc, char **argv)
 {
   /* Initialize PSP */
@@ -31,6 +38,9 @@ int main(int argc, char **argv)
   pl_psp_register_callback(PSP_EXIT_CALLBACK,
                            ExitCallback,
                            NULL);
+  pl_psp_register_callback(PSP_MEDIA_CALLBACK,
+                           MediaCallback,
+                           NULL);
   pl_psp_start_callback_thread();
 
   if (InitMenu())
@@ -12,6 +12,9 @@
 #include "pl_ini.h"
 #include "pl_file.h"
 #include "pl_util.h"
+#include "pl_rewind.h"
+#include "pl_movie.h"
+#include "pl_rom.h"
 #include "image.h"
 
 #include "supervision.h"
@@ -19,6 +22,9 @@
 
 #include "menu.h"
 #include "emulate.h"
+#include "library.h"
+#include "gamedb.h"
+#include "iconcache.h"
 
 #define TAB_QUICKLOAD 0
 #define TAB_STATE     1
@@ -37,10 +43,22 @@
 #define OPTION_CONTROL_MODE 0x07
 #define OPTION_ANIMATE      0x08
 #define OPTION_AUTOFIRE     0x09
+#define OPTION_REWIND_MODE  0x0A
+#define OPTION_REWIND_KEYS  0x0B
+#define OPTION_RUN_AHEAD    0x0C
+#define OPTION_GHOSTING     0x0D
 
 #define SYSTEM_SCRNSHOT     0x11
 #define SYSTEM_RESET        0x12
 #define SYSTEM_COLORS       0x13
+#define SYSTEM_MOVIE_RECORD 0x14
+#define SYSTEM_MOVIE_PLAY   0x15
+#define SYSTEM_MOVIE_STOP   0x16
+#define SYSTEM_GAME_CONFIG  0x17
+
+#define ROM_BANK_SIZE 0x4000
+
+#define STATE_SLOTS 10
 
 /* Tab labels */
 static const char *TabLabel[] = 
@@ -54,16 +72,25 @@ static const char *TabLabel[] =
 };
 
 extern PspImage *Screen;
+extern pl_movie Movie;
 
 EmulatorOptions Options;
 
-static uint8 *rom_buffer;
+static pl_rom *Rom;
+static uint32_t RomCrc;
 static int TabIndex;
 static int ResumeEmulation;
 static PspImage *Background;
 static PspImage *NoSaveIcon;
+static PspImage *LoadingIcon;
 
-static const char *QuickloadFilter[] = { "ZIP", "SV", "BIN", "WS", '\0' },
+/* Save state thumbnails; slots show LoadingIcon until theirs is decoded */
+static IconCache StateIcons;
+static IconEntry *PendingIcons[STATE_SLOTS];
+
+/* Archives first, then ROMs (which archives are searched for) */
+#define ROM_EXTENSIONS (QuickloadFilter + 2)
+static const char *QuickloadFilter[] = { "ZIP", "GZ", "SV", "BIN", "WS", '\0' },
   PresentSlotText[] = "\026\244\020 Save\t\026\001\020 Load\t\026\243\020 Delete",
   EmptySlotText[] = "\026\244\020 Save",
   ControlHelpText[] = "\026\250\020 Change mapping\t\026\001\020 Save to \271\t\026\243\020 Load defaults";
@@ -71,8 +98,21 @@ static const char *QuickloadFilter[] = { "ZIP", "SV", "BIN", "WS", '\0' },
 pl_file_path CurrentGame = "",
              GamePath = "",
              SaveStatePath,
+             MoviePath,
+             LibraryPath,
+             GameDbPath,
              ScreenshotPath;
 
+/* CRCs (and sizes) of the ROMs seen in the file browser */
+static Library RomLibrary;
+static LibraryScan RomScan;
+
+/* Per-game overrides, keyed by ROM CRC; while the current game has */
+/* one, the global values of the overridden settings are kept aside */
+static GameDb GameSettings;
+static GameConfig GlobalSettings;
+static int GameOverride;
+
 #define SET_AS_CURRENT_GAME(filename) \
   strncpy(CurrentGame, filename, sizeof(CurrentGame) - 1)
 #define CURRENT_GAME (CurrentGame)
@@ -80,13 +120,17 @@ pl_file_path CurrentGame = "",
 
 static int psp_load_rom(const char *filename);
 static int SaveOptions();
+static void ApplyGameConfig(const GameConfig *config);
+static void StoreGameConfig(GameConfig *config);
+static void SetGameOverride(int enable);
 static void LoadOptions();
 
 static void DisplayStateTab();
 
 static PspImage* LoadStateIcon(const char *path);
 static int LoadState(const char *path);
-static PspImage* SaveState(const char *path, PspImage *icon);
+static PspImage* SaveState(const char *path);
+static char* GetLegacyStatePath(const char *path);
 
 static void InitButtonConfig();
 static int LoadButtonConfig();
@@ -95,6 +139,7 @@ static int SaveButtonConfig();
 static int OnMenuItemChanged(const struct PspUiMenu *uimenu, pl_menu_item* item, 
   const pl_menu_option* option);
 static int OnMenuOk(const void *uimenu, const void* sel_item);
+static int OnMovie(int id);
 static int OnMenuButtonPress(const struct PspUiMenu *uimenu, 
   pl_menu_item* sel_item, u32 button_mask);
 
@@ -114,6 +159,7 @@ static int OnSaveStateButtonPress(const PspUiGallery *gallery,
 static int OnQuickloadOk(const void *browser, const void *path);
 
 static void OnSystemRender(const void *uiobject, const void *item_obj);
+static void OnSaveStateRender(const void *uiobject, const void *item_obj);
 
 /* Menu options */
 PL_MENU_OPTIONS_BEGIN(ToggleOptions)
@@ -149,10 +195,40 @@ PL_MENU_OPTIONS_BEGIN(AutofireOptions)
   PL_MENU_OPTION("Once every 30 frames", 29)
   PL_MENU_OPTION("Once every 60 frames", 59)
 PL_MENU_OPTIONS_END
+PL_MENU_OPTIONS_BEGIN(RunAheadOptions)
+  PL_MENU_OPTION("Disabled", 0)
+  PL_MENU_OPTION("1 frame",  1)
+  PL_MENU_OPTION("2 frames", 2)
+  PL_MENU_OPTION("3 frames", 3)
+PL_MENU_OPTIONS_END
+PL_MENU_OPTIONS_BEGIN(GhostingOptions)
+  PL_MENU_OPTION("Disabled", 0)
+  PL_MENU_OPTION("1 frame",  1)
+  PL_MENU_OPTION("2 frames", 2)
+  PL_MENU_OPTION("3 frames", 3)
+  PL_MENU_OPTION("4 frames", 4)
+  PL_MENU_OPTION("5 frames", 5)
+  PL_MENU_OPTION("6 frames", 6)
+  PL_MENU_OPTION("7 frames", 7)
+  PL_MENU_OPTION("8 frames", SV_GHOSTING_MAX)
+PL_MENU_OPTIONS_END
+PL_MENU_OPTIONS_BEGIN(RewindModeOptions)
+  PL_MENU_OPTION("Snapshots (fast)",          PL_REWIND_DELTA)
+  PL_MENU_OPTION("Keyframes + input (long)",  PL_REWIND_REPLAY)
+PL_MENU_OPTIONS_END
+PL_MENU_OPTIONS_BEGIN(RewindKeyOptions)
+  PL_MENU_OPTION("Every 0.25 s", 15)
+  PL_MENU_OPTION("Every 0.5 s",  30)
+  PL_MENU_OPTION("Every 1 s",    60)
+PL_MENU_OPTIONS_END
 PL_MENU_OPTIONS_BEGIN(ControlModeOptions)
   PL_MENU_OPTION("\026\242\020 cancels, \026\241\020 confirms (US)",    0)
   PL_MENU_OPTION("\026\241\020 cancels, \026\242\020 confirms (Japan)", 1)
 PL_MENU_OPTIONS_END
+PL_MENU_OPTIONS_BEGIN(GameConfigOptions)
+  PL_MENU_OPTION("All games",      0)
+  PL_MENU_OPTION("This game only", 1)
+PL_MENU_OPTIONS_END
 PL_MENU_OPTIONS_BEGIN(ColorSchemeOptions)
   PL_MENU_OPTION("Default",       SV_COLOR_SCHEME_DEFAULT)
   PL_MENU_OPTION("Amber",         SV_COLOR_SCHEME_AMBER)
@@ -166,6 +242,7 @@ PL_MENU_OPTIONS_BEGIN(ButtonMapOptions)
   PL_MENU_OPTION("None", 0)
   /* Special */
   PL_MENU_OPTION("Special: Open Menu", SPC|SPC_MENU)
+  PL_MENU_OPTION("Special: Rewind",    SPC|SPC_REWIND)
   /* Joystick */
   PL_MENU_OPTION("Up",       JOY|0x08)
   PL_MENU_OPTION("Down",     JOY|0x04)
@@ -184,9 +261,13 @@ PL_MENU_ITEMS_BEGIN(OptionMenuDef)
   PL_MENU_HEADER("Video")
   PL_MENU_ITEM("Screen size", OPTION_DISPLAY_MODE, ScreenSizeOptions,
                "\026\250\020 Change screen size")
+  PL_MENU_ITEM("Ghosting", OPTION_GHOSTING, GhostingOptions,
+               "\026\250\020 Blend recent frames, as the LCD did. Off while run-ahead is on")
   PL_MENU_HEADER("Input")
   PL_MENU_ITEM("Rate of autofire", OPTION_AUTOFIRE, AutofireOptions, 
                "\026\250\020 Adjust rate of autofire")
+  PL_MENU_ITEM("Run-ahead", OPTION_RUN_AHEAD, RunAheadOptions,
+               "\026\250\020 Reduce input lag; each frame costs CPU time. Turns off ghosting")
   PL_MENU_HEADER("Performance")
   PL_MENU_ITEM("Frame limiter", OPTION_SYNC_FREQ, FrameLimitOptions,
                "\026\250\020 Change screen update frequency")
@@ -198,6 +279,11 @@ PL_MENU_ITEMS_BEGIN(OptionMenuDef)
                "\026\250\020 Larger values: faster emulation, faster battery depletion (default: 222MHz)")
   PL_MENU_ITEM("Show FPS counter",    OPTION_SHOW_FPS, ToggleOptions,
                "\026\250\020 Show/hide the frames-per-second counter")
+  PL_MENU_HEADER("Rewind")
+  PL_MENU_ITEM("Rewind mode", OPTION_REWIND_MODE, RewindModeOptions,
+               "\026\250\020 Snapshots: instant; keyframes + input: much longer history")
+  PL_MENU_ITEM("Keyframe spacing", OPTION_REWIND_KEYS, RewindKeyOptions,
+               "\026\250\020 Longer spacing: longer history, slower rewinding")
   PL_MENU_HEADER("Menu")
   PL_MENU_ITEM("Button mode", OPTION_CONTROL_MODE, ControlModeOptions,
                "\026\250\020 Change OK and Cancel button mapping")
@@ -250,6 +336,15 @@ PL_MENU_ITEMS_BEGIN(SystemMenuDef)
   PL_MENU_ITEM("Reset", SYSTEM_RESET, NULL, "\026\001\020 Reset")
   PL_MENU_ITEM("Save screenshot",  SYSTEM_SCRNSHOT, NULL,
     "\026\001\020 Save screenshot")
+  PL_MENU_ITEM("Settings apply to", SYSTEM_GAME_CONFIG, GameConfigOptions,
+    "\026\250\020 Keep clock, colors and run-ahead for this game only")
+  PL_MENU_HEADER("Movie")
+  PL_MENU_ITEM("Record movie", SYSTEM_MOVIE_RECORD, NULL,
+    "\026\001\020 Record input from the current state")
+  PL_MENU_ITEM("Play movie", SYSTEM_MOVIE_PLAY, NULL,
+    "\026\001\020 Play back the recorded movie")
+  PL_MENU_ITEM("Stop movie", SYSTEM_MOVIE_STOP, NULL,
+    "\026\001\020 Stop recording/playback")
 PL_MENU_ITEMS_END
 
 PspUiSplash SplashScreen =
@@ -262,7 +357,7 @@ PspUiSplash SplashScreen =
 
 PspUiGallery SaveStateGallery = 
 {
-  OnGenericRender,             /* OnRender() */
+  OnSaveStateRender,           /* OnRender() */
   OnSaveStateOk,               /* OnOk() */
   OnGenericCancel,             /* OnCancel() */
   OnSaveStateButtonPress,      /* OnButtonPress() */
@@ -371,12 +466,27 @@ int InitMenu()
   /* Reset variables */
   TabIndex = TAB_ABOUT;
   Background = NULL;
-  rom_buffer = NULL;
+  Rom = NULL;
 
   /* Initialize paths */
   sprintf(SaveStatePath, "%sstates", pl_psp_get_app_directory());
   sceIoMkdir(SaveStatePath, 0777);
   sprintf(SaveStatePath, "%sstates/", pl_psp_get_app_directory());
+  sprintf(MoviePath, "%smovies", pl_psp_get_app_directory());
+  sceIoMkdir(MoviePath, 0777);
+  sprintf(MoviePath, "%smovies/", pl_psp_get_app_directory());
+
+  /* Load the ROM index */
+  sprintf(LibraryPath, "%slibrary.idx", pl_psp_get_app_directory());
+  InitLibrary(&RomLibrary);
+  InitLibraryScan(&RomScan);
+  LoadLibraryIndex(&RomLibrary, LibraryPath);
+
+  /* Load per-game settings */
+  sprintf(GameDbPath, "%sgames.db", pl_psp_get_app_directory());
+  InitGameDb(&GameSettings);
+  LoadGameDb(&GameSettings, GameDbPath);
+  GameOverride = 0;
   sprintf(ScreenshotPath, "ms0:/PSP/PHOTO/%s/", PSP_APP_NAME);
   sprintf(GamePath, "%s", pl_psp_get_app_directory());
 
@@ -392,11 +502,16 @@ int InitMenu()
   /* Init NoSaveState icon image */
   NoSaveIcon = pspImageCreate(80, 80, PSP_IMAGE_16BPP);
   pspImageClear(NoSaveIcon, RGB(0x1a,0x44,0x44));
+  LoadingIcon = pspImageCreate(80, 80, PSP_IMAGE_16BPP);
+  pspImageClear(LoadingIcon, RGB(0x22,0x55,0x55));
+
+  /* Thumbnails are decoded in the background */
+  InitIconCache(&StateIcons, LoadStateIcon);
 
   /* Initialize state menu */
   int i;
   pl_menu_item *item;
-  for (i = 0; i < 10; i++)
+  for (i = 0; i < STATE_SLOTS; i++)
   {
     item = pl_menu_append_item(&SaveStateGallery.Menu, i, NULL);
     pl_menu_set_item_help_text(item, EmptySlotText);
@@ -476,12 +591,19 @@ void DisplayMenu()
         pspUiOpenMenu(&ControlUiMenu, NULL);
         break;
       case TAB_QUICKLOAD:
+        /* Index new and changed ROMs while the browser is up; unchanged */
+        /* ones aren't read */
+        StartLibraryScan(&RomScan, &RomLibrary, GamePath,
+          ROM_EXTENSIONS, 0);
+
         pspUiOpenBrowser(&QuickloadBrowser,
                         (GAME_LOADED) ? CURRENT_GAME : GamePath);
         break;
       case TAB_SYSTEM:
         item = pl_menu_find_item_by_id(&SystemUiMenu.Menu, SYSTEM_COLORS);
         pl_menu_select_option_by_value(item, (void*)Options.ColorScheme);
+        item = pl_menu_find_item_by_id(&SystemUiMenu.Menu, SYSTEM_GAME_CONFIG);
+        pl_menu_select_option_by_value(item, (void*)GameOverride);
 
         pspUiOpenMenu(&SystemUiMenu, NULL);
         break;
@@ -505,6 +627,14 @@ void DisplayMenu()
         pl_menu_select_option_by_value(item, (void*)UiMetric.Animate);
         item = pl_menu_find_item_by_id(&OptionUiMenu.Menu, OPTION_AUTOFIRE);
         pl_menu_select_option_by_value(item, (void*)Options.AutoFire);
+        item = pl_menu_find_item_by_id(&OptionUiMenu.Menu, OPTION_RUN_AHEAD);
+        pl_menu_select_option_by_value(item, (void*)Options.RunAhead);
+        item = pl_menu_find_item_by_id(&OptionUiMenu.Menu, OPTION_GHOSTING);
+        pl_menu_select_option_by_value(item, (void*)Options.Ghosting);
+        item = pl_menu_find_item_by_id(&OptionUiMenu.Menu, OPTION_REWIND_MODE);
+        pl_menu_select_option_by_value(item, (void*)Options.RewindMode);
+        item = pl_menu_find_item_by_id(&OptionUiMenu.Menu, OPTION_REWIND_KEYS);
+        pl_menu_select_option_by_value(item, (void*)Options.RewindKeyInterval);
         pspUiOpenMenu(&OptionUiMenu, NULL);
         break;
       case TAB_ABOUT:
@@ -524,6 +654,9 @@ void DisplayMenu()
       if (ResumeEmulation)
       {
         supervision_set_color_scheme(Options.ColorScheme);
+        /* Ghosting history isn't part of the state, so frames run */
+        /* ahead and then discarded would blur into the next one */
+        supervision_set_ghosting(Options.RunAhead ? 0 : Options.Ghosting);
 
         if (UiMetric.Animate) pspUiFadeout();
         RunEmulator();
@@ -537,12 +670,22 @@ void TrashMenu()
 {
   TrashEmulator();
 
-  if (rom_buffer)
-    free(rom_buffer);
+  pl_rom_release(Rom);
 
-  /* Save options */
+  /* Save options (the global values, not the current game's) */
+  SetGameOverride(0);
   SaveOptions();
 
+  /* Save per-game settings */
+  if (GameSettings.Dirty)
+    SaveGameDb(&GameSettings, GameDbPath);
+  TrashGameDb(&GameSettings);
+
+  /* Save the ROM index */
+  FinishLibraryScan(&RomScan);
+  SaveLibraryIndex(&RomLibrary, LibraryPath);
+  TrashLibrary(&RomLibrary);
+
   /* Trash menus */
   pl_menu_destroy(&SystemUiMenu.Menu);
   pl_menu_destroy(&OptionUiMenu.Menu);
@@ -552,124 +695,202 @@ void TrashMenu()
   /* Trash images */
   if (Background) pspImageDestroy(Background);
   if (NoSaveIcon) pspImageDestroy(NoSaveIcon);
+  if (LoadingIcon) pspImageDestroy(LoadingIcon);
+
+  TrashIconCache(&StateIcons);
 }
 
-static int psp_load_rom(const char *path)
+/* Source for the first ROM in a ZIP archive */
+static int ReadZipEntry(pl_rom_source *source, void *buffer, unsigned int length)
 {
-  uint file_size = 0;
-
-  if (pl_file_is_of_type(path, "ZIP"))
-  {
-    char archived_file[512];
-    unzFile zipfile = NULL;
-    unz_global_info gi;
-    unz_file_info fi;
+  return unzReadCurrentFile((unzFile)source->handle, buffer, length);
+}
 
-    /* Open archive for reading */
-    if (!(zipfile = unzOpen(path)))
-      return 0;
+static int CloseZipEntry(pl_rom_source *source)
+{
+  int status = unzCloseCurrentFile((unzFile)source->handle); /* checks CRC */
+  unzClose((unzFile)source->handle);
+  return status == UNZ_OK;
+}
 
-    /* Get global ZIP file information */
-    if (unzGetGlobalInfo(zipfile, &gi) != UNZ_OK)
-    {
-      unzClose(zipfile);
-      return 0;
-    }
+/* name receives the member's name */
+static int OpenZipEntry(pl_rom_source *source, const char *path,
+                        char *name, int name_size)
+{
+  unzFile zipfile;
+  const unz_dir_entry *entries;
+  uLong count, i;
+  const char **ext;
 
-    const char *extension;
-    int i, j;
+  /* Open archive for reading */
+  if (!(zipfile = unzOpen(path)))
+    return 0;
 
-    for (i = 0; i < (int)gi.number_entry; i++)
+  /* Read the central directory in one go */
+  if (unzCacheCentralDir(zipfile) == UNZ_OK
+    && unzGetDirIndex(zipfile, &entries, &count) == UNZ_OK)
+  {
+    for (i = 0; i < count; i++)
     {
-      /* Get name of the archived file */
-      if (unzGetCurrentFileInfo(zipfile, &fi, archived_file, 
-          sizeof(archived_file), NULL, 0, NULL, 0) != UNZ_OK)
-      {
-        unzClose(zipfile);
-        return 0;
-      }
-
-      extension = pl_file_get_extension(archived_file);
-      for (j = 1; QuickloadFilter[j]; j++)
+      for (ext = ROM_EXTENSIONS; *ext; ext++)
       {
-        if (strcasecmp(QuickloadFilter[j], extension) == 0)
+        if (strcasecmp(*ext, entries[i].extension) == 0)
         {
-          file_size = fi.uncompressed_size;
+          unz_file_pos file_pos = entries[i].file_pos;
 
           /* Open archived file for reading */
-          if(unzOpenCurrentFile(zipfile) != UNZ_OK)
-          {
-            unzClose(zipfile);
-            return 0;
-          }
-
-          if (rom_buffer)
-          {
-            free(rom_buffer);
-            rom_buffer = NULL;
-          }
-
-          if (!(rom_buffer = (uint8*)malloc(file_size)))
-          {
-            unzCloseCurrentFile(zipfile);
-            unzClose(zipfile); 
-            return 0;
-          }
-
-          unzReadCurrentFile(zipfile, rom_buffer, file_size);
-          unzCloseCurrentFile(zipfile);
-          unzClose(zipfile);
-          goto done;
-        }
-      }
-
-      /* Go to the next file in the archive */
-      if (i + 1 < (int)gi.number_entry)
-      {
-        if (unzGoToNextFile(zipfile) != UNZ_OK)
-        {
-          unzClose(zipfile);
-          return 0;
+          if (unzGoToFilePos(zipfile, &file_pos) != UNZ_OK
+            || unzOpenCurrentFile(zipfile) != UNZ_OK)
+            goto error;
+
+          snprintf(name, name_size, "%s", entries[i].filename);
+          source->size = entries[i].uncompressed_size;
+          source->handle = zipfile;
+          source->read = ReadZipEntry;
+          source->close = CloseZipEntry;
+          return 1;
         }
       }
     }
-
-    unzClose(zipfile);
-    return 0; /* no valid files in archive */
   }
-  else
-  {
-	  FILE*	file;
-	  if (!(file = fopen(path,"rb")))
-      return 0;
 
-    if (rom_buffer)
-    {
-      free(rom_buffer);
-      rom_buffer = NULL;
-    }
+error:
+  unzClose(zipfile);
+  return 0; /* no valid files in archive */
+}
 
-	  fseek(file,0,SEEK_END);
-	  file_size = (uint)ftell(file);
-	  fseek(file, 0, SEEK_SET);
+/* CRC of a ROM from the index, if its file hasn't changed since it */
+/* was indexed. A scan still running owns the index, and isn't waited */
+/* for */
+static int GetIndexedCrc(const char *path, const char *entry, u32 size,
+                         uint32_t *crc)
+{
+  const LibraryEntry *indexed;
+  SceIoStat stat;
+  u64 modified = 0;
 
-	  if (!(rom_buffer = (uint8 *)malloc(file_size)))
-    {
-      fclose(file);
-      return 0;
-    }
+  if (!PollLibraryScan(&RomScan) || sceIoGetstat(path, &stat) < 0)
+    return 0;
+  sceRtcGetTick(&stat.st_mtime, &modified);
 
-	  fread(rom_buffer,1,file_size,file);
-	  fclose(file);
+  if (!(indexed = FindLibraryEntry(&RomLibrary, path, entry))
+    || indexed->Size != size || indexed->FileSize != (u32)stat.st_size
+    || indexed->Modified != modified)
+    return 0;
+
+  *crc = indexed->Crc;
+  return 1;
+}
+
+static int psp_load_rom(const char *path)
+{
+  pl_rom_source source;
+  pl_rom *rom;
+  pl_file_path entry;
+
+  /* Compressed ROMs are inflated straight into the image; sizes that */
+  /* aren't whole banks are refused before anything is allocated */
+  entry[0] = '\0';
+  if (pl_file_is_of_type(path, "ZIP"))
+    rom = (OpenZipEntry(&source, path, entry, sizeof(entry)))
+      ? pl_rom_load(&source, ROM_BANK_SIZE) : NULL;
+  else if (pl_file_is_of_type(path, "GZ"))
+    rom = (pl_rom_source_gzip(&source, path))
+      ? pl_rom_load(&source, ROM_BANK_SIZE) : NULL;
+  else
+    rom = pl_rom_open(path, ROM_BANK_SIZE);
+
+  if (!rom)
+    return 0;
+
+  /* On failure, the core keeps running the previous ROM */
+  if (!supervision_load(rom->data, rom->size))
+  {
+    pl_rom_release(rom);
+    return 0;
   }
 
-done:
-	supervision_load(rom_buffer, file_size);
   SET_AS_CURRENT_GAME(path);
 
+  /* The core no longer points into the previous ROM */
+  pl_rom_release(Rom);
+  Rom = rom;
+
+  /* Identifies the ROM a movie was recorded with, and its settings */
+  if (!GetIndexedCrc(path, (entry[0]) ? entry : NULL, Rom->size, &RomCrc))
+    pl_util_compute_crc32_buffer(Rom->data, Rom->size, &RomCrc);
+
+  /* A movie is tied to the game it started with */
+  pl_movie_stop(&Movie);
+
+  /* Restore the previous game's overrides, apply this one's */
+  SetGameOverride(0);
+  if (FindGameConfig(&GameSettings, RomCrc))
+    SetGameOverride(1);
+
 	return 1;
 }
 
+/* Copies the settings a config overrides into Options */
+static void ApplyGameConfig(const GameConfig *config)
+{
+  if (config->Fields & GAMECFG_CLOCK_FREQ)
+    Options.ClockFreq = config->ClockFreq;
+  if (config->Fields & GAMECFG_FRAMESKIP)
+    Options.Frameskip = config->Frameskip;
+  if (config->Fields & GAMECFG_COLORS)
+    Options.ColorScheme = config->ColorScheme;
+  if (config->Fields & GAMECFG_GHOSTING)
+    Options.Ghosting = config->Ghosting;
+  if (config->Fields & GAMECFG_RUN_AHEAD)
+    Options.RunAhead = config->RunAhead;
+}
+
+/* Copies the current settings into the fields of a config */
+static void StoreGameConfig(GameConfig *config)
+{
+  if (config->Fields & GAMECFG_CLOCK_FREQ)
+    config->ClockFreq = Options.ClockFreq;
+  if (config->Fields & GAMECFG_FRAMESKIP)
+    config->Frameskip = Options.Frameskip;
+  if (config->Fields & GAMECFG_COLORS)
+    config->ColorScheme = Options.ColorScheme;
+  if (config->Fields & GAMECFG_GHOSTING)
+    config->Ghosting = Options.Ghosting;
+  if (config->Fields & GAMECFG_RUN_AHEAD)
+    config->RunAhead = Options.RunAhead;
+}
+
+/* Switches between the global settings and the current game's */
+static void SetGameOverride(int enable)
+{
+  GameConfig *config;
+
+  if (enable == GameOverride)
+    return;
+
+  if (!enable)
+  {
+    ApplyGameConfig(&GlobalSettings);
+    GameOverride = 0;
+    return;
+  }
+
+  /* A new config starts out with the current settings */
+  if (!(config = FindGameConfig(&GameSettings, RomCrc)))
+  {
+    if (!(config = AddGameConfig(&GameSettings, RomCrc)))
+      return;
+    config->Fields = GAMECFG_ALL;
+    StoreGameConfig(config);
+  }
+
+  GlobalSettings.Fields = GAMECFG_ALL;
+  StoreGameConfig(&GlobalSettings);
+  ApplyGameConfig(config);
+  GameOverride = 1;
+}
+
 /* Save options */
 static int SaveOptions()
 {
@@ -687,9 +908,13 @@ static int SaveOptions()
   pl_ini_set_int(&init, "Video", "VSync", Options.VSync);
   pl_ini_set_int(&init, "Video", "PSP Clock Frequency",Options.ClockFreq);
   pl_ini_set_int(&init, "Video", "Show FPS", Options.ShowFps);
+  pl_ini_set_int(&init, "Video", "Ghosting", Options.Ghosting);
   pl_ini_set_int(&init, "Menu", "Control Mode", Options.ControlMode);
   pl_ini_set_int(&init, "Menu", "Animate", UiMetric.Animate);
   pl_ini_set_int(&init, "Input", "Autofire", Options.AutoFire);
+  pl_ini_set_int(&init, "Input", "Run-ahead", Options.RunAhead);
+  pl_ini_set_int(&init, "Rewind", "Mode", Options.RewindMode);
+  pl_ini_set_int(&init, "Rewind", "Keyframe Interval", Options.RewindKeyInterval);
   pl_ini_set_string(&init, "File", "Game Path", GamePath);
 
   pl_ini_set_int(&init, "System", "Color Scheme", Options.ColorScheme);
@@ -720,9 +945,16 @@ static void LoadOptions()
   Options.VSync = pl_ini_get_int(&init, "Video", "VSync", 0);
   Options.ClockFreq = pl_ini_get_int(&init, "Video", "PSP Clock Frequency", 222);
   Options.ShowFps = pl_ini_get_int(&init, "Video", "Show FPS", 0);
+  Options.Ghosting = pl_ini_get_int(&init, "Video", "Ghosting", 0);
   Options.ControlMode = pl_ini_get_int(&init, "Menu", "Control Mode", 0);
   UiMetric.Animate = pl_ini_get_int(&init, "Menu", "Animate", 1);
   Options.AutoFire = pl_ini_get_int(&init, "Input", "Autofire", 2);
+  Options.RunAhead = pl_ini_get_int(&init, "Input", "Run-ahead", 0);
+  Options.RewindMode = pl_ini_get_int(&init, "Rewind", "Mode", PL_REWIND_DELTA);
+  Options.RewindKeyInterval = pl_ini_get_int(&init, "Rewind", "Keyframe Interval",
+    PL_REWIND_KEY_INTERVAL);
+  if (Options.RewindKeyInterval > PL_REWIND_MAX_KEY_INTERVAL)
+    Options.RewindKeyInterval = PL_REWIND_MAX_KEY_INTERVAL;
   pl_ini_get_string(&init, "File", "Game Path", NULL, GamePath, sizeof(GamePath));
 
   Options.ColorScheme = pl_ini_get_int(&init, "System", "Color Scheme", SV_COLOR_SCHEME_DEFAULT);
@@ -883,9 +1115,35 @@ static int OnMenuItemChanged(const struct PspUiMenu *uimenu,
     case OPTION_AUTOFIRE:
       Options.AutoFire = (int)option->value;
       break;
+    case OPTION_RUN_AHEAD:
+      Options.RunAhead = (int)option->value;
+      break;
+    case OPTION_GHOSTING:
+      Options.Ghosting = (int)option->value;
+      break;
+    case OPTION_REWIND_MODE:
+      Options.RewindMode = (int)option->value;
+      break;
+    case OPTION_REWIND_KEYS:
+      Options.RewindKeyInterval = (int)option->value;
+      break;
     case SYSTEM_COLORS:
       Options.ColorScheme = (int)option->value;
       break;
+    case SYSTEM_GAME_CONFIG:
+      if (!GAME_LOADED)
+        return 0;
+      SetGameOverride((int)option->value);
+      if (!(int)option->value)
+        RemoveGameConfig(&GameSettings, RomCrc);
+      break;
+    }
+
+    /* Changes to overridden settings stay with the current game */
+    if (GameOverride)
+    {
+      StoreGameConfig(FindGameConfig(&GameSettings, RomCrc));
+      GameSettings.Dirty = 1;
     }
   }
 
@@ -917,15 +1175,43 @@ static int OnMenuOk(const void *uimenu, const void* sel_item)
       }
       break;
 
+    case SYSTEM_MOVIE_RECORD:
+    case SYSTEM_MOVIE_PLAY:
+    case SYSTEM_MOVIE_STOP:
+      if (OnMovie(((const pl_menu_item*)sel_item)->id))
+      {
+        ResumeEmulation = 1;
+        return 1;
+      }
+      break;
+
     case SYSTEM_SCRNSHOT:
 
-      /* Save screenshot */
-      if (!pl_util_save_image_seq(ScreenshotPath,
-                                  pl_file_get_filename(CURRENT_GAME),
-                                  Screen))
-        pspUiAlert("ERROR: Screenshot not saved");
-      else
-        pspUiAlert("Screenshot saved successfully");
+      /* Save screenshot as a 2-bit palette PNG of the LCD. What's on */
+      /* screen differs from it with ghosting (blended frames) or */
+      /* run-ahead (a later frame); save the screen itself then */
+      {
+        uint8 frame[SV_FRAME_2BPP_SIZE], rgb[12];
+        int status;
+
+        if (Options.Ghosting || Options.RunAhead)
+          status = pl_util_save_image_seq(ScreenshotPath,
+                                          pl_file_get_filename(CURRENT_GAME),
+                                          Screen);
+        else
+        {
+          supervision_get_frame_2bpp(frame);
+          supervision_get_palette(rgb);
+          status = pl_util_save_indexed_seq(ScreenshotPath,
+                                            pl_file_get_filename(CURRENT_GAME),
+                                            frame, SV_W, SV_H, 2, rgb, 4);
+        }
+
+        if (!status)
+          pspUiAlert("ERROR: Screenshot not saved");
+        else
+          pspUiAlert("Screenshot saved successfully");
+      }
       break;
     }
   }
@@ -1034,21 +1320,14 @@ static int OnSaveStateButtonPress(const PspUiGallery *gallery,
         pspUiFlashMessage("Saving, please wait ...");
 
         PspImage *icon;
-        if (!(icon = SaveState(path, Screen)))
+        if (!(icon = SaveState(path)))
         {
           pspUiAlert("ERROR: State not saved");
           break;
         }
 
         SceIoStat stat;
-
-        /* Trash the old icon (if any) */
-        if (sel->param && sel->param != NoSaveIcon)
-          pspImageDestroy((PspImage*)sel->param);
-
-        /* Update icon, help text */
-        sel->param = icon;
-        pl_menu_set_item_help_text(sel, PresentSlotText);
+        memset(&stat, 0, sizeof(stat));
 
         /* Get file modification time/date */
         if (sceIoGetstat(path, &stat) < 0)
@@ -1061,6 +1340,11 @@ static int OnSaveStateButtonPress(const PspUiGallery *gallery,
             stat.st_mtime.hour,
             stat.st_mtime.minute);
 
+        /* Update icon (replacing the old one in the cache), help text */
+        PendingIcons[sel->id] = NULL;
+        sel->param = StoreIcon(&StateIcons, path, &stat.st_mtime, icon);
+        pl_menu_set_item_help_text(sel, PresentSlotText);
+
         pl_menu_set_item_caption(sel, caption);
       }
       else if (button_mask & PSP_CTRL_TRIANGLE)
@@ -1074,12 +1358,16 @@ static int OnSaveStateButtonPress(const PspUiGallery *gallery,
           break;
         }
 
-        /* Trash the old icon (if any) */
-        if (sel->param && sel->param != NoSaveIcon)
-          pspImageDestroy((PspImage*)sel->param);
+        /* Legacy states keep the state data in a separate file */
+        char *legacy_path = GetLegacyStatePath(path);
+        if (pl_file_exists(legacy_path))
+          pl_file_rm(legacy_path);
+        free(legacy_path);
 
-        /* Update icon, caption */
+        /* Update icon, caption; then trash the old icon (if any) */
+        PendingIcons[sel->id] = NULL;
         sel->param = NoSaveIcon;
+        DropIcon(&StateIcons, path);
         pl_menu_set_item_help_text(sel, EmptySlotText);
         pl_menu_set_item_caption(sel, "Empty");
       }
@@ -1111,6 +1399,65 @@ static void OnSystemRender(const void *uiobject, const void *item_obj)
   OnGenericRender(uiobject, item_obj);
 }
 
+/* Swaps in thumbnails as they're decoded; the ones nearest the */
+/* selection are decoded first */
+static void OnSaveStateRender(const void *uiobject, const void *item_obj)
+{
+  const pl_menu_item *sel = (const pl_menu_item*)item_obj;
+  pl_menu_item *item;
+  PspImage *icon;
+
+  for (item = SaveStateGallery.Menu.items; item; item = item->next)
+  {
+    if (!PendingIcons[item->id])
+      continue;
+
+    if (PollIcon(&StateIcons, PendingIcons[item->id], &icon))
+    {
+      item->param = icon;
+      PendingIcons[item->id] = NULL;
+    }
+    else if (sel)
+      PrioritizeIcon(&StateIcons, PendingIcons[item->id],
+        abs(item->id - sel->id));
+  }
+
+  OnGenericRender(uiobject, item_obj);
+}
+
+/* Save state container: header, PNG thumbnail, state data */
+#define STATE_MAGIC "SVSC"
+
+typedef struct StateHeader
+{
+  char Magic[4];
+  u32  ThumbOffset;
+  u32  ThumbLength;
+  u32  StateOffset;
+  u32  StateLength;
+} StateHeader;
+
+/* Returns 0 for legacy states (PNG, with the state in a separate file) */
+static int ReadStateHeader(FILE *f, StateHeader *header)
+{
+  if (fread(header, sizeof(StateHeader), 1, f) != 1
+    || strncmp(header->Magic, STATE_MAGIC, 4) != 0)
+  {
+    rewind(f);
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Path of the separate state file of legacy states */
+static char* GetLegacyStatePath(const char *path)
+{
+  char *legacy_path = (char*)malloc(strlen(path) + 6);
+  sprintf(legacy_path, "%s0.svst", path);
+  return legacy_path;
+}
+
 /* Load state icon */
 static PspImage* LoadStateIcon(const char *path)
 {
@@ -1118,6 +1465,15 @@ static PspImage* LoadStateIcon(const char *path)
   FILE *f = fopen(path, "r");
   if (!f) return NULL;
 
+  /* Seek to the thumbnail */
+  StateHeader header;
+  if (ReadStateHeader(f, &header)
+    && fseek(f, header.ThumbOffset, SEEK_SET) != 0)
+  {
+    fclose(f);
+    return NULL;
+  }
+
   /* Load image */
   PspImage *image = pspImageLoadPngFd(f);
   fclose(f);
@@ -1132,50 +1488,187 @@ static int LoadState(const char *path)
   FILE *f = fopen(path, "r");
   if (!f) return 0;
 
-  /* Load image into temporary object */
-  PspImage *image = pspImageLoadPngFd(f);
-  pspImageDestroy(image);
+  StateHeader header;
+  if (!ReadStateHeader(f, &header))
+  {
+    /* Legacy state - skip the thumbnail, load the separate file */
+    fclose(f);
+    return supervision_load_state(path, 0);
+  }
 
+  /* Seek straight to the state data */
   int status = 0;
-  status = supervision_load_state(path, 0);
+  void *data = malloc(header.StateLength);
+  if (data && fseek(f, header.StateOffset, SEEK_SET) == 0
+    && fread(data, header.StateLength, 1, f) == 1)
+    status = supervision_unserialize(data, header.StateLength);
+
+  free(data);
   fclose(f);
 
   return status;
 }
 
+/* Gallery icon of a 2bpp frame; an indexed image, like the PNG */
+static PspImage* CreateFrameIcon(const uint8 *frame, const uint8 *rgb)
+{
+  PspImage *icon;
+  if (!(icon = pspImageCreateOptimized(SV_W, SV_H, PSP_IMAGE_INDEXED)))
+    return NULL;
+
+  int i, x, y;
+  for (i = 0; i < 4; i++)
+    icon->Palette[i] = RGB(rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+
+  /* Leftmost pixel in the most significant bits */
+  u8 *row = (u8*)icon->Pixels;
+  for (y = 0; y < SV_H; y++, row += icon->Width)
+    for (x = 0; x < SV_W; x++)
+      row[x] = (frame[(y * SV_W + x) >> 2] >> ((3 - (x & 3)) << 1)) & 3;
+
+  return icon;
+}
+
 /* Save state */
-static PspImage* SaveState(const char *path, PspImage *icon)
+static PspImage* SaveState(const char *path)
 {
+  /* Serialize the state */
+  StateHeader header;
+  memcpy(header.Magic, STATE_MAGIC, 4);
+  header.StateLength = supervision_state_size();
+
+  void *data = malloc(header.StateLength);
+  if (!data) return NULL;
+  supervision_serialize(data, header.StateLength);
+
   /* Open file for writing */
   FILE *f;
   if (!(f = fopen(path, "w")))
+  {
+    free(data);
     return NULL;
+  }
 
-  /* Create thumbnail */
-  PspImage *thumb;
-  thumb = (icon->Viewport.Width < 200)
-    ? pspImageCreateCopy(icon) : pspImageCreateThumbnail(icon);
-  if (!thumb) { fclose(f); return NULL; }
+  /* The file gets the frame as a 2-bit palette PNG; the loader */
+  /* expands it back to RGB. The gallery gets it as an indexed image */
+  uint8 frame[SV_FRAME_2BPP_SIZE], rgb[12];
+  supervision_get_frame_2bpp(frame);
+  supervision_get_palette(rgb);
 
-  /* Write the thumbnail */
-  if (!pspImageSavePngFd(f, thumb))
+  PspImage *thumb;
+  if (!(thumb = CreateFrameIcon(frame, rgb)))
   {
-    pspImageDestroy(thumb);
+    free(data);
     fclose(f);
     return NULL;
   }
 
-  /* Save state */
-  if (!supervision_save_state(path, 0))
+  /* Write the thumbnail after a placeholder header */
+  int status = fwrite(&header, sizeof(header), 1, f) == 1;
+  header.ThumbOffset = sizeof(header);
+  status = status
+    && pspImageSavePngIndexedFd(f, frame, SV_W, SV_H, 2, rgb, 4);
+  header.ThumbLength = ftell(f) - header.ThumbOffset;
+
+  /* Write the state, then the final header */
+  header.StateOffset = header.ThumbOffset + header.ThumbLength;
+  status = status
+    && fwrite(data, header.StateLength, 1, f) == 1
+    && fseek(f, 0, SEEK_SET) == 0
+    && fwrite(&header, sizeof(header), 1, f) == 1;
+
+  free(data);
+  if (fclose(f) != 0) status = 0;
+
+  if (!status)
   {
     pspImageDestroy(thumb);
-    thumb = NULL;
+    return NULL;
   }
 
-  fclose(f);
+  /* Remove the separate state file a legacy state may have left */
+  char *legacy_path = GetLegacyStatePath(path);
+  if (pl_file_exists(legacy_path))
+    pl_file_rm(legacy_path);
+  free(legacy_path);
+
   return thumb;
 }
 
+/* Record/play/stop the movie of the current game; returns nonzero */
+/* if the emulation should resume */
+static int OnMovie(int id)
+{
+  if (!GAME_LOADED)
+    return 0;
+
+  const char *config_name = pl_file_get_filename(CURRENT_GAME);
+  char *path = (char*)malloc(strlen(MoviePath) + strlen(config_name) + 5);
+  sprintf(path, "%s%s.svm", MoviePath, config_name);
+
+  int resume = 0;
+  switch (id)
+  {
+  case SYSTEM_MOVIE_RECORD:
+    if (pl_file_exists(path) && !pspUiConfirm("Overwrite existing movie?"))
+      break;
+
+    /* Start from the current state */
+    {
+      uint32 size = supervision_state_size();
+      void *state = malloc(size);
+      if (state && supervision_serialize(state, size)
+        && pl_movie_record(&Movie, path, RomCrc, state, size))
+        resume = 1;
+      else
+        pspUiAlert("ERROR: Recording not started");
+      free(state);
+    }
+    break;
+
+  case SYSTEM_MOVIE_PLAY:
+    if (!pl_movie_play(&Movie, path))
+    {
+      pspUiAlert("ERROR: Movie not loaded");
+      break;
+    }
+
+    if (Movie.rom_crc != RomCrc
+      && !pspUiConfirm("The movie was recorded with a different ROM. Play anyway?"))
+    {
+      pl_movie_stop(&Movie);
+      break;
+    }
+
+    if (Movie.state)
+      resume = supervision_unserialize(Movie.state, Movie.state_size);
+    else
+    {
+      supervision_reset();
+      resume = 1;
+    }
+
+    if (!resume)
+    {
+      pl_movie_stop(&Movie);
+      pspUiAlert("ERROR: Movie not loaded");
+    }
+    break;
+
+  case SYSTEM_MOVIE_STOP:
+    if (Movie.mode == PL_MOVIE_IDLE)
+      pspUiAlert("No movie is being recorded or played");
+    else if (!pl_movie_stop(&Movie))
+      pspUiAlert("ERROR: Movie not saved");
+    else
+      pspUiAlert("Movie stopped");
+    break;
+  }
+
+  free(path);
+  return resume;
+}
+
 /* Initialize game configuration */
 static void InitButtonConfig()
 {
@@ -1254,6 +1747,7 @@ static void DisplayStateTab()
 
     if (pl_file_exists(path))
     {
+      memset(&stat, 0, sizeof(stat));
       if (sceIoGetstat(path, &stat) < 0)
         sprintf(caption, "ERROR");
       else
@@ -1274,8 +1768,16 @@ static void DisplayStateTab()
       }
 
       pl_menu_set_item_caption(item, caption);
-      item->param = LoadStateIcon(path);
       pl_menu_set_item_help_text(item, PresentSlotText);
+
+      /* Cached thumbnails show right away, others once they're decoded */
+      PspImage *icon = NULL;
+      if ((PendingIcons[item->id] = RequestIcon(&StateIcons, path, &stat.st_mtime))
+        && !PollIcon(&StateIcons, PendingIcons[item->id], &icon))
+        icon = LoadingIcon;
+      else
+        PendingIcons[item->id] = NULL;
+      item->param = icon;
     }
     else
     {
@@ -1294,9 +1796,13 @@ static void DisplayStateTab()
   pspUiOpenGallery(&SaveStateGallery, game_name);
   free(game_name);
 
-  /* Destroy any icons */
+  /* Icons that are no longer displayed may be evicted */
   for (item = SaveStateGallery.Menu.items; item; item = item->next)
-    if (item->param != NULL && item->param != NoSaveIcon)
-      pspImageDestroy((PspImage*)item->param);
+  {
+    PendingIcons[item->id] = NULL;
+    if (item->param != NoSaveIcon)
+      item->param = NULL;
+  }
+  ReleaseIcons(&StateIcons);
 }
 
@@ -149,6 +149,11 @@ typedef struct
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const unsigned long* pcrc_32_tab;
 #    endif
+
+    unsigned char* central_dir; /* cached central dir, or NULL */
+    unz_dir_entry* dir_index;   /* index of the cached central dir */
+    char* dir_names;            /* names referenced by the index */
+    uLong dir_count;
 } unz_s;
 
 
@@ -488,6 +493,10 @@ extern unzFile ZEXPORT unzOpen2 (path, pzlib_filefunc_def)
     us.central_pos = central_pos;
     us.pfile_in_zip_read = NULL;
     us.encrypted = 0;
+    us.central_dir = NULL;
+    us.dir_index = NULL;
+    us.dir_names = NULL;
+    us.dir_count = 0;
 
 
     s=(unz_s*)ALLOC(sizeof(unz_s));
@@ -520,6 +529,9 @@ extern int ZEXPORT unzClose (file)
         unzCloseCurrentFile(file);
 
     ZCLOSE(s->z_filefunc, s->filestream);
+    TRYFREE(s->central_dir);
+    TRYFREE(s->dir_index);
+    TRYFREE(s->dir_names);
     TRYFREE(s);
     return UNZ_OK;
 }
@@ -574,6 +586,135 @@ local int unzlocal_GetCurrentFileInfoInternal OF((unzFile file,
                                                   char *szComment,
                                                   uLong commentBufferSize));
 
+/*
+  Little-endian fields of the cached central dir
+*/
+local uLong unzlocal_bufShort OF((const unsigned char* p));
+local uLong unzlocal_bufShort (p)
+    const unsigned char* p;
+{
+    return (uLong)p[0] | ((uLong)p[1]<<8);
+}
+
+local uLong unzlocal_bufLong OF((const unsigned char* p));
+local uLong unzlocal_bufLong (p)
+    const unsigned char* p;
+{
+    return (uLong)p[0] | ((uLong)p[1]<<8) | ((uLong)p[2]<<16) | ((uLong)p[3]<<24);
+}
+
+/*
+  Same as unzlocal_GetCurrentFileInfoInternal, from the cached central dir
+*/
+local int unzlocal_GetCachedFileInfo OF((unz_s* s,
+                                         unz_file_info *pfile_info,
+                                         unz_file_info_internal
+                                         *pfile_info_internal,
+                                         char *szFileName,
+                                         uLong fileNameBufferSize,
+                                         void *extraField,
+                                         uLong extraFieldBufferSize,
+                                         char *szComment,
+                                         uLong commentBufferSize));
+
+local int unzlocal_GetCachedFileInfo (s,
+                                      pfile_info,
+                                      pfile_info_internal,
+                                      szFileName, fileNameBufferSize,
+                                      extraField, extraFieldBufferSize,
+                                      szComment,  commentBufferSize)
+    unz_s* s;
+    unz_file_info *pfile_info;
+    unz_file_info_internal *pfile_info_internal;
+    char *szFileName;
+    uLong fileNameBufferSize;
+    void *extraField;
+    uLong extraFieldBufferSize;
+    char *szComment;
+    uLong commentBufferSize;
+{
+    unz_file_info file_info;
+    unz_file_info_internal file_info_internal;
+    uLong pos = s->pos_in_central_dir - s->offset_central_dir;
+    const unsigned char* p;
+    uLong uSizeRead;
+
+    if ((s->pos_in_central_dir < s->offset_central_dir) ||
+        (pos + SIZECENTRALDIRITEM > s->size_central_dir))
+        return UNZ_ERRNO;
+
+    p = s->central_dir + pos;
+    if (unzlocal_bufLong(p) != 0x02014b50)
+        return UNZ_BADZIPFILE;
+
+    file_info.version            = unzlocal_bufShort(p + 4);
+    file_info.version_needed     = unzlocal_bufShort(p + 6);
+    file_info.flag               = unzlocal_bufShort(p + 8);
+    file_info.compression_method = unzlocal_bufShort(p + 10);
+    file_info.dosDate            = unzlocal_bufLong(p + 12);
+    file_info.crc                = unzlocal_bufLong(p + 16);
+    file_info.compressed_size    = unzlocal_bufLong(p + 20);
+    file_info.uncompressed_size  = unzlocal_bufLong(p + 24);
+    file_info.size_filename      = unzlocal_bufShort(p + 28);
+    file_info.size_file_extra    = unzlocal_bufShort(p + 30);
+    file_info.size_file_comment  = unzlocal_bufShort(p + 32);
+    file_info.disk_num_start     = unzlocal_bufShort(p + 34);
+    file_info.internal_fa        = unzlocal_bufShort(p + 36);
+    file_info.external_fa        = unzlocal_bufLong(p + 38);
+    file_info_internal.offset_curfile = unzlocal_bufLong(p + 42);
+
+    unzlocal_DosDateToTmuDate(file_info.dosDate,&file_info.tmu_date);
+
+    if (pos + SIZECENTRALDIRITEM + file_info.size_filename +
+        file_info.size_file_extra + file_info.size_file_comment >
+        s->size_central_dir)
+        return UNZ_ERRNO;
+
+    p += SIZECENTRALDIRITEM;
+    if (szFileName!=NULL)
+    {
+        if (file_info.size_filename<fileNameBufferSize)
+        {
+            *(szFileName+file_info.size_filename)='\0';
+            uSizeRead = file_info.size_filename;
+        }
+        else
+            uSizeRead = fileNameBufferSize;
+        memcpy(szFileName,p,uSizeRead);
+    }
+
+    p += file_info.size_filename;
+    if (extraField!=NULL)
+    {
+        if (file_info.size_file_extra<extraFieldBufferSize)
+            uSizeRead = file_info.size_file_extra;
+        else
+            uSizeRead = extraFieldBufferSize;
+        memcpy(extraField,p,uSizeRead);
+    }
+
+    p += file_info.size_file_extra;
+    if (szComment!=NULL)
+    {
+        if (file_info.size_file_comment<commentBufferSize)
+        {
+            *(szComment+file_info.size_file_comment)='\0';
+            uSizeRead = file_info.size_file_comment;
+        }
+        else
+            uSizeRead = commentBufferSize;
+        memcpy(szComment,p,uSizeRead);
+    }
+
+    if (pfile_info!=NULL)
+        *pfile_info=file_info;
+
+    if (pfile_info_internal!=NULL)
+        *pfile_info_internal=file_info_internal;
+
+    return UNZ_OK;
+}
+
 local int unzlocal_GetCurrentFileInfoInternal (file,
                                               pfile_info,
                                               pfile_info_internal,
@@ -600,6 +741,12 @@ local int unzlocal_GetCurrentFileInfoInternal (file,
     if (file==NULL)
         return UNZ_PARAMERROR;
     s=(unz_s*)file;
+    if (s->central_dir!=NULL)
+        return unzlocal_GetCachedFileInfo(s,pfile_info,pfile_info_internal,
+                                          szFileName,fileNameBufferSize,
+                                          extraField,extraFieldBufferSize,
+                                          szComment,commentBufferSize);
+
     if (ZSEEK(s->z_filefunc, s->filestream,
               s->pos_in_central_dir+s->byte_before_the_zipfile,
               ZLIB_FILEFUNC_SEEK_SET)!=0)
@@ -945,6 +1092,131 @@ extern int ZEXPORT unzGoToFilePos(file, file_pos)
     return err;
 }
 
+/*
+  Read the central dir at once, then index it in two passes: the first
+  validates the entries and sizes the index, the second fills it in.
+*/
+extern int ZEXPORT unzCacheCentralDir (file)
+    unzFile file;
+{
+    unz_s* s;
+    unsigned char* buf;
+    unz_dir_entry* index;
+    char* names;
+    char* name;
+    uLong pos, count, size_names, i, item_size;
+    const unsigned char* p;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+    if (s->central_dir!=NULL)
+        return UNZ_OK;
+
+    buf = (unsigned char*)ALLOC(s->size_central_dir + 1);
+    if (buf==NULL)
+        return UNZ_INTERNALERROR;
+
+    if ((ZSEEK(s->z_filefunc, s->filestream,
+               s->offset_central_dir+s->byte_before_the_zipfile,
+               ZLIB_FILEFUNC_SEEK_SET)!=0) ||
+        (ZREAD(s->z_filefunc, s->filestream,
+               buf,s->size_central_dir)!=s->size_central_dir))
+    {
+        TRYFREE(buf);
+        return UNZ_ERRNO;
+    }
+
+    /* Validate and size */
+    count = size_names = 0;
+    for (pos = 0; pos + SIZECENTRALDIRITEM <= s->size_central_dir; pos += item_size)
+    {
+        /* 2^16 files overflow hack: number_entry is only a lower bound */
+        if ((s->gi.number_entry != 0xffff) && (count == s->gi.number_entry))
+            break;
+
+        p = buf + pos;
+        if (unzlocal_bufLong(p) != 0x02014b50)
+            break;
+
+        item_size = SIZECENTRALDIRITEM + unzlocal_bufShort(p + 28) +
+            unzlocal_bufShort(p + 30) + unzlocal_bufShort(p + 32);
+        if (pos + item_size > s->size_central_dir)
+            break;
+
+        size_names += unzlocal_bufShort(p + 28) + 1;
+        count++;
+    }
+
+    if (count < s->gi.number_entry)
+    {
+        TRYFREE(buf);
+        return UNZ_BADZIPFILE;
+    }
+
+    index = (unz_dir_entry*)ALLOC(count * sizeof(unz_dir_entry) + 1);
+    names = (char*)ALLOC(size_names + 1);
+    if (index==NULL || names==NULL)
+    {
+        TRYFREE(index);
+        TRYFREE(names);
+        TRYFREE(buf);
+        return UNZ_INTERNALERROR;
+    }
+
+    /* Fill in */
+    name = names;
+    for (i = 0, pos = 0; i < count; i++, pos += item_size)
+    {
+        uLong size_filename;
+        const char* ext;
+
+        p = buf + pos;
+        size_filename = unzlocal_bufShort(p + 28);
+        item_size = SIZECENTRALDIRITEM + size_filename +
+            unzlocal_bufShort(p + 30) + unzlocal_bufShort(p + 32);
+
+        memcpy(name, p + SIZECENTRALDIRITEM, size_filename);
+        name[size_filename] = '\0';
+
+        /* Extension of the name without its directory */
+        ext = strrchr(name, '/');
+        ext = strrchr(ext ? ext : name, '.');
+
+        index[i].filename = name;
+        index[i].extension = ext ? ext + 1 : name + size_filename;
+        index[i].uncompressed_size = unzlocal_bufLong(p + 24);
+        index[i].crc = unzlocal_bufLong(p + 16);
+        index[i].file_pos.pos_in_zip_directory = s->offset_central_dir + pos;
+        index[i].file_pos.num_of_file = i;
+
+        name += size_filename + 1;
+    }
+
+    s->central_dir = buf;
+    s->dir_index = index;
+    s->dir_names = names;
+    s->dir_count = count;
+    return UNZ_OK;
+}
+
+extern int ZEXPORT unzGetDirIndex (file, entries, count)
+    unzFile file;
+    const unz_dir_entry** entries;
+    uLong* count;
+{
+    unz_s* s;
+    if (file==NULL || entries==NULL || count==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+    if (s->central_dir==NULL)
+        return UNZ_PARAMERROR;
+
+    *entries = s->dir_index;
+    *count = s->dir_count;
+    return UNZ_OK;
+}
+
 /*
 // Unzip Helper Functions - should be here?
 ///////////////////////////////////////////
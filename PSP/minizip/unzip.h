@@ -221,6 +221,36 @@ extern int ZEXPORT unzGoToFilePos(
     unzFile file,
     unz_file_pos* file_pos);
 
+/* ****************************************** */
+/* Central directory cache */
+
+/* unz_dir_entry is an entry of the in-memory index of the central dir */
+typedef struct unz_dir_entry_s
+{
+    const char* filename;       /* full name in the archive */
+    const char* extension;      /* after the last '.' of the name, or "" */
+    uLong uncompressed_size;
+    uLong crc;
+    unz_file_pos file_pos;      /* for unzGoToFilePos */
+} unz_dir_entry;
+
+extern int ZEXPORT unzCacheCentralDir OF((unzFile file));
+/*
+  Read the whole central dir in a single read and index its entries.
+  From then on, unzGoToFirstFile, unzGoToNextFile, unzGoToFilePos,
+    unzLocateFile and unzGetCurrentFileInfo work from memory.
+  return UNZ_OK if there is no problem; the archive remains usable
+    (uncached) otherwise.
+*/
+
+extern int ZEXPORT unzGetDirIndex OF((unzFile file,
+                                      const unz_dir_entry** entries,
+                                      uLong* count));
+/*
+  Get the index built by unzCacheCentralDir, in central dir order.
+  The entries are valid until unzClose.
+*/
+
 /* ****************************************** */
 
 extern int ZEXPORT unzGetCurrentFileInfo OF((unzFile file,
@@ -436,6 +436,7 @@ PspImage* pspImageLoadPngFd(FILE *fp)
           a = pRow[1];
           pRow += 2;
           break;
+        case PNG_COLOR_TYPE_PALETTE: /* expanded to RGB */
         case PNG_COLOR_TYPE_RGB:
           b = pRow[0];
           g = pRow[1];
@@ -572,6 +573,84 @@ int pspImageSavePngFd(FILE *fp, const PspImage* image)
   return 1;
 }
 
+int pspImageSavePngIndexed(const char *path, const unsigned char *pixels,
+  int width, int height, int bits, const unsigned char *rgb, int colors)
+{
+  FILE *fp = fopen( path, "wb" );
+  if (!fp) return 0;
+
+  int stat = pspImageSavePngIndexedFd(fp, pixels, width, height,
+    bits, rgb, colors);
+  if (fclose(fp) != 0) stat = 0;
+
+  return stat;
+}
+
+/* Saves packed color indices to an open file descriptor (palette PNG); */
+/* rows are (width * bits + 7) / 8 bytes, leftmost pixel in the most */
+/* significant bits */
+int pspImageSavePngIndexedFd(FILE *fp, const unsigned char *pixels,
+  int width, int height, int bits, const unsigned char *rgb, int colors)
+{
+  png_color palette[256];
+  int i, pitch = (width * bits + 7) / 8;
+
+  if (colors < 1 || colors > (1 << bits) || colors > 256)
+    return 0;
+
+  for (i = 0; i < colors; i++)
+  {
+    palette[i].red = rgb[i * 3 + 0];
+    palette[i].green = rgb[i * 3 + 1];
+    palette[i].blue = rgb[i * 3 + 2];
+  }
+
+  png_struct *pPngStruct = png_create_write_struct( PNG_LIBPNG_VER_STRING,
+    NULL, NULL, NULL );
+  if (!pPngStruct)
+    return 0;
+
+  png_info *pPngInfo = png_create_info_struct( pPngStruct );
+  if (!pPngInfo)
+  {
+    png_destroy_write_struct( &pPngStruct, NULL );
+    return 0;
+  }
+
+  png_byte **buf = (png_byte**)malloc(height * sizeof(png_byte*));
+  if (!buf)
+  {
+    png_destroy_write_struct( &pPngStruct, &pPngInfo );
+    return 0;
+  }
+
+  for (i = 0; i < height; i++)
+    buf[i] = (png_byte*)&pixels[i * pitch];
+
+  if (setjmp( pPngStruct->jmpbuf ))
+  {
+    free(buf);
+    png_destroy_write_struct( &pPngStruct, &pPngInfo );
+    return 0;
+  }
+
+  png_init_io( pPngStruct, fp );
+  png_set_IHDR( pPngStruct, pPngInfo, width, height, bits,
+    PNG_COLOR_TYPE_PALETTE,
+    PNG_INTERLACE_NONE,
+    PNG_COMPRESSION_TYPE_DEFAULT,
+    PNG_FILTER_TYPE_DEFAULT);
+  png_set_PLTE( pPngStruct, pPngInfo, palette, colors );
+  png_write_info( pPngStruct, pPngInfo );
+  png_write_image( pPngStruct, buf );
+  png_write_end( pPngStruct, pPngInfo );
+
+  png_destroy_write_struct( &pPngStruct, &pPngInfo );
+  free(buf);
+
+  return 1;
+}
+
 int FindPowerOfTwoLargerThan(int n)
 {
   int i;
@@ -70,6 +70,14 @@ PspImage* pspImageLoadPng(const char *path);
 int       pspImageSavePng(const char *path, const PspImage* image);
 PspImage* pspImageLoadPngFd(FILE *fp);
 int       pspImageSavePngFd(FILE *fp, const PspImage* image);
+/* Palette PNG of packed indices (bits: 1, 2, 4 or 8 per pixel); */
+/* rgb holds colors RGB888 entries */
+int       pspImageSavePngIndexed(const char *path, const unsigned char *pixels,
+            int width, int height, int bits, const unsigned char *rgb,
+            int colors);
+int       pspImageSavePngIndexedFd(FILE *fp, const unsigned char *pixels,
+            int width, int height, int bits, const unsigned char *rgb,
+            int colors);
 
 int pspImageBlur(const PspImage *original, PspImage *blurred);
 int pspImageDiscardColors(const PspImage *original);
@@ -26,15 +26,46 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 #include "pl_file.h"
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+#define CACHE_SIZE  8     /* directories */
+#define BLOCK_SIZE  16384 /* bytes of entries per arena block */
+
+typedef struct pl_file_block_t
+{
+  struct pl_file_block_t *next;
+  int used;
+} pl_file_block;
+
+typedef struct pl_file_dir_t
+{
+  char *path;
+  const char **filter;
+  ScePspDateTime mtime;
+  int dated;            /* mtime is known; otherwise never reused */
+  SceUID fd;            /* >= 0 while being read */
+  int refs;
+  int count;
+  pl_file *files;
+  pl_file *tail;
+  pl_file_block *blocks;
+  struct pl_file_dir_t *next;
+} pl_file_dir;
+
+/* Most recently used first */
+static pl_file_dir *DirCache = NULL;
+/* Set from any thread; checked when a listing is next opened */
+static volatile int CacheInvalid = 0;
+
+static void
+  sort_file_list(pl_file_dir *dir);
 static void
-  sort_file_list(pl_file_list *list,
-                 int count);
+  free_dir(pl_file_dir *dir);
 static int
   compare_files_by_name(const void *s1, 
                         const void *s2);
@@ -81,9 +112,38 @@ const char* pl_file_get_extension(const char *path)
   return ext + 1;
 }
 
+/* Whether two directory paths are the same, trailing slash or not */
+static int same_dir(const char *path1,
+                    const char *path2)
+{
+  int len1 = strlen(path1), len2 = strlen(path2);
+  if (len1 > 0 && path1[len1 - 1] == '/') len1--;
+  if (len2 > 0 && path2[len2 - 1] == '/') len2--;
+  return len1 == len2 && strncmp(path1, path2, len1) == 0;
+}
+
 int pl_file_rm(const char *path)
 {
-  return sceIoRemove(path) >= 0;
+  pl_file_path parent;
+  pl_file_dir *dir, *next;
+
+  if (sceIoRemove(path) < 0)
+    return 0;
+
+  /* The directory's mtime may not change; don't reuse its listing */
+  pl_file_get_parent_directory(path, parent, sizeof(parent));
+  for (dir = DirCache; dir; dir = next)
+  {
+    next = dir->next;
+    if (!same_dir(dir->path, parent))
+      continue;
+
+    dir->dated = 0;
+    if (dir->refs == 0 && dir->fd < 0)
+      free_dir(dir);
+  }
+
+  return 1;
 }
 
 /* Returns size of file in bytes or <0 if error */
@@ -129,16 +189,46 @@ int pl_file_is_of_type(const char *path,
   return 0;
 }
 
-void pl_file_destroy_file_list(pl_file_list *list)
+static void free_dir(pl_file_dir *dir)
 {
-  pl_file *file, *next;
+  pl_file_dir **link;
+  pl_file_block *block, *next;
+
+  for (link = &DirCache; *link; link = &(*link)->next)
+  {
+    if (*link == dir)
+    {
+      *link = dir->next;
+      break;
+    }
+  }
+
+  if (dir->fd >= 0)
+    sceIoDclose(dir->fd);
 
-  for (file = list->files; file; file = next)
+  for (block = dir->blocks; block; block = next)
   {
-    next = file->next;
-    free(file->name);
-    free(file);
+    next = block->next;
+    free(block);
   }
+
+  free(dir->path);
+  free(dir);
+}
+
+void pl_file_destroy_file_list(pl_file_list *list)
+{
+  pl_file_dir *dir = list->dir;
+
+  list->files = NULL;
+  list->dir = NULL;
+
+  if (!dir || --dir->refs > 0)
+    return;
+
+  /* Abandoned before it was read completely */
+  if (dir->fd >= 0)
+    free_dir(dir);
 }
 
 static int mkdir_recursive(const char *path)
@@ -177,115 +267,266 @@ int pl_file_mkdir_recursive(const char *path)
   return mkdir_recursive(path);
 }
 
+void pl_file_invalidate_file_lists()
+{
+  CacheInvalid = 1;
+}
+
 int pl_file_get_file_list_count(const pl_file_list *list)
 {
-  int count = 0;
-  pl_file *file;
+  return (list->dir) ? list->dir->count : 0;
+}
+
+static int get_dir_mtime(const char *path,
+                         ScePspDateTime *mtime)
+{
+  pl_file_path dir_path;
+  SceIoStat stat;
+  int len = strlen(path);
+
+  /* Stat the directory without the trailing slash, unless it's a root */
+  strncpy(dir_path, path, sizeof(dir_path) - 1);
+  dir_path[sizeof(dir_path) - 1] = '\0';
+  if (len > 1 && len < (int)sizeof(dir_path) && dir_path[len - 1] == '/'
+    && dir_path[len - 2] != ':')
+    dir_path[len - 1] = '\0';
 
-  for (file = list->files; file; file = file->next)
-    count++;
-  return count;
+  memset(&stat, 0, sizeof(stat));
+  if (sceIoGetstat(dir_path, &stat) < 0)
+    return 0;
+
+  *mtime = stat.st_mtime;
+  return 1;
 }
 
-/* Returns number of files successfully read; negative number if error */
-int pl_file_get_file_list(pl_file_list *list,
-                          const char *path,
-                          const char **filter)
+static pl_file* append_file(pl_file_dir *dir,
+                            const char *name,
+                            unsigned char attrs)
 {
-  SceUID fd = sceIoDopen(path);
-  if (fd < 0) return -1;
+  pl_file_block *block = dir->blocks;
+  int len = strlen(name) + 1;
+  int size = (sizeof(pl_file) + len + sizeof(void*) - 1)
+    & ~(sizeof(void*) - 1);
+  pl_file *file;
+
+  /* Entries (with their names) are bumped from the newest block */
+  if (!block || block->used + size > BLOCK_SIZE)
+  {
+    if (!(block = (pl_file_block*)malloc(sizeof(pl_file_block)
+                                         + MAX(size, BLOCK_SIZE))))
+      return NULL;
+    block->used = 0;
+    block->next = dir->blocks;
+    dir->blocks = block;
+  }
+
+  file = (pl_file*)((char*)(block + 1) + block->used);
+  block->used += size;
 
-  SceIoDirent dir;
-  memset(&dir, 0, sizeof(dir));
+  file->name = (char*)(file + 1);
+  memcpy(file->name, name, len);
+  file->attrs = attrs;
+  file->next = NULL;
+
+  /* Directories first, then by the first letters (as strcasecmp would) */
+  file->sort_key = (!(attrs & PL_FILE_DIRECTORY)) << 24;
+  if (name[0])
+  {
+    file->sort_key |= tolower((unsigned char)name[0]) << 16;
+    if (name[1])
+    {
+      file->sort_key |= tolower((unsigned char)name[1]) << 8;
+      if (name[2])
+        file->sort_key |= tolower((unsigned char)name[2]);
+    }
+  }
+
+  if (dir->tail) dir->tail->next = file;
+  else dir->files = file;
+  dir->tail = file;
+  dir->count++;
+
+  return file;
+}
+
+int pl_file_open_file_list(pl_file_list *list,
+                           const char *path,
+                           const char **filter)
+{
+  pl_file_dir *dir, *next, **link;
+  ScePspDateTime mtime;
+  int dated, cached;
 
-  pl_file *file, *last = NULL;
   list->files = NULL;
+  list->dir = NULL;
+
+  /* Nothing cached so far can be reused */
+  if (CacheInvalid)
+  {
+    CacheInvalid = 0;
+    for (dir = DirCache; dir; dir = dir->next)
+      dir->dated = 0;
+  }
+
+  dated = get_dir_mtime(path, &mtime);
+
+  for (dir = DirCache, link = &DirCache; dir; link = &dir->next, dir = next)
+  {
+    next = dir->next;
+    if (dir->filter != filter || strcmp(dir->path, path) != 0
+      || dir->fd >= 0)
+      continue;
+
+    if (dated && dir->dated
+      && memcmp(&dir->mtime, &mtime, sizeof(mtime)) == 0)
+    {
+      /* Unchanged - move to front and share */
+      *link = dir->next;
+      dir->next = DirCache;
+      DirCache = dir;
+
+      dir->refs++;
+      list->dir = dir;
+      list->files = dir->files;
+      return dir->count;
+    }
+
+    /* Stale */
+    if (dir->refs == 0)
+    {
+      free_dir(dir);
+      break;
+    }
+  }
+
+  if (!(dir = (pl_file_dir*)calloc(1, sizeof(pl_file_dir))))
+    return -1;
+
+  if (!(dir->path = strdup(path)) || (dir->fd = sceIoDopen(path)) < 0)
+  {
+    dir->fd = -1;
+    free_dir(dir);
+    return -1;
+  }
+
+  dir->filter = filter;
+  dir->mtime = mtime;
+  dir->dated = dated;
+  dir->refs = 1;
+  dir->next = DirCache;
+  DirCache = dir;
+
+  /* Drop the least recently used directories no one is looking at */
+  for (dir = DirCache, cached = 0; dir; dir = next)
+  {
+    next = dir->next;
+    if (++cached > CACHE_SIZE && dir->refs == 0)
+      free_dir(dir);
+  }
+
+  list->dir = DirCache;
+  return 0;
+}
 
+int pl_file_read_file_list(pl_file_list *list,
+                           int max)
+{
+  pl_file_dir *dir = list->dir;
+  SceIoDirent dirent;
   const char **pext;
-  int loop;
-  int count = 0;
+  int read;
+
+  if (!dir || dir->fd < 0)
+    return 0;
 
-  while (sceIoDread(fd, &dir) > 0)
+  memset(&dirent, 0, sizeof(dirent));
+
+  for (read = 0; !max || read < max; )
   {
-    if (filter && !(dir.d_stat.st_attr & FIO_SO_IFDIR))
+    if (sceIoDread(dir->fd, &dirent) <= 0)
+      goto done;
+
+    if (dir->filter && !(dirent.d_stat.st_attr & FIO_SO_IFDIR))
     {
       /* Loop through the list of allowed extensions and compare */
-      for (pext = filter, loop = 1; *pext; pext++)
-      {
-        if (pl_file_is_of_type(dir.d_name, *pext))
-        {
-          loop = 0;
+      for (pext = dir->filter; *pext; pext++)
+        if (pl_file_is_of_type(dirent.d_name, *pext))
           break;
-        }
-      }
 
-      if (loop) continue;
+      if (!*pext) continue;
     }
 
-    /* Create a new file entry */
-    if (!(file = (pl_file*)malloc(sizeof(pl_file))))
+    if (!append_file(dir, dirent.d_name,
+                     (dirent.d_stat.st_attr & FIO_SO_IFDIR)
+                     ? PL_FILE_DIRECTORY : 0))
     {
-      pl_file_destroy_file_list(list);
-      return -1;
+      /* Out of memory; keep what was read, but don't reuse it */
+      dir->dated = 0;
+      goto done;
     }
 
-    file->name = strdup(dir.d_name);
-    file->next = NULL;
-    file->attrs = (dir.d_stat.st_attr & FIO_SO_IFDIR) 
-                  ? PL_FILE_DIRECTORY : 0;
+    if (!list->files)
+      list->files = dir->files;
+    read++;
+  }
 
-    /* Update preceding element */
-    if (last) last->next = file;
-    else list->files = file;
+  return 1;
 
-    last = file;
-    count++;
-  }
+done:
+  /* Sort; from now on, the listing can be shared */
+  sceIoDclose(dir->fd);
+  dir->fd = -1;
 
-  sceIoDclose(fd);
+  sort_file_list(dir);
+  list->files = dir->files;
+  return 0;
+}
 
-  /* Sort the files by name */
-  sort_file_list(list, count);
-  return count;
+/* Returns number of files successfully read; negative number if error */
+int pl_file_get_file_list(pl_file_list *list,
+                          const char *path,
+                          const char **filter)
+{
+  if (pl_file_open_file_list(list, path, filter) < 0)
+    return -1;
+
+  pl_file_read_file_list(list, 0);
+  return list->dir->count;
 }
 
-static void sort_file_list(pl_file_list *list,
-                           int count)
+static void sort_file_list(pl_file_dir *dir)
 {
   pl_file **files, *file, **fp;
-  int i;
+  int i, count = dir->count;
 
-  if (count < 1)
+  if (count < 2)
     return;
 
   /* Copy the file entries to an array */
-  files = (pl_file**)malloc(sizeof(pl_file*) * count);
-  for (file = list->files, fp = files; file; file = file->next, fp++)
+  if (!(files = (pl_file**)malloc(sizeof(pl_file*) * count)))
+    return;
+  for (file = dir->files, fp = files; file; file = file->next, fp++)
     *fp = file;
 
   /* Sort the array */
   qsort((void*)files, count, sizeof(pl_file*), compare_files_by_name);
 
   /* Rearrange the file entries in the list */
-  list->files = files[0];
-  list->files->next = NULL;
-
+  dir->files = files[0];
   for (i = 1; i < count; i++)
     files[i - 1]->next = files[i];
 
-  pl_file *last = files[count - 1];
-  last->next = NULL;
+  dir->tail = files[count - 1];
+  dir->tail->next = NULL;
   free(files);
 }
 
 static int compare_files_by_name(const void *s1, const void *s2)
 {
   pl_file *f1 = *(pl_file**)s1, *f2 = *(pl_file**)s2;
-  if ((f1->attrs & PL_FILE_DIRECTORY) == (f2->attrs & PL_FILE_DIRECTORY))
-    return strcasecmp(f1->name, f2->name);
-  else if (f1->attrs & PL_FILE_DIRECTORY)
-    return -1;
-  else return 1;
+  if (f1->sort_key != f2->sort_key)
+    return (f1->sort_key < f2->sort_key) ? -1 : 1;
+  return strcasecmp(f1->name, f2->name);
 }
 
 int pl_file_open_directory(const char *path,
@@ -31,16 +31,23 @@ extern "C" {
 
 typedef char pl_file_path[PL_FILE_MAX_PATH_LEN];
 
+struct pl_file_dir_t;
+
 typedef struct pl_file_t
 {
   char *name;
   unsigned char attrs;
+  unsigned int sort_key; /* files after directories, first 3 letters */
   struct pl_file_t *next;
 } pl_file;
 
+/* Listings are cached by path, filter and modification time; a list */
+/* refers to the cached directory until it's destroyed. See */
+/* pl_file_invalidate_file_lists() */
 typedef struct pl_file_list_t
 {
   struct pl_file_t *files;
+  struct pl_file_dir_t *dir;
 } pl_file_list;
 
 void pl_file_get_parent_directory(const char *path,
@@ -66,8 +73,23 @@ int  pl_file_mkdir_recursive(const char *path);
 int  pl_file_get_file_list(pl_file_list *list,
                            const char *path,
                            const char **filter);
+/* Incremental version of the above: the list fills in as it's read, */
+/* in directory order, and is sorted once the last entry is in. */
+/* Returns <0 if error */
+int  pl_file_open_file_list(pl_file_list *list,
+                            const char *path,
+                            const char **filter);
+/* Reads up to max entries (0 - all); returns nonzero while */
+/* entries remain */
+int  pl_file_read_file_list(pl_file_list *list,
+                            int max);
 void pl_file_destroy_file_list(pl_file_list *list);
 int  pl_file_get_file_list_count(const pl_file_list *list);
+/* FAT doesn't reliably update a directory's modification time, so */
+/* cached listings are also dropped when psplib deletes a file, and */
+/* after this is called (e.g. from a media change callback; any */
+/* thread). They're reread when next opened. */
+void pl_file_invalidate_file_lists();
 
 #ifdef __cplusplus
 }
@@ -26,126 +26,196 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define PL_MAX_LINE_LENGTH 512
+#define PL_INI_BLOCK_SIZE   4096
+#define PL_INI_MIN_BUCKETS  32
+#define PL_INI_ALIGN(x) \
+  (((x) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+typedef struct pl_ini_block_t
+{
+  struct pl_ini_block_t *next;
+  size_t size;
+  size_t used;
+} pl_ini_block;
 
 typedef struct pl_ini_pair_t
 {
   char *key;
   char *value;
-  struct pl_ini_pair_t *next;
+  unsigned int hash;
+  struct pl_ini_section_t *section;
+  struct pl_ini_pair_t *next;      /* in the section, in file order */
+  struct pl_ini_pair_t *hash_next; /* in the bucket */
 } pl_ini_pair;
 
 typedef struct pl_ini_section_t
 {
   char *name;
   struct pl_ini_pair_t *head;
+  struct pl_ini_pair_t *tail;
   struct pl_ini_section_t *next;
 } pl_ini_section;
 
-static pl_ini_section* create_section(const char *name);
-static pl_ini_pair* create_pair(char *string);
+static void* arena_alloc(pl_ini_file *file,
+                         size_t size);
+static char* arena_strdup(pl_ini_file *file,
+                          const char *string);
+static unsigned int hash_key(const char *section_name,
+                             const char *key_name);
+static pl_ini_section* create_section(pl_ini_file *file,
+                                      char *name);
+static pl_ini_pair* create_pair(pl_ini_file *file,
+                                pl_ini_section *section,
+                                char *key,
+                                unsigned int hash);
+static int insert_pair(pl_ini_file *file,
+                       pl_ini_pair *pair);
 static pl_ini_section* find_section(const pl_ini_file *file,
                                     const char *section_name);
-static pl_ini_pair* find_pair(const pl_ini_section *section,
-                              const char *key_name);
 static pl_ini_pair* locate(const pl_ini_file *file,
                            const char *section_name,
-                           const char *key_name);
+                           const char *key_name,
+                           unsigned int hash);
 static pl_ini_pair* locate_or_create(pl_ini_file *file,
                                      const char *section_name,
                                      const char *key_name);
 
 int pl_ini_create(pl_ini_file *file)
 {
-  file->head = NULL;
+  memset(file, 0, sizeof(pl_ini_file));
   return 1;
 }
 
 int pl_ini_load(pl_ini_file *file,
                 const char *path)
-{ 
-  file->head = NULL;
-
+{
   FILE *stream;
-  if (!(stream = fopen(path, "r"))) 
+  pl_ini_block *block;
+  pl_ini_section *section = NULL;
+  pl_ini_pair *pair;
+  char *buffer, *line, *end, *ptr;
+  long size;
+
+  pl_ini_create(file);
+
+  if (!(stream = fopen(path, "r")))
     return 0;
 
-  pl_ini_section *current_section = NULL;
-  pl_ini_pair *tail = NULL;
+  /* Read the entire file into an arena block of its own */
+  if (fseek(stream, 0, SEEK_END) != 0 || (size = ftell(stream)) < 0
+    || fseek(stream, 0, SEEK_SET) != 0
+    || !(block = (pl_ini_block*)malloc(sizeof(pl_ini_block) + size + 1)))
+  {
+    fclose(stream);
+    return 0;
+  }
+
+  buffer = (char*)(block + 1);
+  size = fread(buffer, 1, size, stream);
+  fclose(stream);
 
-  char string[PL_MAX_LINE_LENGTH],
-       name[PL_MAX_LINE_LENGTH];
-  char *ptr;
-  int len;
+  buffer[size] = '\0';
+  block->size = block->used = size + 1;
+  block->next = file->arena;
+  file->arena = block;
 
-  /* Create unnamed section */
-  while(!feof(stream) && fgets(string, sizeof(string), stream))
+  /* Parse in place; names, keys and values are terminated in the buffer */
+  for (line = buffer; line < buffer + size; line = end + 1)
   {
-    /* TODO: Skip whitespace */
+    if (!(end = strchr(line, '\n')))
+      end = buffer + size;
+    *end = '\0';
+    if (end > line && end[-1] == '\r')
+      end[-1] = '\0';
+
     /* New section */
-    if (string[0] == '[')
+    if (line[0] == '[')
     {
-      if ((ptr = strrchr(string, ']')))
+      if ((ptr = strrchr(line, ']')))
       {
-        len = ptr - string - 1;
-        strncpy(name, string + 1, len);
-        name[len] = '\0';
-
-        if (!current_section)
-          current_section = file->head = create_section(name);
-        else
-        {
-          current_section->next = create_section(name);
-          current_section = current_section->next;
-        }
-
-        tail = NULL;
+        *ptr = '\0';
+        if (!(section = create_section(file, line + 1)))
+          return 0;
       }
     }
-    else if (string[0] =='#'); /* Do nothing - comment */
-    else
+    else if (line[0] == '#'); /* Do nothing - comment */
+    else if ((ptr = strchr(line, '=')))
     {
       /* No section defined - create empty section */
-      if (!current_section)
-      {
-        current_section = create_section(strdup(""));
-        file->head = current_section;
-        tail = NULL;
-      }
+      if (!section && !(section = create_section(file, "")))
+        return 0;
 
-      pl_ini_pair *pair = create_pair(string);
-      if (pair)
-      {
-        if (tail) tail->next = pair;
-        else current_section->head = pair;
-        tail = pair;
-      }
+      *ptr = '\0';
+
+      /* Of duplicate keys, only the first one is hashed (and found) */
+      unsigned int hash = hash_key(section->name, line);
+      int duplicate = (locate(file, section->name, line, hash) != NULL);
+
+      if (!(pair = create_pair(file, section, line, hash))
+        || (!duplicate && !insert_pair(file, pair)))
+        return 0;
+
+      pair->value = ptr + 1;
     }
   }
 
-  fclose(stream);
   return 1;
 }
 
 int pl_ini_save(const pl_ini_file *file,
                 const char *path)
 {
+  const pl_ini_section *section;
+  const pl_ini_pair *pair;
+  size_t size = 0, len;
+  char *buffer, *ptr;
   FILE *stream;
-  if (!(stream = fopen(path, "w")))
-    return 0;
+  int status;
 
-  pl_ini_section *section;
-  pl_ini_pair *pair;
+  /* Format everything into one buffer, then write it at once */
+  for (section = file->head; section; section = section->next)
+  {
+    size += strlen(section->name) + 3;
+    for (pair = section->head; pair; pair = pair->next)
+      size += strlen(pair->key) + strlen(pair->value) + 2;
+  }
+
+  if (!(buffer = (char*)malloc(size + 1)))
+    return 0;
 
+  ptr = buffer;
   for (section = file->head; section; section = section->next)
   {
-    fprintf(stream, "[%s]\n", section->name);
+    *ptr++ = '[';
+    len = strlen(section->name);
+    memcpy(ptr, section->name, len);
+    ptr += len;
+    *ptr++ = ']';
+    *ptr++ = '\n';
+
     for (pair = section->head; pair; pair = pair->next)
-      fprintf(stream, "%s=%s\n", pair->key, pair->value);
+    {
+      len = strlen(pair->key);
+      memcpy(ptr, pair->key, len);
+      ptr += len;
+      *ptr++ = '=';
+      len = strlen(pair->value);
+      memcpy(ptr, pair->value, len);
+      ptr += len;
+      *ptr++ = '\n';
+    }
   }
 
-  fclose(stream);
-  return 1;
+  status = 0;
+  if ((stream = fopen(path, "w")))
+  {
+    status = (size == 0 || fwrite(buffer, size, 1, stream) == 1);
+    if (fclose(stream) != 0)
+      status = 0;
+  }
+
+  free(buffer);
+  return status;
 }
 
 int pl_ini_get_int(const pl_ini_file *file,
@@ -153,7 +223,7 @@ int pl_ini_get_int(const pl_ini_file *file,
                    const char *key,
                    int default_value)
 {
-  pl_ini_pair *pair = locate(file, section, key);
+  pl_ini_pair *pair = locate(file, section, key, hash_key(section, key));
   return (pair) ? atoi(pair->value) : default_value;
 }
 
@@ -164,7 +234,7 @@ int pl_ini_get_string(const pl_ini_file *file,
                       char *copy_to,
                       int dest_len)
 {
-  pl_ini_pair *pair = locate(file, section, key);
+  pl_ini_pair *pair = locate(file, section, key, hash_key(section, key));
   if (pair)
   {
     strncpy(copy_to, pair->value, dest_len);
@@ -184,17 +254,9 @@ void pl_ini_set_int(pl_ini_file *file,
                     const char *key,
                     int value)
 {
-  pl_ini_pair *pair;
-  if (!(pair = locate_or_create(file, section, key)))
-    return;
-
-  /* Replace the value */
-  if (pair->value)
-    free(pair->value);
-
   char temp[64];
   snprintf(temp, 63, "%i", value);
-  pair->value = strdup(temp);
+  pl_ini_set_string(file, section, key, temp);
 }
 
 void pl_ini_set_string(pl_ini_file *file,
@@ -203,38 +265,81 @@ void pl_ini_set_string(pl_ini_file *file,
                        const char *string)
 {
   pl_ini_pair *pair;
+  char *value;
   if (!(pair = locate_or_create(file, section, key)))
     return;
 
-  /* Replace the value */
-  if (pair->value)
-    free(pair->value);
-  pair->value = strdup(string);
+  /* Replace the value; the old one stays in the arena until destroyed */
+  if (pair->value && strcmp(pair->value, string) == 0)
+    return;
+  if ((value = arena_strdup(file, string)))
+    pair->value = value;
 }
 
 void pl_ini_destroy(pl_ini_file *file)
 {
-  pl_ini_section *section, *next_section;
-  pl_ini_pair *pair, *next_pair;
+  pl_ini_block *block, *next;
 
-  for (section = file->head; section; section = next_section)
+  for (block = file->arena; block; block = next)
   {
-    next_section = section->next;
+    next = block->next;
+    free(block);
+  }
 
-    if (section->name) 
-      free(section->name);
-    for (pair = section->head; pair; pair = next_pair)
-    {
-      next_pair = pair->next;
-      if (pair->key)
-        free(pair->key);
-      if (pair->value)
-        free(pair->value);
-      free(pair);
-    }
+  free(file->buckets);
+  pl_ini_create(file);
+}
 
-    free(section);
+static void* arena_alloc(pl_ini_file *file,
+                         size_t size)
+{
+  pl_ini_block *block = file->arena;
+  void *ptr;
+
+  /* Allocations are bumped from the newest block */
+  size = PL_INI_ALIGN(size);
+  if (!block || block->used + size > block->size)
+  {
+    size_t block_size = (size > PL_INI_BLOCK_SIZE) ? size : PL_INI_BLOCK_SIZE;
+    if (!(block = (pl_ini_block*)malloc(sizeof(pl_ini_block) + block_size)))
+      return NULL;
+
+    block->size = block_size;
+    block->used = 0;
+    block->next = file->arena;
+    file->arena = block;
   }
+
+  ptr = (char*)(block + 1) + block->used;
+  block->used += size;
+
+  return ptr;
+}
+
+static char* arena_strdup(pl_ini_file *file,
+                          const char *string)
+{
+  size_t len = strlen(string) + 1;
+  char *copy;
+  if ((copy = (char*)arena_alloc(file, len)))
+    memcpy(copy, string, len);
+  return copy;
+}
+
+/* FNV-1a over the section name, a separator and the key */
+static unsigned int hash_key(const char *section_name,
+                             const char *key_name)
+{
+  unsigned int hash = 2166136261U;
+  const unsigned char *p;
+
+  for (p = (const unsigned char*)section_name; *p; p++)
+    hash = (hash ^ *p) * 16777619U;
+  hash = (hash ^ ']') * 16777619U;
+  for (p = (const unsigned char*)key_name; *p; p++)
+    hash = (hash ^ *p) * 16777619U;
+
+  return hash;
 }
 
 static pl_ini_section* find_section(const pl_ini_file *file,
@@ -248,123 +353,130 @@ static pl_ini_section* find_section(const pl_ini_file *file,
   return NULL;
 }
 
-static pl_ini_pair* find_pair(const pl_ini_section *section,
-                              const char *key_name)
-{
-  pl_ini_pair *pair;
-  for (pair = section->head; pair; pair = pair->next)
-    if (strcmp(pair->key, key_name) == 0)
-      return pair;
-
-  return NULL;
-}
-
 static pl_ini_pair* locate(const pl_ini_file *file,
                            const char *section_name,
-                           const char *key_name)
+                           const char *key_name,
+                           unsigned int hash)
 {
-  pl_ini_section *section;
-  if (!(section = find_section(file, section_name)))
+  pl_ini_pair *pair;
+  if (!file->buckets)
     return NULL;
 
-  return find_pair(section, key_name);
+  for (pair = file->buckets[hash & file->bucket_mask]; pair;
+       pair = pair->hash_next)
+    if (pair->hash == hash && strcmp(pair->key, key_name) == 0
+      && strcmp(pair->section->name, section_name) == 0)
+      return pair;
+
+  return NULL;
 }
 
 static pl_ini_pair* locate_or_create(pl_ini_file *file,
                                      const char *section_name,
                                      const char *key_name)
 {
-  pl_ini_section *section = find_section(file, section_name);
-  pl_ini_pair *pair = NULL;
+  unsigned int hash = hash_key(section_name, key_name);
+  pl_ini_section *section;
+  pl_ini_pair *pair;
+  char *name;
+
+  if ((pair = locate(file, section_name, key_name, hash)))
+    return pair;
 
-  if (section)
-    pair = find_pair(section, key_name);
-  else
+  if (!(section = find_section(file, section_name)))
   {
     /* Create section */
-    section = create_section(section_name);
-
-    if (!file->head)
-      file->head = section;
-    else
-    {
-      pl_ini_section *s;
-      for (s = file->head; s->next; s = s->next); /* Find the tail */
-      s->next = section;
-    }
+    if (!(name = arena_strdup(file, section_name))
+      || !(section = create_section(file, name)))
+      return NULL;
   }
 
-  if (!pair)
-  {
-    /* Create pair */
-    pair = (pl_ini_pair*)malloc(sizeof(pl_ini_pair));
-    pair->key = strdup(key_name);
-    pair->value = NULL;
-    pair->next = NULL;
-
-    if (!section->head)
-      section->head = pair;
-    else
-    {
-      pl_ini_pair *p;
-      for (p = section->head; p->next; p = p->next); /* Find the tail */
-      p->next = pair;
-    }
-  }
+  /* Create pair */
+  if (!(name = arena_strdup(file, key_name))
+    || !(pair = create_pair(file, section, name, hash))
+    || !insert_pair(file, pair))
+    return NULL;
 
   return pair;
 }
 
-static pl_ini_section* create_section(const char *name)
+static pl_ini_section* create_section(pl_ini_file *file,
+                                      char *name)
 {
   pl_ini_section *section
-    = (pl_ini_section*)malloc(sizeof(pl_ini_section));
+    = (pl_ini_section*)arena_alloc(file, sizeof(pl_ini_section));
+  if (!section)
+    return NULL;
+
+  section->name = name;
   section->head = NULL;
+  section->tail = NULL;
   section->next = NULL;
-  section->name = strdup(name);
+
+  if (file->tail) file->tail->next = section;
+  else file->head = section;
+  file->tail = section;
 
   return section;
 }
 
-static pl_ini_pair* create_pair(char *string)
+static pl_ini_pair* create_pair(pl_ini_file *file,
+                                pl_ini_section *section,
+                                char *key,
+                                unsigned int hash)
 {
-  char *ptr;
-  if (!(ptr = strchr(string, '=')))
+  pl_ini_pair *pair = (pl_ini_pair*)arena_alloc(file, sizeof(pl_ini_pair));
+  if (!pair)
     return NULL;
 
-  int len;
-  char *name, *value;
-
-  /* Copy NAME */
-  len = ptr - string;
-  if (!(name = (char*)malloc(sizeof(char) * (len + 1))))
-    return NULL;
-  strncpy(name, string, len);
-  name[len] = '\0';
+  pair->key = key;
+  pair->value = (char*)"";
+  pair->hash = hash;
+  pair->section = section;
+  pair->next = NULL;
+  pair->hash_next = NULL;
 
-  /* Copy VALUE */
-  if (!(value = strdup(ptr + 1)))
-  {
-    free(name);
-    return NULL;
-  }
+  if (section->tail) section->tail->next = pair;
+  else section->head = pair;
+  section->tail = pair;
 
-  len = strlen(value);
-  if (value[len - 1] == '\n') value[len - 1] = '\0';
+  return pair;
+}
 
-  /* Create struct */
-  pl_ini_pair *pair = (pl_ini_pair*)malloc(sizeof(pl_ini_pair));
+static int insert_pair(pl_ini_file *file,
+                       pl_ini_pair *pair)
+{
+  pl_ini_pair *p, *next, **buckets;
+  unsigned int count, i;
 
-  if (!pair)
+  /* Keep the table at most one pair per bucket */
+  if (!file->buckets || file->pair_count > file->bucket_mask)
   {
-    free(name);
-    free(value);
-    return NULL;
+    count = (file->buckets) ? (file->bucket_mask + 1) * 2 : PL_INI_MIN_BUCKETS;
+    if (!(buckets = (pl_ini_pair**)calloc(count, sizeof(pl_ini_pair*))))
+      return 0;
+
+    if (file->buckets)
+    {
+      for (i = 0; i <= file->bucket_mask; i++)
+      {
+        for (p = file->buckets[i]; p; p = next)
+        {
+          next = p->hash_next;
+          p->hash_next = buckets[p->hash & (count - 1)];
+          buckets[p->hash & (count - 1)] = p;
+        }
+      }
+      free(file->buckets);
+    }
+
+    file->buckets = buckets;
+    file->bucket_mask = count - 1;
   }
 
-  pair->key = name;
-  pair->value = value;
-  pair->next = NULL;
+  pair->hash_next = file->buckets[pair->hash & file->bucket_mask];
+  file->buckets[pair->hash & file->bucket_mask] = pair;
+  file->pair_count++;
 
-  return pair;
+  return 1;
 }
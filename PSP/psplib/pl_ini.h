@@ -27,10 +27,17 @@ extern "C" {
 #endif
 
 struct pl_ini_section_t;
+struct pl_ini_pair_t;
+struct pl_ini_block_t;
 
 typedef struct pl_ini_file_t
 {
   struct pl_ini_section_t *head;
+  struct pl_ini_section_t *tail;
+  struct pl_ini_pair_t **buckets; /* hashed by section and key */
+  unsigned int bucket_mask;
+  unsigned int pair_count;
+  struct pl_ini_block_t *arena;   /* holds all nodes and strings */
 } pl_ini_file;
 
 int  pl_ini_create(pl_ini_file *file);
@@ -0,0 +1,216 @@
+/* psplib/pl_movie.c
+   Input movie recording and playback
+
+   Copyright (C) 2026 Potator PSP contributors
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pl_movie.h"
+
+#define MOVIE_MAGIC   "SVMV"
+#define MOVIE_VERSION 1
+#define MAX_RUN       255
+
+static int write_u32(FILE *f, unsigned int value)
+{
+  unsigned char b[4] = { value, value >> 8, value >> 16, value >> 24 };
+  return fwrite(b, 4, 1, f) == 1;
+}
+
+static int read_u32(FILE *f, unsigned int *value)
+{
+  unsigned char b[4];
+  if (fread(b, 4, 1, f) != 1)
+    return 0;
+  *value = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+  return 1;
+}
+
+static int append_run(pl_movie *movie)
+{
+  if (movie->data_size + 2 > movie->data_capacity)
+  {
+    unsigned int capacity = (movie->data_capacity)
+      ? movie->data_capacity * 2 : 4096;
+    unsigned char *data = (unsigned char*)realloc(movie->data, capacity);
+    if (!data)
+      return 0;
+    movie->data = data;
+    movie->data_capacity = capacity;
+  }
+
+  movie->data[movie->data_size++] = movie->run_length;
+  movie->data[movie->data_size++] = movie->run_input;
+  movie->run_length = 0;
+
+  return 1;
+}
+
+static void clear(pl_movie *movie)
+{
+  free(movie->path);
+  free(movie->state);
+  free(movie->data);
+  pl_movie_init(movie);
+}
+
+void pl_movie_init(pl_movie *movie)
+{
+  memset(movie, 0, sizeof(pl_movie));
+  movie->mode = PL_MOVIE_IDLE;
+}
+
+int pl_movie_record(pl_movie *movie,
+                    const char *path,
+                    unsigned int rom_crc,
+                    const void *state,
+                    unsigned int state_size)
+{
+  pl_movie_stop(movie);
+
+  if (!(movie->path = strdup(path)))
+    return 0;
+
+  if (state && state_size)
+  {
+    if (!(movie->state = malloc(state_size)))
+    {
+      clear(movie);
+      return 0;
+    }
+    memcpy(movie->state, state, state_size);
+    movie->state_size = state_size;
+  }
+
+  movie->rom_crc = rom_crc;
+  movie->mode = PL_MOVIE_RECORDING;
+
+  return 1;
+}
+
+int pl_movie_play(pl_movie *movie,
+                  const char *path)
+{
+  char magic[4];
+  unsigned int version;
+  FILE *f;
+
+  pl_movie_stop(movie);
+
+  if (!(f = fopen(path, "rb")))
+    return 0;
+
+  if (fread(magic, 4, 1, f) != 1 || strncmp(magic, MOVIE_MAGIC, 4) != 0
+    || !read_u32(f, &version) || version != MOVIE_VERSION
+    || !read_u32(f, &movie->rom_crc)
+    || !read_u32(f, &movie->frame_count)
+    || !read_u32(f, &movie->state_size))
+    goto error;
+
+  if (movie->state_size)
+  {
+    if (!(movie->state = malloc(movie->state_size))
+      || fread(movie->state, movie->state_size, 1, f) != 1)
+      goto error;
+  }
+
+  if (!read_u32(f, &movie->data_size)
+    || !(movie->data = (unsigned char*)malloc(movie->data_size + 1))
+    || (movie->data_size
+      && fread(movie->data, movie->data_size, 1, f) != 1))
+    goto error;
+
+  fclose(f);
+  movie->data_capacity = movie->data_size;
+  movie->mode = PL_MOVIE_PLAYING;
+
+  return 1;
+
+error:
+  fclose(f);
+  clear(movie);
+  return 0;
+}
+
+int pl_movie_update(pl_movie *movie,
+                    unsigned char *input)
+{
+  switch (movie->mode)
+  {
+  case PL_MOVIE_RECORDING:
+    if (movie->run_length > 0
+      && (movie->run_input != *input || movie->run_length == MAX_RUN))
+      if (!append_run(movie))
+        return 0;
+
+    movie->run_input = *input;
+    movie->run_length++;
+    movie->frame_count++;
+    return 1;
+
+  case PL_MOVIE_PLAYING:
+    if (movie->run_length == 0)
+    {
+      if (movie->data_pos + 2 > movie->data_size)
+        return 0;
+      movie->run_length = movie->data[movie->data_pos++];
+      movie->run_input = movie->data[movie->data_pos++];
+      if (movie->run_length == 0)
+        return 0;
+    }
+
+    *input = movie->run_input;
+    movie->run_length--;
+    return 1;
+  }
+
+  return 0;
+}
+
+int pl_movie_stop(pl_movie *movie)
+{
+  int status = 1;
+
+  if (movie->mode == PL_MOVIE_RECORDING)
+  {
+    FILE *f;
+    status = 0;
+
+    if ((movie->run_length == 0 || append_run(movie))
+      && (f = fopen(movie->path, "wb")))
+    {
+      status = fwrite(MOVIE_MAGIC, 4, 1, f) == 1
+        && write_u32(f, MOVIE_VERSION)
+        && write_u32(f, movie->rom_crc)
+        && write_u32(f, movie->frame_count)
+        && write_u32(f, movie->state_size)
+        && (!movie->state_size
+          || fwrite(movie->state, movie->state_size, 1, f) == 1)
+        && write_u32(f, movie->data_size)
+        && (!movie->data_size
+          || fwrite(movie->data, movie->data_size, 1, f) == 1);
+
+      if (fclose(f) != 0)
+        status = 0;
+    }
+  }
+
+  clear(movie);
+  return status;
+}
@@ -0,0 +1,70 @@
+/* psplib/pl_movie.h
+   Input movie recording and playback
+
+   Copyright (C) 2026 Potator PSP contributors
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PL_MOVIE_H
+#define _PL_MOVIE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PL_MOVIE_IDLE      0
+#define PL_MOVIE_RECORDING 1
+#define PL_MOVIE_PLAYING   2
+
+/* A movie is a starting point (a serialized state, or power-on if there */
+/* is none), the CRC32 of the ROM and one input byte per frame, stored   */
+/* as (count, input) runs. */
+typedef struct pl_movie_t
+{
+  int mode;
+  char *path;
+  unsigned int rom_crc;
+  unsigned int frame_count;
+  void *state;              /* NULL - power-on */
+  unsigned int state_size;
+  unsigned char *data;      /* input runs */
+  unsigned int data_size;
+  unsigned int data_capacity;
+  unsigned int data_pos;
+  unsigned char run_input;
+  unsigned int run_length;
+} pl_movie;
+
+void pl_movie_init(pl_movie *movie);
+int  pl_movie_record(pl_movie *movie,
+                     const char *path,
+                     unsigned int rom_crc,
+                     const void *state,
+                     unsigned int state_size);
+/* Loads the movie; the caller checks rom_crc and restores the state */
+int  pl_movie_play(pl_movie *movie,
+                   const char *path);
+/* Call once per frame. Recording: logs the input. Playing: replaces */
+/* the input; returns 0 once the movie is over */
+int  pl_movie_update(pl_movie *movie,
+                     unsigned char *input);
+/* Writes the recording to disk; ends playback */
+int  pl_movie_stop(pl_movie *movie);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _PL_MOVIE_H
@@ -0,0 +1,188 @@
+/* psplib/pl_pace.c
+   Audio-driven frame pacing
+
+   Copyright (C) 2026 Potator PSP contributors
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pspkernel.h>
+#include <pspthreadman.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "pl_pace.h"
+
+#define DISCARD_SAMPLES 256
+
+int pl_pace_init(pl_pace *pace,
+                 unsigned int capacity)
+{
+  /* Nothing to release yet, should this fail */
+  pace->buffer = NULL;
+  pace->sema = -1;
+
+  /* Positions wrap around at 2^32; capacity must divide it */
+  if (capacity < 2 || (capacity & (capacity - 1)))
+    return 0;
+
+  if (!(pace->buffer =
+          (pl_snd_sample*)malloc(capacity * sizeof(pl_snd_sample))))
+    return 0;
+
+  if ((pace->sema = sceKernelCreateSema("pl_pace", 0, 0, 1, NULL)) < 0)
+  {
+    free(pace->buffer);
+    pace->buffer = NULL;
+    pace->sema = -1;
+    return 0;
+  }
+
+  pace->capacity = capacity;
+  pl_pace_reset(pace, 44100, 60, 2);
+
+  return 1;
+}
+
+void pl_pace_destroy(pl_pace *pace)
+{
+  if (pace->sema >= 0)
+    sceKernelDeleteSema(pace->sema);
+  pace->sema = -1;
+
+  if (pace->buffer)
+    free(pace->buffer);
+  pace->buffer = NULL;
+}
+
+/* Must not be called while the sound thread is reading */
+void pl_pace_reset(pl_pace *pace,
+                   int sample_rate,
+                   float frame_rate,
+                   int latency_frames)
+{
+  pace->frame_samples = (float)sample_rate / frame_rate;
+  pace->target = (unsigned int)(pace->frame_samples * latency_frames);
+
+  /* A full frame must still fit when the queue is at target level */
+  if (pace->target > pace->capacity / 2)
+    pace->target = pace->capacity / 2;
+
+  /* Start at target level with silence to ride out the first frames */
+  memset(pace->buffer, 0, pace->target * sizeof(pl_snd_sample));
+  pace->read_pos = 0;
+  pace->write_pos = pace->target;
+  pace->remainder = 0;
+  pace->ratio = 1.0f;
+  pace->integral = 0;
+  pace->underruns = 0;
+}
+
+int pl_pace_write_frame(pl_pace *pace,
+                        pl_snd_callback fill,
+                        void *userdata,
+                        int block)
+{
+  static pl_snd_sample discard[DISCARD_SAMPLES];
+  unsigned int queued, count, room, pos, span, produced, waited = 0;
+  float wanted, error;
+
+  /* Block until the sound thread drains the queue to the target level */
+  while ((queued = pace->write_pos - pace->read_pos) > pace->target && block)
+  {
+    sceKernelWaitSema(pace->sema, 1, NULL);
+    waited = 1;
+  }
+
+  /* Steer the resampling ratio towards the target fill level. The */
+  /* proportional term alone leaves the fill wherever it offsets the */
+  /* clock mismatch (or pinned at a limit, when the mismatch is close */
+  /* to it); the integral term takes the mismatch over. It is held */
+  /* while the limiter throttles: the frames then follow the audio */
+  /* clock, and there is no mismatch to learn */
+  error = ((float)pace->target - (float)queued) / (float)pace->target;
+  if (!waited)
+  {
+    pace->integral += PL_PACE_GAIN_I * error;
+    if (pace->integral < -PL_PACE_MAX_DEVIATION)
+      pace->integral = -PL_PACE_MAX_DEVIATION;
+    else if (pace->integral > PL_PACE_MAX_DEVIATION)
+      pace->integral = PL_PACE_MAX_DEVIATION;
+  }
+
+  pace->ratio = 1.0f + pace->integral + PL_PACE_GAIN_P * error;
+  if (pace->ratio < 1.0f - PL_PACE_MAX_DEVIATION)
+    pace->ratio = 1.0f - PL_PACE_MAX_DEVIATION;
+  else if (pace->ratio > 1.0f + PL_PACE_MAX_DEVIATION)
+    pace->ratio = 1.0f + PL_PACE_MAX_DEVIATION;
+
+  wanted = pace->frame_samples * pace->ratio + pace->remainder;
+  produced = count = (unsigned int)wanted;
+  pace->remainder = wanted - (float)count;
+
+  /* Fill the ring in (at most) two contiguous spans */
+  room = pace->capacity - queued;
+  span = (count < room) ? count : room;
+  pos = pace->write_pos & (pace->capacity - 1);
+
+  if (pos + span > pace->capacity)
+  {
+    fill(pace->buffer + pos, pace->capacity - pos, userdata);
+    fill(pace->buffer, span - (pace->capacity - pos), userdata);
+  }
+  else if (span > 0)
+    fill(pace->buffer + pos, span, userdata);
+
+  pace->write_pos += span;
+
+  /* Queue is full (unthrottled); the rest is generated, but dropped */
+  for (count -= span; count > 0; count -= span)
+  {
+    span = (count < DISCARD_SAMPLES) ? count : DISCARD_SAMPLES;
+    fill(discard, span, userdata);
+  }
+
+  return produced;
+}
+
+void pl_pace_read(pl_pace *pace,
+                  pl_snd_sample *buffer,
+                  unsigned int samples)
+{
+  unsigned int queued = pace->write_pos - pace->read_pos;
+  unsigned int count = (samples < queued) ? samples : queued;
+  unsigned int pos = pace->read_pos & (pace->capacity - 1);
+
+  if (pos + count > pace->capacity)
+  {
+    memcpy(buffer, pace->buffer + pos,
+      (pace->capacity - pos) * sizeof(pl_snd_sample));
+    memcpy(buffer + (pace->capacity - pos), pace->buffer,
+      (count - (pace->capacity - pos)) * sizeof(pl_snd_sample));
+  }
+  else
+    memcpy(buffer, pace->buffer + pos, count * sizeof(pl_snd_sample));
+
+  pace->read_pos += count;
+
+  /* Underrun - pad with silence */
+  if (count < samples)
+  {
+    memset(buffer + count, 0, (samples - count) * sizeof(pl_snd_sample));
+    pace->underruns++;
+  }
+
+  /* Wake the emulation thread */
+  sceKernelSignalSema(pace->sema, 1);
+}
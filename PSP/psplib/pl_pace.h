@@ -0,0 +1,71 @@
+/* psplib/pl_pace.h
+   Audio-driven frame pacing
+
+   Copyright (C) 2026 Potator PSP contributors
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PL_PACE_H
+#define _PL_PACE_H
+
+#include "pl_snd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum deviation of the resampling ratio (+/- 0.5%) */
+#define PL_PACE_MAX_DEVIATION 0.005f
+/* Gains of the fill level controller, per frame and relative to target */
+#define PL_PACE_GAIN_P        0.003f
+#define PL_PACE_GAIN_I        0.00001f
+
+typedef struct pl_pace_t
+{
+  pl_snd_sample *buffer;
+  unsigned int capacity; /* power of two */
+  unsigned int target;
+  volatile unsigned int read_pos;
+  volatile unsigned int write_pos;
+  int sema;
+  float frame_samples;
+  float remainder;
+  float ratio;
+  float integral; /* steady clock mismatch, as learned so far */
+  unsigned int underruns;
+} pl_pace;
+
+int  pl_pace_init(pl_pace *pace,
+                  unsigned int capacity);
+void pl_pace_destroy(pl_pace *pace);
+void pl_pace_reset(pl_pace *pace,
+                   int sample_rate,
+                   float frame_rate,
+                   int latency_frames);
+/* Produces one frame's worth of samples via fill(); returns sample count */
+int  pl_pace_write_frame(pl_pace *pace,
+                         pl_snd_callback fill,
+                         void *userdata,
+                         int block);
+/* Called from the sound thread */
+void pl_pace_read(pl_pace *pace,
+                  pl_snd_sample *buffer,
+                  unsigned int samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _PL_PACE_H
@@ -21,6 +21,7 @@
 
 #include <pspkernel.h>
 #include <psppower.h>
+#include <pspmscm.h>
 #include <malloc.h>
 #include <string.h>
 
@@ -34,6 +35,7 @@ typedef struct pl_psp_callback_t
 
 static char _app_directory[1024];
 static pl_psp_callback _exit_callback;
+static pl_psp_callback _media_callback;
 int ExitPSP;
 
 static int _callback_thread(SceSize args, void* argp);
@@ -54,6 +56,8 @@ int pl_psp_init(const char *app_path)
 
   _exit_callback.handler = NULL;
   _exit_callback.param = NULL;
+  _media_callback.handler = NULL;
+  _media_callback.param = NULL;
 
   return 1;
 }
@@ -93,6 +97,12 @@ static int _callback_thread(SceSize args, void* argp)
     sceKernelRegisterExitCallback(cbid);
   }
 
+  if (_media_callback.handler)
+  {
+    cbid = sceKernelCreateCallback("Media Callback", _callback, &_media_callback);
+    MScmRegisterMSInsertEjectCallback(cbid);
+  }
+
   sceKernelSleepThreadCB();
   return 0;
 }
@@ -107,6 +117,10 @@ int pl_psp_register_callback(pl_callback_type type,
     _exit_callback.handler = func;
     _exit_callback.param = param;
     break;
+  case PSP_MEDIA_CALLBACK:
+    _media_callback.handler = func;
+    _media_callback.param = param;
+    break;
   default:
     return 0;
   }
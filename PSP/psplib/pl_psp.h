@@ -28,7 +28,8 @@ extern "C" {
 
 typedef enum
 {
-  PSP_EXIT_CALLBACK
+  PSP_EXIT_CALLBACK,
+  PSP_MEDIA_CALLBACK  /* Memory Stick inserted or ejected */
 } pl_callback_type;
 
 extern int ExitPSP;
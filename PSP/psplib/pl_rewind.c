@@ -21,81 +21,252 @@
 */
 
 #include <stdlib.h>
-#include <stdio.h>
+#include <string.h>
+#include <psprtc.h>
 
 #include "pl_rewind.h"
 
-typedef struct rewind_state
+/* Snapshots are kept in one ring arena. Every PL_REWIND_KEY_INTERVAL-th
+   one is stored in full (keyframe); the others are stored as the XOR of
+   the snapshot and its predecessor, run-length encoded. XOR works both
+   ways: applied to a snapshot, a delta yields the previous one; applied
+   to the previous one, it yields the snapshot. */
+
+typedef struct rewind_record
+{
+  unsigned int offset;
+  unsigned int length;
+  int key;
+} rewind_record_t;
+
+/* Delta token: u16 bytes to skip, u16 literal count, literals */
+#define TOKEN_SIZE 4
+#define TOKEN_MAX  0xffff
+/* Shorter runs of unchanged bytes are cheaper to keep as literals */
+#define MIN_SKIP   4
+/* Average record size used to size the index */
+#define AVG_RECORD 64
+
+/* Regions of the allocation are aligned for word-sized compares */
+#define ALIGN(x) (((x) + 15) & ~15)
+
+#define RECORD(r, i) \
+  (&(r)->records[((r)->first + (i)) & ((r)->record_capacity - 1)])
+
+static void put_token(unsigned char *out,
+  unsigned int skip, unsigned int count)
+{
+  out[0] = skip & 0xff;
+  out[1] = skip >> 8;
+  out[2] = count & 0xff;
+  out[3] = count >> 8;
+}
+
+/* Returns the encoded length, or -1 if it would exceed max */
+static int encode_delta(const unsigned char *curr,
+  const unsigned char *prev, int size, unsigned char *out, int max)
 {
-  void *data;
-  struct rewind_state *prev;
-  struct rewind_state *next;
-} rewind_state_t;
+  int pos = 0, len = 0, start, lit, i;
 
-static int get_free_memory();
+  while (pos < size)
+  {
+    /* Skip unchanged bytes, a word at a time when aligned */
+    for (start = pos; pos < size; pos++)
+    {
+      while (!(pos & 3) && pos + 4 <= size
+        && *(const unsigned int*)(curr + pos)
+          == *(const unsigned int*)(prev + pos))
+        pos += 4;
+      if (pos >= size || curr[pos] != prev[pos])
+        break;
+    }
+    if (pos >= size)
+      break;
+
+    for (; pos - start > TOKEN_MAX; start += TOKEN_MAX)
+    {
+      if (len + TOKEN_SIZE > max) return -1;
+      put_token(out + len, TOKEN_MAX, 0);
+      len += TOKEN_SIZE;
+    }
+
+    /* Collect changed bytes, up to the next run of unchanged ones */
+    for (lit = pos; pos < size && pos - lit < TOKEN_MAX; pos++)
+      if (curr[pos] == prev[pos] && (pos + MIN_SKIP > size
+          || memcmp(curr + pos, prev + pos, MIN_SKIP) == 0))
+        break;
+
+    if (len + TOKEN_SIZE + (pos - lit) > max) return -1;
+    put_token(out + len, lit - start, pos - lit);
+    len += TOKEN_SIZE;
+    for (i = lit; i < pos; i++)
+      out[len++] = curr[i] ^ prev[i];
+  }
+
+  return len;
+}
+
+static void apply_delta(unsigned char *state,
+  const unsigned char *delta, unsigned int length)
+{
+  const unsigned char *end = delta + length;
+  unsigned int count;
+
+  while (delta < end)
+  {
+    state += delta[0] | (delta[1] << 8);
+    count = delta[2] | (delta[3] << 8);
+    delta += TOKEN_SIZE;
+    for (; count > 0; count--)
+      *state++ ^= *delta++;
+  }
+}
+
+/* Drops the oldest keyframe along with its deltas */
+static void evict_oldest(pl_rewind *rewind)
+{
+  do
+  {
+    rewind->arena_used -= RECORD(rewind, 0)->length;
+    rewind->first = (rewind->first + 1) & (rewind->record_capacity - 1);
+    rewind->state_count--;
+  } while (rewind->state_count > 0 && !RECORD(rewind, 0)->key);
+}
+
+/* Makes room for length bytes at the head; returns the offset */
+static int reserve(pl_rewind *rewind, unsigned int length)
+{
+  if (length > rewind->arena_size)
+    return -1;
+
+  /* Records past the head are older than those before it */
+  if (rewind->arena_head + length > rewind->arena_size)
+  {
+    while (rewind->state_count > 0
+      && RECORD(rewind, 0)->offset >= rewind->arena_head)
+      evict_oldest(rewind);
+    rewind->arena_head = 0;
+  }
+
+  while (rewind->state_count > 0
+    && RECORD(rewind, 0)->offset >= rewind->arena_head
+    && RECORD(rewind, 0)->offset < rewind->arena_head + length)
+    evict_oldest(rewind);
+
+  return rewind->arena_head;
+}
 
 int pl_rewind_init(pl_rewind *rewind,
+  unsigned int budget,
   int (*save_state)(void *),
   int (*load_state)(void *),
   int (*get_state_size)())
 {
-	float memory_needed = (float)get_free_memory() * 0.85;
-  int state_data_size = get_state_size();
-  int state_count = (int)(memory_needed 
-                    / (float)(state_data_size + sizeof(rewind_state_t)));
+  return pl_rewind_init_ex(rewind, budget,
+    PL_REWIND_DELTA, PL_REWIND_KEY_INTERVAL,
+    save_state, load_state, get_state_size, NULL);
+}
 
-	if (state_count < 1)
-    return 0;
+static int delta_init(pl_rewind *rewind)
+{
+  unsigned int state_alloc = ALIGN(rewind->state_data_size);
 
-  /* First state */
-  rewind_state_t *prev, *curr = NULL;
-  if (!(rewind->start = (rewind_state_t*)malloc(sizeof(rewind_state_t))))
+  /* Two decoded snapshots come off the top */
+  if (rewind->budget < state_alloc * 2)
+    return 0;
+  unsigned int available = rewind->budget - state_alloc * 2;
+
+  /* Size the index for the average record; the rest is arena */
+  int record_capacity = 1;
+  while (record_capacity * 2 * (AVG_RECORD + sizeof(rewind_record_t))
+      <= available)
+    record_capacity *= 2;
+  unsigned int index_alloc = ALIGN(record_capacity * sizeof(rewind_record_t));
+
+  /* Need room for at least two keyframes */
+  if (record_capacity < 2 || available < index_alloc
+      || available - index_alloc < state_alloc * 2)
     return 0;
 
-  if (!(rewind->start->data = malloc(state_data_size)))
-  {
-    free(rewind->start);
-    rewind->start = NULL;
+  unsigned char *memory = (unsigned char*)malloc(rewind->budget);
+  if (!memory)
     return 0;
-  }
 
-  prev = rewind->start;
+  rewind->memory = memory;
+  rewind->state = memory;
+  rewind->scratch = memory + state_alloc;
+  rewind->records = (rewind_record_t*)(memory + state_alloc * 2);
+  rewind->arena = memory + state_alloc * 2 + index_alloc;
+  rewind->arena_size = available - index_alloc;
+  rewind->record_capacity = record_capacity;
 
-  /* The rest */
-  int i;
-  for (i = 1; i < state_count; i++)
-  {
-    /* If allocation fails, compose a shorter state chain */
-    if (!(curr = (rewind_state_t*)malloc(sizeof(rewind_state_t))))
-    {
-      state_count = i + 1;
-      break;
-    }
+  return 1;
+}
 
-    /* If allocation fails, compose a shorter state chain */
-    if (!(curr->data = malloc(state_data_size)))
-    {
-      state_count = i + 1;
-      free(curr);
-      break;
-    }
+static int replay_init(pl_rewind *rewind)
+{
+  unsigned int state_alloc = ALIGN(rewind->state_data_size);
 
-    prev->next = curr;
-    curr->prev = prev;
-    prev = curr;
+  /* Each keyframe comes with the inputs of the frames it starts */
+  int key_capacity = rewind->budget
+    / (state_alloc + rewind->key_interval);
+  unsigned int input_alloc = ALIGN(key_capacity * rewind->key_interval);
+
+  while (key_capacity >= 2
+      && key_capacity * state_alloc + input_alloc > rewind->budget)
+  {
+    key_capacity--;
+    input_alloc = ALIGN(key_capacity * rewind->key_interval);
   }
 
-  /* Make circular */
-  rewind->start->prev = prev;
-  curr->next = rewind->start;
+  if (key_capacity < 2 || !rewind->run_frame)
+    return 0;
+
+  unsigned char *memory = (unsigned char*)malloc(rewind->budget);
+  if (!memory)
+    return 0;
+
+  rewind->memory = memory;
+  rewind->keys = memory;
+  rewind->inputs = memory + key_capacity * state_alloc;
+  rewind->key_capacity = key_capacity;
 
-  /* Init structure */
-  rewind->current = NULL;
+  return 1;
+}
+
+int pl_rewind_init_ex(pl_rewind *rewind,
+  unsigned int budget,
+  int mode,
+  int key_interval,
+  int (*save_state)(void *),
+  int (*load_state)(void *),
+  int (*get_state_size)(),
+  void (*run_frame)(unsigned char input))
+{
+  rewind->memory = NULL;
+  rewind->arena = NULL;
+  rewind->records = NULL;
+  rewind->state = NULL;
+  rewind->scratch = NULL;
+  rewind->keys = NULL;
+  rewind->inputs = NULL;
+  rewind->budget = budget;
+  rewind->mode = mode;
+  rewind->key_interval = (key_interval > 0) ? key_interval : 1;
+  if (rewind->key_interval > PL_REWIND_MAX_KEY_INTERVAL)
+    rewind->key_interval = PL_REWIND_MAX_KEY_INTERVAL;
   rewind->save_state = save_state;
   rewind->load_state = load_state;
   rewind->get_state_size = get_state_size;
-  rewind->state_data_size = state_data_size;
-  rewind->state_count = state_count;
+  rewind->run_frame = run_frame;
+  rewind->state_data_size = get_state_size();
+
+  int status = (mode == PL_REWIND_REPLAY)
+    ? replay_init(rewind) : delta_init(rewind);
+  if (!status)
+    return 0;
+
+  pl_rewind_reset(rewind);
 
   return 1;
 }
@@ -103,93 +274,295 @@ int pl_rewind_init(pl_rewind *rewind,
 void pl_rewind_realloc(pl_rewind *rewind)
 {
   pl_rewind_destroy(rewind);
-  pl_rewind_init(rewind,
+  pl_rewind_init_ex(rewind,
+    rewind->budget,
+    rewind->mode,
+    rewind->key_interval,
     rewind->save_state,
     rewind->load_state,
-    rewind->get_state_size);
+    rewind->get_state_size,
+    rewind->run_frame);
 }
 
 void pl_rewind_destroy(pl_rewind *rewind)
 {
-  rewind->start->prev->next = NULL; /* Prevent infinite loop */
-	rewind_state_t *curr, *next;
+  free(rewind->memory);
+
+  rewind->memory = NULL;
+  rewind->arena = NULL;
+  rewind->records = NULL;
+  rewind->state = NULL;
+  rewind->scratch = NULL;
+  rewind->keys = NULL;
+  rewind->inputs = NULL;
+  rewind->state_count = 0;
+}
+
+void pl_rewind_reset(pl_rewind *rewind)
+{
+  rewind->state_count = 0;
+  rewind->first = 0;
+  rewind->since_key = 0;
+  rewind->restored = rewind->live = 0;
+  rewind->arena_head = 0;
+  rewind->arena_used = 0;
+  rewind->save_ticks = rewind->restore_ticks = 0;
+  rewind->save_count = rewind->restore_count = 0;
+  rewind->max_restore_ticks = 0;
+  rewind->replay_ticks = 0;
+  rewind->replay_count = 0;
+}
+
+static int delta_save(pl_rewind *rewind)
+{
+  if (!rewind->save_state(rewind->scratch))
+    return 0;
+
+  /* Index is full - drop the oldest keyframe */
+  if (rewind->state_count == rewind->record_capacity)
+    evict_oldest(rewind);
 
-  for (curr = rewind->start; curr; curr = next)
+  /* Reserve enough for a keyframe; a delta is never larger */
+  int size = rewind->state_data_size;
+  int offset = reserve(rewind, size);
+  if (offset < 0)
+    return 0;
+
+  unsigned char *data = rewind->arena + offset;
+  int key = (rewind->state_count == 0
+    || rewind->since_key >= rewind->key_interval - 1);
+  int length = size;
+
+  if (!key && (length = encode_delta(rewind->scratch,
+      rewind->state, size, data, size)) < 0)
+    key = 1;
+  if (key)
   {
-    next = curr->next;
-    free(curr->data);
-    free(curr);
+    memcpy(data, rewind->scratch, size);
+    length = size;
   }
 
-  rewind->start = NULL;
-  rewind->current = NULL;
+  rewind_record_t *record = RECORD(rewind, rewind->state_count);
+  record->offset = offset;
+  record->length = length;
+  record->key = key;
+
+  rewind->state_count++;
+  rewind->arena_head = offset + length;
+  rewind->arena_used += length;
+  rewind->since_key = (key) ? 0 : rewind->since_key + 1;
+
+  /* The new snapshot is now the newest */
+  unsigned char *swap = rewind->state;
+  rewind->state = rewind->scratch;
+  rewind->scratch = swap;
+
+  return 1;
 }
 
-void pl_rewind_reset(pl_rewind *rewind)
+/* Drops the newest record, decodes the one before it (if any) */
+static void delta_drop(pl_rewind *rewind)
 {
-  rewind->current = NULL;
+  rewind_record_t *record = RECORD(rewind, rewind->state_count - 1);
+  rewind->arena_head = record->offset;
+  rewind->arena_used -= record->length;
+  rewind->state_count--;
+
+  if (rewind->state_count == 0)
+    rewind->since_key = 0;
+  else if (!record->key)
+  {
+    apply_delta(rewind->state,
+      rewind->arena + record->offset, record->length);
+    rewind->since_key--;
+  }
+  else
+  {
+    /* Replay from the previous keyframe */
+    int i, key;
+    for (key = rewind->state_count - 1; !RECORD(rewind, key)->key; key--);
+
+    record = RECORD(rewind, key);
+    memcpy(rewind->state, rewind->arena + record->offset,
+      rewind->state_data_size);
+
+    for (i = key + 1; i < rewind->state_count; i++)
+    {
+      record = RECORD(rewind, i);
+      apply_delta(rewind->state,
+        rewind->arena + record->offset, record->length);
+    }
+
+    rewind->since_key = rewind->state_count - 1 - key;
+  }
 }
 
-int pl_rewind_save(pl_rewind *rewind)
+static int delta_restore(pl_rewind *rewind)
 {
-  rewind_state_t *save_slot = 
-    (rewind->current) ? rewind->current->next
-                      : rewind->start;
+  /* The frame run after the last step back was logged; it goes first */
+  if (rewind->live && rewind->state_count > 1)
+    delta_drop(rewind);
 
-	if (!rewind->save_state(save_slot->data))
+  if (!(rewind->state_count > 0 && rewind->load_state(rewind->state)))
     return 0;
 
-	rewind->current = save_slot;
+  delta_drop(rewind);
+  return 1;
+}
 
-  /* Move starting point forward, if we've reached the start node */
-  if (save_slot->next == rewind->start)
-    rewind->start = rewind->start->next;
+/* Frame n (counted from the oldest keyframe) */
+#define KEY(r, n) ((r)->keys + ALIGN((r)->state_data_size) \
+  * (((r)->first + (n) / (r)->key_interval) % (r)->key_capacity))
+#define INPUT(r, n) (&(r)->inputs[((r)->first * (r)->key_interval + (n)) \
+  % ((r)->key_capacity * (r)->key_interval)])
+
+static int replay_save(pl_rewind *rewind, unsigned char input)
+{
+  int frame = rewind->state_count;
+
+  if (frame % rewind->key_interval == 0)
+  {
+    /* Out of keyframes - drop the oldest, along with its inputs */
+    if (frame / rewind->key_interval == rewind->key_capacity)
+    {
+      rewind->first = (rewind->first + 1) % rewind->key_capacity;
+      rewind->state_count -= rewind->key_interval;
+      frame -= rewind->key_interval;
+    }
+
+    if (!rewind->save_state(KEY(rewind, frame)))
+      return 0;
+  }
+
+  *INPUT(rewind, frame) = input;
+  rewind->state_count++;
 
   return 1;
 }
 
-int pl_rewind_restore(pl_rewind *rewind)
+static int replay_restore(pl_rewind *rewind)
 {
-  rewind_state_t *load_slot = rewind->current;
-  if (!(load_slot && rewind->load_state(load_slot->data)))
+  /* The frame run after the last step back was logged; it goes first */
+  if (rewind->live && rewind->state_count > 1)
+    rewind->state_count--;
+
+  if (rewind->state_count == 0)
+    return 0;
+
+  /* Restore the nearest keyframe, re-emulate up to the newest frame */
+  int frame = rewind->state_count - 1;
+  int key = frame - frame % rewind->key_interval;
+
+  if (!rewind->load_state(KEY(rewind, key)))
     return 0;
 
-  /* Can't go past the starting point */
-  if (load_slot != rewind->start)
-    rewind->current = rewind->current->prev;
+  if (key < frame)
+  {
+    u64 start_tick, end_tick;
+    sceRtcGetCurrentTick(&start_tick);
+
+    rewind->replay_count += frame - key;
+    for (; key < frame; key++)
+      rewind->run_frame(*INPUT(rewind, key));
+
+    sceRtcGetCurrentTick(&end_tick);
+    rewind->replay_ticks += end_tick - start_tick;
+  }
+
+  /* The core is where the next save will describe it */
+  rewind->state_count--;
 
   return 1;
 }
 
-static int get_free_memory()
+int pl_rewind_save(pl_rewind *rewind, unsigned char input)
 {
-  const int 
-    chunk_size = 65536, // 64 kB
-    chunks = 1024; // 65536 * 1024 = 64 MB
-  void *mem_reserv[chunks];
-  int total_mem = 0, i;
+  u64 start_tick, end_tick;
+  sceRtcGetCurrentTick(&start_tick);
 
-  /* Initialize */	
-  for (i = 0; i < chunks; i++)
-    mem_reserv[i] = NULL;
+  int status = (rewind->mode == PL_REWIND_REPLAY)
+    ? replay_save(rewind, input) : delta_save(rewind);
 
-  /* Allocate */
-  for (i = 0; i < chunks; i++)
-  {
-    if (!(mem_reserv[i] = malloc(chunk_size)))
-      break;
+  rewind->live = rewind->restored;
+  rewind->restored = 0;
 
-    total_mem += chunk_size;
-  }
+  sceRtcGetCurrentTick(&end_tick);
+  rewind->save_ticks += end_tick - start_tick;
+  rewind->save_count++;
+
+  return status;
+}
+
+int pl_rewind_restore(pl_rewind *rewind)
+{
+  u64 start_tick, end_tick;
+  sceRtcGetCurrentTick(&start_tick);
+
+  int status = (rewind->mode == PL_REWIND_REPLAY)
+    ? replay_restore(rewind) : delta_restore(rewind);
+
+  rewind->restored = status;
+  rewind->live = 0;
+
+  sceRtcGetCurrentTick(&end_tick);
+  rewind->restore_ticks += end_tick - start_tick;
+  rewind->restore_count++;
+  if (end_tick - start_tick > rewind->max_restore_ticks)
+    rewind->max_restore_ticks = end_tick - start_tick;
+
+  return status;
+}
+
+float pl_rewind_get_save_time(const pl_rewind *rewind)
+{
+  if (!rewind->save_count)
+    return 0;
+  return (float)rewind->save_ticks / (float)rewind->save_count
+    * 1000000.0f / (float)sceRtcGetTickResolution();
+}
 
-  /* Free */
-  for (i = 0; i < chunks; i++)
+float pl_rewind_get_restore_time(const pl_rewind *rewind)
+{
+  if (!rewind->restore_count)
+    return 0;
+  return (float)rewind->restore_ticks / (float)rewind->restore_count
+    * 1000000.0f / (float)sceRtcGetTickResolution();
+}
+
+float pl_rewind_get_capacity_seconds(const pl_rewind *rewind,
+  float frame_rate)
+{
+  if (frame_rate <= 0)
+    return 0;
+
+  if (rewind->mode == PL_REWIND_REPLAY)
+    return (float)rewind->key_capacity * (float)rewind->key_interval
+      / frame_rate;
+
+  if (!rewind->state_count || !rewind->arena_used)
+    return 0;
+
+  float frames = (float)rewind->arena_size * (float)rewind->state_count
+    / (float)rewind->arena_used;
+  if (frames > (float)rewind->record_capacity)
+    frames = (float)rewind->record_capacity;
+
+  return frames / frame_rate;
+}
+
+float pl_rewind_get_seek_latency(const pl_rewind *rewind)
+{
+  float resolution = (float)sceRtcGetTickResolution();
+  float worst = (float)rewind->max_restore_ticks * 1000000.0f / resolution;
+
+  /* Worst case for replay: a full keyframe interval to re-emulate */
+  if (rewind->mode == PL_REWIND_REPLAY && rewind->replay_count)
   {
-    if (!mem_reserv[i])
-      break;
-    free(mem_reserv[i]);
+    float estimate = (float)rewind->replay_ticks / (float)rewind->replay_count
+      * (float)(rewind->key_interval - 1) * 1000000.0f / resolution;
+    if (estimate > worst)
+      worst = estimate;
   }
-	
-	return total_mem;
-}
 
+  return worst;
+}
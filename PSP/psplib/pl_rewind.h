@@ -27,28 +27,92 @@
 extern "C" {
 #endif
 
-struct rewind_state;
+#include <psptypes.h>
+
+/* Backends:
+   DELTA  - every snapshot is kept, most as a delta to the previous one
+   REPLAY - keyframes plus per-frame input; restoring re-emulates from the
+            nearest keyframe. Much longer history, slower seeks. */
+#define PL_REWIND_DELTA  0
+#define PL_REWIND_REPLAY 1
+
+/* Default keyframe spacing, in frames */
+#define PL_REWIND_KEY_INTERVAL 60
+/* Every step back re-emulates up to key_interval-1 frames, so the
+   spacing is capped to keep rewinding close to real time */
+#define PL_REWIND_MAX_KEY_INTERVAL 60
+
+struct rewind_record;
 
 typedef struct
 {
+  int mode;
+  int key_interval;
+  unsigned int budget;    /* bytes, all-inclusive */
+  void *memory;           /* single allocation holding everything below */
   int state_data_size;
-  int state_count;
-  struct rewind_state *start;
-  struct rewind_state *current;
+  int state_count;        /* snapshots in the ring */
+  unsigned char *arena;   /* ring of keyframes and deltas */
+  unsigned int arena_size;
+  unsigned int arena_head;
+  unsigned int arena_used;
+  unsigned char *state;   /* newest snapshot, decoded */
+  unsigned char *scratch;
+  struct rewind_record *records;
+  int record_capacity;    /* power of two */
+  int first;              /* oldest record (always a keyframe)/key slot */
+  int since_key;          /* deltas after the newest keyframe */
+  int restored;           /* last call was a successful restore */
+  int live;               /* newest frame was run right after a restore */
+  unsigned char *keys;    /* REPLAY: ring of keyframes */
+  unsigned char *inputs;  /* REPLAY: one byte per frame */
+  int key_capacity;
   int (*save_state)(void *);
   int (*load_state)(void *);
   int (*get_state_size)();
+  void (*run_frame)(unsigned char input); /* REPLAY: emulate, don't render */
+  /* Cost of pl_rewind_save()/pl_rewind_restore() */
+  u64 save_ticks;
+  u64 restore_ticks;
+  unsigned int save_count;
+  unsigned int restore_count;
+  u64 max_restore_ticks;
+  u64 replay_ticks;
+  unsigned int replay_count;
 } pl_rewind;
 
 int  pl_rewind_init(pl_rewind *rewind,
+  unsigned int budget,
   int (*save_state)(void *),
   int (*load_state)(void *),
   int (*get_state_size)());
+int  pl_rewind_init_ex(pl_rewind *rewind,
+  unsigned int budget,
+  int mode,
+  int key_interval,
+  int (*save_state)(void *),
+  int (*load_state)(void *),
+  int (*get_state_size)(),
+  void (*run_frame)(unsigned char input));
 void pl_rewind_realloc(pl_rewind *rewind);
 void pl_rewind_destroy(pl_rewind *rewind);
 void pl_rewind_reset(pl_rewind *rewind);
-int  pl_rewind_save(pl_rewind *rewind);
+/* Call before emulating every frame, with the input for that frame -
+   including frames run right after a restore */
+int  pl_rewind_save(pl_rewind *rewind,
+  unsigned char input);
+/* Steps back a frame: loads the newest state and drops it from the
+   history (along with the frame run after the previous step back) */
 int  pl_rewind_restore(pl_rewind *rewind);
+/* Average cost, in microseconds */
+float pl_rewind_get_save_time(const pl_rewind *rewind);
+float pl_rewind_get_restore_time(const pl_rewind *rewind);
+/* Estimated length of history the budget holds, at the current
+   compression ratio */
+float pl_rewind_get_capacity_seconds(const pl_rewind *rewind,
+  float frame_rate);
+/* Worst-case time to step back one frame, in microseconds */
+float pl_rewind_get_seek_latency(const pl_rewind *rewind);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,328 @@
+/* psplib/pl_rom.c
+   Shared, reference-counted ROM images
+
+   Copyright (C) 2026 Potator PSP contributors
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "pl_rom.h"
+
+#ifdef PL_ROM_MMAP
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <pspkernel.h>
+#endif
+
+#define VALID_SIZE(size, granularity) \
+  ((size) > 0 && ((granularity) == 0 || (size) % (granularity) == 0))
+
+/* Images opened from files, for sharing */
+static pl_rom *OpenRoms = NULL;
+
+static int read_file(pl_rom_source *source,
+                     void *buffer,
+                     unsigned int length)
+{
+  return fread(buffer, 1, length, (FILE*)source->handle);
+}
+
+static int close_file(pl_rom_source *source)
+{
+  return fclose((FILE*)source->handle) == 0;
+}
+
+static int read_gzip(pl_rom_source *source,
+                     void *buffer,
+                     unsigned int length)
+{
+  return gzread((gzFile)source->handle, buffer, length);
+}
+
+static int close_gzip(pl_rom_source *source)
+{
+  return gzclose((gzFile)source->handle) == Z_OK;
+}
+
+/* Size and modification time, for telling whether an open file changed */
+static int get_stat(const char *path,
+                    unsigned int *size,
+                    ScePspDateTime *mtime)
+{
+#ifdef PL_ROM_MMAP
+  struct stat st;
+  struct tm tm;
+  long nsec;
+
+  if (stat(path, &st) != 0 || !gmtime_r(&st.st_mtime, &tm))
+    return 0;
+
+#ifdef __APPLE__
+  nsec = st.st_mtimespec.tv_nsec;
+#else
+  nsec = st.st_mtim.tv_nsec;
+#endif
+
+  *size = (unsigned int)st.st_size;
+  memset(mtime, 0, sizeof(*mtime));
+  mtime->year = tm.tm_year + 1900;
+  mtime->month = tm.tm_mon + 1;
+  mtime->day = tm.tm_mday;
+  mtime->hour = tm.tm_hour;
+  mtime->minute = tm.tm_min;
+  mtime->second = tm.tm_sec;
+  mtime->microsecond = nsec / 1000;
+#else
+  SceIoStat stat;
+
+  memset(&stat, 0, sizeof(stat));
+  if (sceIoGetstat(path, &stat) < 0)
+    return 0;
+
+  *size = (unsigned int)stat.st_size;
+  *mtime = stat.st_mtime;
+#endif
+
+  return 1;
+}
+
+#ifdef PL_ROM_MMAP
+static pl_rom* map_file(const char *path,
+                        unsigned int granularity)
+{
+  pl_rom *rom;
+  struct stat st;
+  void *data;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return NULL;
+
+  if (fstat(fd, &st) != 0 || !VALID_SIZE(st.st_size, granularity))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  /* The mapping outlives the descriptor */
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED)
+    return NULL;
+
+  if (!(rom = (pl_rom*)calloc(1, sizeof(pl_rom))))
+  {
+    munmap(data, st.st_size);
+    return NULL;
+  }
+
+  rom->data = (unsigned char*)data;
+  rom->size = (unsigned int)st.st_size;
+  rom->mapped = 1;
+  rom->refs = 1;
+
+  return rom;
+}
+#endif
+
+int pl_rom_source_file(pl_rom_source *source,
+                       const char *path)
+{
+  FILE *file;
+  long size;
+
+  if (!(file = fopen(path, "rb")))
+    return 0;
+
+  if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) <= 0
+    || fseek(file, 0, SEEK_SET) != 0)
+  {
+    fclose(file);
+    return 0;
+  }
+
+  source->size = (unsigned int)size;
+  source->handle = file;
+  source->read = read_file;
+  source->close = close_file;
+
+  return 1;
+}
+
+int pl_rom_source_gzip(pl_rom_source *source,
+                       const char *path)
+{
+  unsigned char header[2], trailer[4];
+  gzFile gz;
+  FILE *file;
+  int ok;
+
+  /* The uncompressed size (mod 2^32) ends the file */
+  if (!(file = fopen(path, "rb")))
+    return 0;
+
+  ok = fread(header, sizeof(header), 1, file) == 1
+    && header[0] == 0x1f && header[1] == 0x8b
+    && fseek(file, -4, SEEK_END) == 0
+    && fread(trailer, sizeof(trailer), 1, file) == 1;
+  fclose(file);
+
+  if (!ok || !(gz = gzopen(path, "rb")))
+    return 0;
+
+  source->size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16)
+    | ((unsigned int)trailer[3] << 24);
+  source->handle = gz;
+  source->read = read_gzip;
+  source->close = close_gzip;
+
+  return 1;
+}
+
+pl_rom* pl_rom_load(pl_rom_source *source,
+                    unsigned int granularity)
+{
+  pl_rom *rom = NULL;
+  unsigned int offset;
+  unsigned char extra;
+  int len = 0;
+
+  if (VALID_SIZE(source->size, granularity)
+    && (rom = pl_rom_create(source->size)))
+  {
+    for (offset = 0; offset < rom->size; offset += len)
+      if ((len = source->read(source, rom->data + offset,
+                              rom->size - offset)) <= 0)
+        break;
+
+    /* Short, or longer than advertised */
+    if (len <= 0 || source->read(source, &extra, 1) != 0)
+    {
+      pl_rom_release(rom);
+      rom = NULL;
+    }
+  }
+
+  if (!source->close(source) && rom)
+  {
+    pl_rom_release(rom);
+    rom = NULL;
+  }
+
+  return rom;
+}
+
+pl_rom* pl_rom_open(const char *path,
+                    unsigned int granularity)
+{
+  ScePspDateTime mtime;
+  unsigned int size;
+  pl_rom *rom;
+
+  if (!get_stat(path, &size, &mtime))
+    return NULL;
+
+  /* Already open and unchanged - share */
+  for (rom = OpenRoms; rom; rom = rom->next)
+    if (strcmp(rom->path, path) == 0
+      && rom->size == size
+      && memcmp(&rom->mtime, &mtime, sizeof(rom->mtime)) == 0)
+      return (VALID_SIZE(rom->size, granularity)) ? pl_rom_ref(rom) : NULL;
+
+#ifdef PL_ROM_MMAP
+  if (!(rom = map_file(path, granularity)))
+    return NULL;
+#else
+  pl_rom_source source;
+  if (!pl_rom_source_file(&source, path)
+    || !(rom = pl_rom_load(&source, granularity)))
+    return NULL;
+#endif
+
+  if (!(rom->path = strdup(path)))
+  {
+    pl_rom_release(rom);
+    return NULL;
+  }
+
+  rom->mtime = mtime;
+  rom->next = OpenRoms;
+  OpenRoms = rom;
+
+  return rom;
+}
+
+pl_rom* pl_rom_create(unsigned int size)
+{
+  pl_rom *rom;
+
+  if (!(rom = (pl_rom*)calloc(1, sizeof(pl_rom))))
+    return NULL;
+
+  if (!(rom->data = (unsigned char*)malloc(size)))
+  {
+    free(rom);
+    return NULL;
+  }
+
+  rom->size = size;
+  rom->refs = 1;
+
+  return rom;
+}
+
+pl_rom* pl_rom_ref(pl_rom *rom)
+{
+  rom->refs++;
+  return rom;
+}
+
+void pl_rom_release(pl_rom *rom)
+{
+  pl_rom **link;
+
+  if (!rom || --rom->refs > 0)
+    return;
+
+  /* Unlist */
+  for (link = &OpenRoms; *link; link = &(*link)->next)
+  {
+    if (*link == rom)
+    {
+      *link = rom->next;
+      break;
+    }
+  }
+
+#ifdef PL_ROM_MMAP
+  if (rom->mapped)
+    munmap(rom->data, rom->size);
+  else
+#endif
+  free(rom->data);
+
+  free(rom->path);
+  free(rom);
+}
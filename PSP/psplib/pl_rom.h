@@ -0,0 +1,86 @@
+/* psplib/pl_rom.h
+   Shared, reference-counted ROM images
+
+   Copyright (C) 2026 Potator PSP contributors
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PL_ROM_H
+#define _PL_ROM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <psptypes.h>
+
+/* Hosts other than the PSP map opened files instead of reading them */
+#if !defined(PSP) && (defined(__unix__) || defined(__APPLE__))
+#define PL_ROM_MMAP
+#endif
+
+/* A read-only ROM image. Opening a file that is already open, and */
+/* hasn't changed since (same size and modification time), shares the */
+/* image; it's released (unmapped) when the last reference is dropped. */
+/* A mapped file must be replaced, not rewritten in place. */
+typedef struct pl_rom_t
+{
+  unsigned char *data;
+  unsigned int size;
+  char *path;        /* NULL - created, not opened */
+  ScePspDateTime mtime;
+  int mapped;        /* data is a read-only mapping of the file */
+  int refs;
+  struct pl_rom_t *next;
+} pl_rom;
+
+/* Uncompressed data of a known size, read front to back; e.g. a */
+/* plain file, a gzip file or an archive member */
+typedef struct pl_rom_source_t
+{
+  unsigned int size;
+  void *handle;
+  /* Returns the number of bytes read; 0 at the end, < 0 on error */
+  int (*read)(struct pl_rom_source_t *source,
+              void *buffer,
+              unsigned int length);
+  /* Returns 0 if the data turned out to be bad (e.g. CRC mismatch) */
+  int (*close)(struct pl_rom_source_t *source);
+} pl_rom_source;
+
+int pl_rom_source_file(pl_rom_source *source,
+                       const char *path);
+int pl_rom_source_gzip(pl_rom_source *source,
+                       const char *path);
+
+/* Images with sizes that aren't a multiple of granularity (0 - any) */
+/* are refused before anything is allocated or read */
+
+/* Whole (uncompressed) file */
+pl_rom* pl_rom_open(const char *path,
+                    unsigned int granularity);
+/* Reads the source straight into the image, then closes the source */
+pl_rom* pl_rom_load(pl_rom_source *source,
+                    unsigned int granularity);
+/* Buffer for the caller to fill, e.g. from an archive */
+pl_rom* pl_rom_create(unsigned int size);
+pl_rom* pl_rom_ref(pl_rom *rom);
+void    pl_rom_release(pl_rom *rom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _PL_ROM_H
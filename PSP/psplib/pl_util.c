@@ -30,15 +30,17 @@
 #include "pl_file.h"
 #include "video.h"
 
-#define CRC_BUFFER_SIZE  8192
+#define CRC_BUFFER_SIZE  (64 * 1024)
 
 static uint32_t compute_buffer_crc(uint32_t inCrc32,
                                    const void *buf,
                                    size_t bufLen);
 
-int pl_util_save_image_seq(const char *path,
-                           const char *filename,
-                           const PspImage *image)
+/* Finds the first free "<path><filename>-NN.png" */
+static int get_seq_path(char *full_path,
+                        size_t size,
+                        const char *path,
+                        const char *filename)
 {
   /* If screenshot path does not exist, create it */
   if (!pl_file_exists(path))
@@ -47,19 +49,46 @@ int pl_util_save_image_seq(const char *path,
 
   /* Loop until first free screenshot slot is found */
   int i = 0;
-  pl_file_path full_path;
   do
   {
     snprintf(full_path, 
-             sizeof(full_path) - 1,
+             size - 1,
              "%s%s-%02i.png",
              path, filename, i);
   } while (pl_file_exists(full_path) && ++i < 100);
 
+  return 1;
+}
+
+int pl_util_save_image_seq(const char *path,
+                           const char *filename,
+                           const PspImage *image)
+{
+  pl_file_path full_path;
+  if (!get_seq_path(full_path, sizeof(full_path), path, filename))
+    return 0;
+
   /* Save the screenshot */
   return pspImageSavePng(full_path, image);
 }
 
+int pl_util_save_indexed_seq(const char *path,
+                             const char *filename,
+                             const unsigned char *pixels,
+                             int width,
+                             int height,
+                             int bits,
+                             const unsigned char *rgb,
+                             int colors)
+{
+  pl_file_path full_path;
+  if (!get_seq_path(full_path, sizeof(full_path), path, filename))
+    return 0;
+
+  return pspImageSavePngIndexed(full_path, pixels, width, height,
+                                bits, rgb, colors);
+}
+
 int pl_util_save_vram_seq(const char *path, 
                           const char *filename)
 {
@@ -119,9 +148,13 @@ int pl_util_compute_crc32_file(const char *path,
 int pl_util_compute_crc32_fd(FILE *file,
                              uint32_t *outCrc32)
 {
-  unsigned char buf[CRC_BUFFER_SIZE];
+  unsigned char *buf;
   size_t bufLen;
 
+  /* Large reads; the buffer is too big for thread stacks */
+  if (!(buf = (unsigned char*)malloc(CRC_BUFFER_SIZE)))
+    return -1;
+
   /** accumulate crc32 from file **/
   *outCrc32 = 0;
   while (1) 
@@ -129,20 +162,20 @@ int pl_util_compute_crc32_fd(FILE *file,
       if ((bufLen = fread( buf, 1, CRC_BUFFER_SIZE, file )) == 0) 
       {
           if (ferror(file)) 
+          {
+            free(buf);
             return -1;
+          }
           break;
       }
       *outCrc32 = compute_buffer_crc(*outCrc32, buf, bufLen);
   }
 
+  free(buf);
   return 0;
 }
 
-static uint32_t compute_buffer_crc(uint32_t inCrc32,
-                                   const void *buf,
-                                   size_t bufLen)
-{
-  static const unsigned long crcTable[256] = {
+static const uint32_t crcTable[256] = {
     0x00000000,0x77073096,0xEE0E612C,0x990951BA,0x076DC419,0x706AF48F,0xE963A535,
     0x9E6495A3,0x0EDB8832,0x79DCB8A4,0xE0D5E91E,0x97D2D988,0x09B64C2B,0x7EB17CBD,
     0xE7B82D07,0x90BF1D91,0x1DB71064,0x6AB020F2,0xF3B97148,0x84BE41DE,0x1ADAD47D,
@@ -180,14 +213,51 @@ static uint32_t compute_buffer_crc(uint32_t inCrc32,
     0x47B2CF7F,0x30B5FFE9,0xBDBDF21C,0xCABAC28A,0x53B39330,0x24B4A3A6,0xBAD03605,
     0xCDD70693,0x54DE5729,0x23D967BF,0xB3667A2E,0xC4614AB8,0x5D681B02,0x2A6F2B94,
     0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D };
-  unsigned long crc32;
-  unsigned char *byteBuf;
-  size_t i;
-
-  /** accumulate crc32 for buffer **/
-  crc32 = inCrc32 ^ 0xFFFFFFFF;
-  byteBuf = (unsigned char*) buf;
-  for (i=0; i < bufLen; i++)
-    crc32 = (crc32 >> 8) ^ crcTable[ (crc32 ^ byteBuf[i]) & 0xFF ];
-  return( crc32 ^ 0xFFFFFFFF );
+
+/* Slicing-by-8: crcTables[k][i] is the CRC of byte i followed by k zeros. */
+/* Filled in on first use; concurrent first calls write identical values */
+static uint32_t crcTables[8][256];
+static volatile int crcTablesReady = 0;
+
+static void init_crc_tables()
+{
+  int i, k;
+  for (i = 0; i < 256; i++)
+    crcTables[0][i] = crcTable[i];
+  for (k = 1; k < 8; k++)
+    for (i = 0; i < 256; i++)
+      crcTables[k][i] = (crcTables[k - 1][i] >> 8)
+        ^ crcTable[crcTables[k - 1][i] & 0xFF];
+  crcTablesReady = 1;
+}
+
+static uint32_t compute_buffer_crc(uint32_t inCrc32,
+                                   const void *buf,
+                                   size_t bufLen)
+{
+  const unsigned char *byteBuf = (const unsigned char*)buf;
+  uint32_t crc32 = inCrc32 ^ 0xFFFFFFFF;
+  uint32_t one, two;
+
+  if (!crcTablesReady)
+    init_crc_tables();
+
+  /** 8 bytes at a time **/
+  for (; bufLen >= 8; bufLen -= 8, byteBuf += 8)
+  {
+    one = crc32 ^ (byteBuf[0] | (byteBuf[1] << 8) | (byteBuf[2] << 16)
+      | ((uint32_t)byteBuf[3] << 24));
+    two = byteBuf[4] | (byteBuf[5] << 8) | (byteBuf[6] << 16)
+      | ((uint32_t)byteBuf[7] << 24);
+    crc32 = crcTables[7][one & 0xFF] ^ crcTables[6][(one >> 8) & 0xFF]
+      ^ crcTables[5][(one >> 16) & 0xFF] ^ crcTables[4][one >> 24]
+      ^ crcTables[3][two & 0xFF] ^ crcTables[2][(two >> 8) & 0xFF]
+      ^ crcTables[1][(two >> 16) & 0xFF] ^ crcTables[0][two >> 24];
+  }
+
+  /** then the rest **/
+  for (; bufLen > 0; bufLen--)
+    crc32 = (crc32 >> 8) ^ crcTable[(crc32 ^ *byteBuf++) & 0xFF];
+
+  return crc32 ^ 0xFFFFFFFF;
 }
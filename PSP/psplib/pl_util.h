@@ -33,6 +33,14 @@ extern "C" {
 int pl_util_save_image_seq(const char *path,
                            const char *filename,
                            const PspImage *image);
+int pl_util_save_indexed_seq(const char *path,
+                             const char *filename,
+                             const unsigned char *pixels,
+                             int width,
+                             int height,
+                             int bits,
+                             const unsigned char *rgb,
+                             int colors);
 int pl_util_save_vram_seq(const char *path,
                           const char *prefix);
 int pl_util_date_compare(const ScePspDateTime *date1,
@@ -80,6 +80,7 @@ void enter_directory(pl_file_path current_dir,
                      const char *subdir);
 
 #define BROWSER_TEMPLATE_COUNT 4
+#define BROWSER_READ_BATCH     64
 
 struct UiPos
 {
@@ -620,10 +621,72 @@ void pspUiFlashMessage(const char *message)
   if (screen) pspImageDestroy(screen);
 }
 
+/* Appends items for file and those after it, skipping dot-files; */
+/* returns the last file appended */
+static const pl_file* browser_append_files(pl_menu *menu,
+                                           const pl_file *file,
+                                           const char *sel_name,
+                                           const pl_menu_item **sel)
+{
+  const pl_file *last = NULL;
+  pl_menu_item *item;
+
+  for (; file; file = file->next)
+  {
+    last = file;
+
+    /* Skip files that begin with '.' */
+    if (file->name && file->name[0] == '.')
+      continue;
+
+    item = pl_menu_append_item(menu, 0, file->name);
+    item->param = (void*)(int)file->attrs;
+
+    if (sel_name && strcmp(file->name, sel_name) == 0)
+      *sel = item;
+  }
+
+  return last;
+}
+
+/* Computes the scroll position that shows the selection */
+static void browser_locate(const pl_menu *menu,
+                           const pl_menu_item **sel,
+                           struct UiPos *pos,
+                           int lnmax)
+{
+  const pl_menu_item *item;
+
+  pos->Index = pos->Offset = 0;
+  pos->Top = NULL;
+
+  if (!*sel) 
+  { 
+    /* Select the first file/dir in the directory */
+    if (menu->items && menu->items->next)
+      *sel = menu->items->next;
+    else if (menu->items)
+      *sel = menu->items;
+  }
+
+  /* Compute index and offset of selected file */
+  if (*sel)
+  {
+    pos->Top = menu->items;
+    for (item = menu->items; item != *sel; item = item->next)
+    {
+      if (pos->Index + 1 >= lnmax) { pos->Offset++; pos->Top=pos->Top->next; } 
+      else pos->Index++;
+    }
+  }
+}
+
 void pspUiOpenBrowser(PspUiFileBrowser *browser, const char *start_path)
 {
-  pl_file *file;
-  pl_file_list list;
+  const pl_file *last_file;
+  pl_file_list list = { NULL, NULL };
+  const pl_menu_item *first_sel;
+  int loading;
   const pl_menu_item *sel, *last_sel;
   pl_menu_item *item;
   SceCtrlData pad;
@@ -683,79 +746,84 @@ void pspUiOpenBrowser(PspUiFileBrowser *browser, const char *start_path)
     pos.Top = NULL;
     pl_menu_clear_items(&menu);
 
-    /* Load list of files for the selected path */
-    if (pl_file_get_file_list(&list, cur_path, browser->Filter) >= 0)
-    {
-      /* Check for a parent path, prepend .. if necessary */
-      if ((hasparent =! pl_file_is_root_directory(cur_path)))
-      {
-        item = pl_menu_append_item(&menu, 0, "..");
-        item->param = (void*)PL_FILE_DIRECTORY;
-      }
-
-      /* Add a menu item for each file */
-      for (file = list.files; file; file = file->next)
-      {
-        /* Skip files that begin with '.' */
-        if (file->name && file->name[0] == '.')
-          continue;
-
-        item = pl_menu_append_item(&menu, 0, file->name);
-        item->param = (void*)(int)file->attrs;
-
-        if (cur_file && strcmp(file->name, cur_file) == 0)
-          sel = item;
-      }
-
-      cur_file = NULL;
+    lnmax = (dy - sy) / fh;
+    lnhalf = lnmax >> 1;
 
-      /* Destroy the file list */
-      pl_file_destroy_file_list(&list);
+    /* Check for a parent path, prepend .. if necessary */
+    if ((hasparent = !pl_file_is_root_directory(cur_path)))
+    {
+      item = pl_menu_append_item(&menu, 0, "..");
+      item->param = (void*)PL_FILE_DIRECTORY;
     }
-    else
+
+    /* Load list of files for the selected path; enough for a screenful */
+    /* is read now, the rest in between frames */
+    last_file = NULL;
+    loading = 0;
+    if (pl_file_open_file_list(&list, cur_path, browser->Filter) >= 0)
     {
-      /* Check for a parent path, prepend .. if necessary */
-      if ((hasparent = !pl_file_is_root_directory(cur_path)))
-      {
-        item = pl_menu_append_item(&menu, 0, "..");
-        item->param = (void*)PL_FILE_DIRECTORY;
-      }
+      loading = pl_file_read_file_list(&list, lnmax + 1);
+      last_file = browser_append_files(&menu, list.files, cur_file, &sel);
     }
 
+    /* Until sorted, only the first screenful may select the current file */
+    if (!loading || sel)
+      cur_file = NULL;
+
     /* Initialize variables */
-    lnmax = (dy - sy) / fh;
-    lnhalf = lnmax >> 1;
     int item_count = pl_menu_get_item_count(&menu);
     sbh = (item_count > lnmax) 
           ? (int)((float)h * ((float)lnmax / (float)item_count)) : 0;
 
-    pos.Index = pos.Offset = 0;
-
-    if (!sel) 
-    { 
-      /* Select the first file/dir in the directory */
-      if (menu.items && menu.items->next)
-        sel=menu.items->next;
-      else if (menu.items)
-        sel=menu.items;
-    }
-
-    /* Compute index and offset of selected file */
-    if (sel)
-    {
-      pos.Top = menu.items;
-      for (item = menu.items; item != sel; item = item->next)
-      {
-        if (pos.Index + 1 >= lnmax) { pos.Offset++; pos.Top=pos.Top->next; } 
-        else pos.Index++;
-      }
-    }
+    browser_locate(&menu, &sel, &pos, lnmax);
+    first_sel = sel;
 
     pspVideoWaitVSync();
 
     /* Begin navigation (inner) loop */
     while (!ExitPSP)
     {
+      if (loading)
+      {
+        if ((loading = pl_file_read_file_list(&list, BROWSER_READ_BATCH)))
+        {
+          /* Still in directory order - add to the end */
+          const pl_file *next = (last_file) ? last_file->next : list.files;
+          if (next)
+            last_file = browser_append_files(&menu, next, NULL, NULL);
+        }
+        else
+        {
+          /* Sorted - rebuild, keeping the selection (or selecting the */
+          /* current file, if the selection hasn't been moved) */
+          pl_file_path sel_name = "";
+          if (cur_file && sel == first_sel)
+            strncpy(sel_name, cur_file, sizeof(sel_name) - 1);
+          else if (sel)
+            strncpy(sel_name, sel->caption, sizeof(sel_name) - 1);
+          cur_file = NULL;
+
+          pl_menu_clear_items(&menu);
+          sel = NULL;
+
+          if (hasparent)
+          {
+            item = pl_menu_append_item(&menu, 0, "..");
+            item->param = (void*)PL_FILE_DIRECTORY;
+            if (strcmp(sel_name, "..") == 0)
+              sel = item;
+          }
+
+          browser_append_files(&menu, list.files, sel_name, &sel);
+          browser_locate(&menu, &sel, &pos, lnmax);
+          last_sel = sel;
+        }
+
+        item_count = pl_menu_get_item_count(&menu);
+        sbh = (item_count > lnmax) 
+              ? (int)((float)h * ((float)lnmax / (float)item_count)) : 0;
+      }
+
       if (!pspCtrlPollControls(&pad))
         continue;
 
@@ -1009,10 +1077,14 @@ void pspUiOpenBrowser(PspUiFileBrowser *browser, const char *start_path)
       last_sel = sel;
       last_sel_top = sel_top;
     }
+
+    pl_file_destroy_file_list(&list);
   }
 
 exit_browser:
 
+  pl_file_destroy_file_list(&list);
+
   if (screenshot != NULL)
     pspImageDestroy(screenshot);
 
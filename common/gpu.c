@@ -54,19 +54,18 @@ static const uint8 palettes[SV_COLOR_SCHEME_COUNT][12] = {
 },
 };
 
-static uint16 *palette;
+static uint16 palette[4];
 static int paletteIndex;
 
 #define SB_MAX (SV_GHOSTING_MAX + 1)
 static int ghostCount = 0;
-static uint8 *screenBuffers[SB_MAX];
+static uint8 screenBuffers[SB_MAX][SV_H * SV_W / 4];
 static uint8 screenBufferInnerX[SB_MAX];
 
 static void add_ghosting(uint32 scanline, uint16 *backbuffer, uint8 start_x, uint8 end_x);
 
 void gpu_init(void)
 {
-    palette = (uint16*)malloc(4 * sizeof(int16));
 }
 
 void gpu_reset(void)
@@ -78,7 +77,6 @@ void gpu_reset(void)
 
 void gpu_done(void)
 {
-    free(palette); palette = NULL;
     gpu_set_ghosting(0);
 }
 
@@ -148,9 +146,44 @@ void gpu_render_scanline(uint32 scanline, uint16 *backbuffer, uint8 innerx, uint
     }
 }
 
+// VRAM keeps the leftmost pixel in the least significant bits; PNG
+// wants it in the most significant ones
+void gpu_get_scanline_2bpp(uint32 scanline, uint8 *dest, uint8 innerx, uint8 size)
+{
+    uint8 *vram_line = memorymap_getUpperRamPointer() + scanline;
+    uint8 x, j = innerx, b = 0, out = 0;
+
+    if (j & 3) {
+        b = *vram_line++;
+        b >>= (j & 3) * 2;
+    }
+    for (x = 0; x < size; x++, j++) {
+        if (!(j & 3)) {
+            b = *(vram_line++);
+        }
+        out = (out << 2) | (b & 3);
+        b >>= 2;
+        if ((x & 3) == 3) {
+            *dest++ = out;
+            out = 0;
+        }
+    }
+    if (x & 3) {
+        *dest++ = out << ((4 - (x & 3)) * 2);
+        x = (x + 3) & ~3;
+    }
+    for (; x < SV_W; x += 4) {
+        *dest++ = 0;
+    }
+}
+
+void gpu_get_palette(uint8 rgb[12])
+{
+    memcpy(rgb, palettes[paletteIndex], 12);
+}
+
 void gpu_set_ghosting(int frameCount)
 {
-    int i;
     if (frameCount < 0)
         ghostCount = 0;
     else if (frameCount > SV_GHOSTING_MAX)
@@ -159,23 +192,7 @@ void gpu_set_ghosting(int frameCount)
         ghostCount = frameCount;
 
     if (ghostCount != 0) {
-        if (screenBuffers[0] == NULL) {
-            for (i = 0; i < SB_MAX; i++) {
-                screenBuffers[i] = malloc(SV_H * SV_W / 4);
-                if (screenBuffers[i] == NULL) {
-                    return;
-                }
-            }
-        }
-        for (i = 0; i < SB_MAX; i++) {
-            memset(screenBuffers[i], 0, SV_H * SV_W / 4);
-        }
-    }
-    else {
-        for (i = 0; i < SB_MAX; i++) {
-            free(screenBuffers[i]);
-            screenBuffers[i] = NULL;
-        }
+        memset(screenBuffers, 0, sizeof(screenBuffers));
     }
 }
 
@@ -11,5 +11,7 @@ void gpu_set_map_func(SV_MapRGBFunc func);
 void gpu_set_color_scheme(int colorScheme);
 void gpu_render_scanline(uint32 scanline, uint16 *backbuffer, uint8 innerx, uint8 size);
 void gpu_set_ghosting(int frameCount);
+void gpu_get_scanline_2bpp(uint32 scanline, uint8 *dest, uint8 innerx, uint8 size);
+void gpu_get_palette(uint8 rgb[12]);
 
 #endif
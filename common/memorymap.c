@@ -8,23 +8,42 @@
 #include <stdlib.h>
 #include <string.h>
 
-static uint8 *lowerRam;
-static uint8 *upperRam;
-static uint8 *regs;
+// All RAM in one block, in state order: a MEM chunk is a single copy.
+// Cache-aligned, so each hash page starts on a cache line.
+static SV_ALIGNED(SV_CACHE_LINE) struct {
+    uint8 regs[0x2000];
+    uint8 lowerRam[0x2000];
+    uint8 upperRam[0x2000];
+} mem;
 static const uint8 *programRom;
 static const uint8 *lowerRomBank;
 static const uint8 *upperRomBank;
 
 static uint32 programRomSize;
 
+// State hash: regs, lowerRam and upperRam are split into 256-byte pages.
+// A page is rehashed only if it was written since the last memorymap_hash().
+#define HASH_PAGE_SHIFT 8
+#define HASH_PAGE_SIZE  (1 << HASH_PAGE_SHIFT)
+#define HASH_PAGE_COUNT (3 * 0x2000 / HASH_PAGE_SIZE)
+#define HASH_REGS_PAGE  (0 * 0x2000 / HASH_PAGE_SIZE)
+#define HASH_LOWER_PAGE (1 * 0x2000 / HASH_PAGE_SIZE)
+#define HASH_UPPER_PAGE (2 * 0x2000 / HASH_PAGE_SIZE)
+
+static uint32 pageHash[HASH_PAGE_COUNT];
+static uint32 dirtyPages[HASH_PAGE_COUNT / 32];
+
+#define SET_DIRTY(page) (dirtyPages[(page) >> 5] |= 1U << ((page) & 31))
+#define SET_ALL_DIRTY() memset(dirtyPages, 0xff, sizeof(dirtyPages))
+
 static BOOL dma_finished = FALSE;
 static BOOL timer_shot   = FALSE;
 static BOOL isMAGNUM     = FALSE;
 
 static void check_irq(void)
 {
-    BOOL irq = (timer_shot && ((regs[BANK] >> 1) & 1))
-          || (dma_finished && ((regs[BANK] >> 2) & 1));
+    BOOL irq = (timer_shot && ((mem.regs[BANK] >> 1) & 1))
+          || (dma_finished && ((mem.regs[BANK] >> 2) & 1));
 
     void m6502_set_irq_line(BOOL); // watara.c
     m6502_set_irq_line(irq);
@@ -44,9 +63,7 @@ void memorymap_set_timer_shot(void)
 
 void memorymap_init(void)
 {
-    lowerRam = (uint8*)malloc(0x2000);
-    upperRam = (uint8*)malloc(0x2000);
-    regs     = (uint8*)malloc(0x2000);
+    SET_ALL_DIRTY();
 }
 
 void memorymap_reset(void)
@@ -64,9 +81,8 @@ void memorymap_reset(void)
     // 512KB -- 'Journey to the West' is supported! (MAGNUM cartridge)
     upperRomBank = programRom + (programRomSize - 0x4000);
 
-    memset(lowerRam, 0x00, 0x2000);
-    memset(upperRam, 0x00, 0x2000);
-    memset(regs,     0x00, 0x2000);
+    memset(&mem, 0x00, sizeof(mem));
+    SET_ALL_DIRTY();
 
     dma_finished = FALSE;
     timer_shot   = FALSE;
@@ -74,21 +90,19 @@ void memorymap_reset(void)
 
 void memorymap_done(void)
 {
-    free(lowerRam); lowerRam = NULL;
-    free(upperRam); upperRam = NULL;
-    free(regs);     regs     = NULL;
+    // Nothing to free: RAM is static
 }
 
 uint8 memorymap_registers_read(uint32 Addr)
 {
-    uint8 data = regs[Addr & 0x1fff];
+    uint8 data = mem.regs[Addr & 0x1fff];
     switch (Addr & 0x1fff) {
         case 0x20:
             return controls_read();
         case 0x21:
             //data &= ~0xf;
             // Not used. Pass Link Port Probe (WaTest.bin from Wataroo)
-            data |= regs[0x22] & 0xf;
+            data |= mem.regs[0x22] & 0xf;
             break;
         case 0x24:
             timer_shot = FALSE;
@@ -146,10 +160,11 @@ static void dma_write(uint32 Addr, uint8 Value)
                 int i;
                 for (i = 0; i < dma.length; i++) {
                     if (dma.cpu2vram) {
-                        upperRam[dma.vaddr + i] = Rd6502(dma.caddr + i);
+                        mem.upperRam[(dma.vaddr + i) & 0x1fff] = Rd6502(dma.caddr + i);
+                        SET_DIRTY(HASH_UPPER_PAGE + (((dma.vaddr + i) & 0x1fff) >> HASH_PAGE_SHIFT));
                     }
                     else {
-                        Wr6502(dma.caddr + i, upperRam[dma.vaddr + i]);
+                        Wr6502(dma.caddr + i, mem.upperRam[(dma.vaddr + i) & 0x1fff]);
                     }
                 }
             }
@@ -161,21 +176,22 @@ static void update_lowerRomBank(void)
 {
     uint32 bankOffset = 0;
     if (isMAGNUM) {
-        bankOffset = (((regs[BANK] & 0x20) << 9) | ((regs[0x21] & 0xf) << 15));
+        bankOffset = (((mem.regs[BANK] & 0x20) << 9) | ((mem.regs[0x21] & 0xf) << 15));
     }
     else {
-        bankOffset =  ((regs[BANK] & 0xe0) << 9);
+        bankOffset =  ((mem.regs[BANK] & 0xe0) << 9);
     }
     lowerRomBank = programRom + bankOffset % programRomSize;
 }
 
 void memorymap_registers_write(uint32 Addr, uint8 Value)
 {
-    regs[Addr & 0x1fff] = Value;
+    mem.regs[Addr & 0x1fff] = Value;
+    SET_DIRTY(HASH_REGS_PAGE + ((Addr & 0x1fff) >> HASH_PAGE_SHIFT));
     switch (Addr & 0x1fff) {
         case 0x21:
             // MAGNUM cartridge && Output (Link Port Data Direction)
-            if (isMAGNUM && regs[0x22] == 0) {
+            if (isMAGNUM && mem.regs[0x22] == 0) {
                 update_lowerRomBank();
                 check_irq();
             }
@@ -215,7 +231,8 @@ void Wr6502(register word Addr, register byte Value)
     switch (Addr >> 12) {
         case 0x0:
         case 0x1:
-            lowerRam[Addr] = Value;
+            mem.lowerRam[Addr] = Value;
+            SET_DIRTY(HASH_LOWER_PAGE + (Addr >> HASH_PAGE_SHIFT));
             return;
         case 0x2:
         case 0x3:
@@ -223,7 +240,8 @@ void Wr6502(register word Addr, register byte Value)
             return;
         case 0x4:
         case 0x5:
-            upperRam[Addr & 0x1fff] = Value;
+            mem.upperRam[Addr & 0x1fff] = Value;
+            SET_DIRTY(HASH_UPPER_PAGE + ((Addr & 0x1fff) >> HASH_PAGE_SHIFT));
             return;
     }
 }
@@ -234,13 +252,13 @@ byte Rd6502(register word Addr)
     switch (Addr >> 12) {
         case 0x0:
         case 0x1:
-            return lowerRam[Addr];
+            return mem.lowerRam[Addr];
         case 0x2:
         case 0x3:
             return memorymap_registers_read(Addr);
         case 0x4:
         case 0x5:
-            return upperRam[Addr & 0x1fff];
+            return mem.upperRam[Addr & 0x1fff];
         case 0x6:
         case 0x7:
             return Addr >> 8; // Not usable
@@ -269,47 +287,79 @@ BOOL memorymap_load(const uint8 *rom, uint32 size)
     return TRUE;
 }
 
-void memorymap_save_state(FILE *fp)
+void memorymap_save_state(SV_STREAM *st)
 {
     uint8 ibank = 0;
-    fwrite(regs,     0x2000, 1, fp);
-    fwrite(lowerRam, 0x2000, 1, fp);
-    fwrite(upperRam, 0x2000, 1, fp);
+    WRITE_BYTES(&mem, sizeof(mem), st);
 
     ibank = (uint8)((lowerRomBank - programRom) / 0x4000);
-    WRITE_uint8(ibank, fp);
+    WRITE_uint8(ibank, st);
 
-    WRITE_BOOL(dma_finished, fp);
-    WRITE_BOOL(timer_shot,   fp);
+    WRITE_BOOL(dma_finished, st);
+    WRITE_BOOL(timer_shot, st);
 }
 
-void memorymap_load_state(FILE *fp)
+void memorymap_load_state(SV_STREAM *st)
 {
     uint8 ibank = 0;
-    fread(regs,     0x2000, 1, fp);
-    fread(lowerRam, 0x2000, 1, fp);
-    fread(upperRam, 0x2000, 1, fp);
+    READ_BYTES(&mem, sizeof(mem), st);
+
+    READ_uint8(ibank, st);
+    // The state may come from a different (smaller) ROM
+    lowerRomBank = programRom + (ibank * 0x4000) % programRomSize;
 
-    READ_uint8(ibank, fp);
-    lowerRomBank = programRom + ibank * 0x4000;
+    READ_BOOL(dma_finished, st);
+    READ_BOOL(timer_shot, st);
 
-    READ_BOOL(dma_finished, fp);
-    READ_BOOL(timer_shot,   fp);
+    SET_ALL_DIRTY();
+}
+
+uint32 memorymap_hash(uint32 hash)
+{
+    uint32 i, j;
+    uint8 ibank = (uint8)((lowerRomBank - programRom) / 0x4000);
+
+    for (i = 0; i < HASH_PAGE_COUNT; i += 32) {
+        uint32 dirty = dirtyPages[i >> 5];
+        for (j = i; dirty != 0; j++, dirty >>= 1) {
+            if (dirty & 1) {
+                const uint8 *page = (const uint8 *)&mem + j * HASH_PAGE_SIZE;
+                uint32 h = SV_FNV_BASIS, k;
+                for (k = 0; k < HASH_PAGE_SIZE; k++) {
+                    h = SV_FNV_BYTE(h, page[k]);
+                }
+                pageHash[j] = h;
+            }
+        }
+        dirtyPages[i >> 5] = 0;
+    }
+
+    // Combine the page hashes, then the rest of the MEM chunk
+    for (i = 0; i < HASH_PAGE_COUNT; i++) {
+        hash = SV_FNV_BYTE(hash, pageHash[i]);
+        hash = SV_FNV_BYTE(hash, pageHash[i] >>  8);
+        hash = SV_FNV_BYTE(hash, pageHash[i] >> 16);
+        hash = SV_FNV_BYTE(hash, pageHash[i] >> 24);
+    }
+    hash = SV_FNV_BYTE(hash, ibank);
+    hash = SV_FNV_BYTE(hash, dma_finished);
+    hash = SV_FNV_BYTE(hash, timer_shot);
+    return hash;
 }
 
 uint8 *memorymap_getLowerRamPointer(void)
 {
-    return lowerRam;
+    return mem.lowerRam;
 }
 
 uint8 *memorymap_getUpperRamPointer(void)
 {
-    return upperRam;
+    return mem.upperRam;
 }
 
 uint8 *memorymap_getRegisters(void)
 {
-    return regs;
+    return mem.regs;
 }
 
 const uint8 *memorymap_getRomPointer(void)
@@ -317,6 +367,11 @@ const uint8 *memorymap_getRomPointer(void)
     return programRom;
 }
 
+uint32 memorymap_getRomSize(void)
+{
+    return programRomSize;
+}
+
 const uint8 *memorymap_getLowerRomBank(void)
 {
     return lowerRomBank;
@@ -23,13 +23,15 @@ uint8 memorymap_registers_read(uint32 Addr);
 void memorymap_registers_write(uint32 Addr, uint8 Value);
 BOOL memorymap_load(const uint8 *rom, uint32 size);
 
-void memorymap_save_state(FILE *fp);
-void memorymap_load_state(FILE *fp);
+void memorymap_save_state(SV_STREAM *st);
+void memorymap_load_state(SV_STREAM *st);
+uint32 memorymap_hash(uint32 hash);
 
 uint8 *memorymap_getLowerRamPointer(void);
 uint8 *memorymap_getUpperRamPointer(void);
 uint8 *memorymap_getRegisters(void);
 const uint8 *memorymap_getRomPointer(void);
+uint32 memorymap_getRomSize(void);
 const uint8 *memorymap_getLowerRomBank(void);
 const uint8 *memorymap_getUpperRomBank(void);
 
@@ -38,8 +38,23 @@ typedef struct  {
     uint16 start;
     uint16 size;
     real pos, step;
+    int32 cycles; // Until the end of the transfer (IRQ)
 } SVISION_DMA;
 SVISION_DMA m_dma;
+// Source resolved on DMA start: [m_dma.start, m_dma.start + dma_src_len)
+static const uint8 *dma_src;
+static uint32 dma_src_len;
+// Unpacked 4-bit samples, up to 0x100 * 32
+static uint8 dma_samples[0x2000];
+
+// Master gain: S16 units per U8 step (1.0 -> 512, same as U8 << 9)
+static int32 sound_volume = 512;
+static BOOL  sound_dc_filter = TRUE;
+// DC offset estimate (x256) of each output channel
+static int32 dc_left, dc_right;
+static BOOL  synthesis = TRUE;
+// 0xff - enabled, 0x00 - muted
+static uint8 channel_mask[SV_SOUND_CHANNEL_COUNT] = { 0xff, 0xff, 0xff, 0xff };
 
 void sound_reset(void)
 {
@@ -48,100 +63,322 @@ void sound_reset(void)
     memset(&m_dma,    0, sizeof(m_dma)    );
 
     memset(ch,        0, sizeof(ch)       );
+
+    dma_src = NULL;
+    dma_src_len = 0;
+
+    // The DC filter is host-side, like the gain: sound_set_dc_filter()
+    // restarts it
 }
 
-void sound_stream_update(uint8 *stream, uint32 len)
+static void dma_resolve(void)
+{
+    uint16 addr = m_dma.start;
+
+    dma_src = NULL;
+    dma_src_len = 0;
+    switch (addr >> 12) {
+        case 0x0:
+        case 0x1:
+            dma_src = memorymap_getLowerRamPointer() + addr;
+            dma_src_len = 0x2000 - addr;
+            break;
+        case 0x4:
+        case 0x5:
+            dma_src = memorymap_getUpperRamPointer() + (addr & 0x1fff);
+            dma_src_len = 0x6000 - addr;
+            break;
+        case 0x8:
+        case 0x9:
+        case 0xa:
+        case 0xb: {
+            // Not the current bank
+            uint32 romSize = memorymap_getRomSize();
+            uint32 offset;
+            if (romSize == 0)
+                break;
+            offset = ((addr & 0x3fff) | m_dma.ca14to16) % romSize;
+            dma_src = memorymap_getRomPointer() + offset;
+            dma_src_len = 0x4000 - (addr & 0x3fff);
+            if (dma_src_len > romSize - offset)
+                dma_src_len = romSize - offset;
+        }
+            break;
+        case 0xc:
+        case 0xd:
+        case 0xe:
+        case 0xf:
+            dma_src = memorymap_getUpperRomBank() + (addr & 0x3fff);
+            dma_src_len = 0x10000 - addr;
+            break;
+        // Registers, 0x6000 - 0x7fff: Rd6502()
+    }
+}
+
+// 2 samples per byte, high nibble first
+static void unpack_nibbles(uint8 *dst, const uint8 *src, uint32 count)
+{
+    uint32 i;
+    for (i = 0; i < count; i++) {
+        uint8 b = src[i];
+        dst[2 * i + 0] = b >> 4;
+        dst[2 * i + 1] = b & 0xf;
+    }
+}
+
+// Unpack the DMA samples played by the next 'samples' output samples
+static void dma_unpack(uint32 samples)
 {
-    size_t i, j;
+    uint32 first, last, i;
+
+    if (!m_dma.on)
+        return;
+
+    first = (uint16)m_dma.pos >> 1;
+    // +1 sample/byte: rounding of the accumulated m_dma.pos
+    last = ((uint32)(m_dma.pos + m_dma.step * (samples + 1)) >> 1) + 1;
+    if (last > (uint32)(m_dma.size >> 1))
+        last = m_dma.size >> 1;
+
+    i = first;
+    if (i < dma_src_len) {
+        uint32 end = last < dma_src_len ? last : dma_src_len;
+        unpack_nibbles(dma_samples + 2 * i, dma_src + i, end - i);
+        i = end;
+    }
+    // Outside of the resolved block
+    for (; i < last; i++) {
+        uint8 b = Rd6502((uint16)(m_dma.start + i));
+        dma_samples[2 * i + 0] = b >> 4;
+        dma_samples[2 * i + 1] = b & 0xf;
+    }
+}
+
+// Generate one sample of each channel, U8 (0 - 15) per side
+static void render_sample(uint8 out[SV_SOUND_CHANNEL_COUNT][2])
+{
+    size_t j;
     SVISION_CHANNEL *channel;
     uint8 s = 0;
-    uint8 *left  = stream + 0;
-    uint8 *right = stream + 1;
-
-    for (i = 0; i < len >> 1; i++, left += 2, right += 2) {
-        *left = *right = 0;
-
-        for (channel = m_channel, j = 0; j < 2; j++, channel++) {
-            if (ch[j].size != 0) {
-                if (ch[j].on || channel->count != 0) {
-                    BOOL on = FALSE;
-                    switch (ch[j].waveform) {
-                        case 0: // 12.5%
-                            on = ch[j].pos < (28 * ch[j].size) >> 5;
-                            break;
-                        case 1: // 25%
-                            on = ch[j].pos < (24 * ch[j].size) >> 5;
-                            break;
-                        case 2: // 50%
-                            on = ch[j].pos < ch[j].size / 2;
-                            break;
-                        case 3: // 75%
-                            on = ch[j].pos < ch[j].size / 4;
-                            // MESS/MAME:  <= (9 * ch[j].size) >> 5;
-                            break;
-                    }
-                    s = on ? ch[j].volume : 0;
-                    if (j == 0) {
-                        *right += s;
-                    }
-                    else {
-                        *left += s;
-                    }
+
+    memset(out, 0, SV_SOUND_CHANNEL_COUNT * 2);
+
+    for (channel = m_channel, j = 0; j < 2; j++, channel++) {
+        if (ch[j].size != 0) {
+            if (ch[j].on || channel->count != 0) {
+                BOOL on = FALSE;
+                switch (ch[j].waveform) {
+                    case 0: // 12.5%
+                        on = ch[j].pos < (28 * ch[j].size) >> 5;
+                        break;
+                    case 1: // 25%
+                        on = ch[j].pos < (24 * ch[j].size) >> 5;
+                        break;
+                    case 2: // 50%
+                        on = ch[j].pos < ch[j].size / 2;
+                        break;
+                    case 3: // 75%
+                        on = ch[j].pos < ch[j].size / 4;
+                        // MESS/MAME:  <= (9 * ch[j].size) >> 5;
+                        break;
                 }
-                ch[j].pos++;
-                if (ch[j].pos >= ch[j].size) {
-                    ch[j].pos = 0;
+                s = on ? ch[j].volume : 0;
+                // Channel 1 - right, channel 2 - left
+                out[SV_SOUND_SQUARE1 + j][j == 0 ? 1 : 0] = s;
+            }
+            ch[j].pos++;
+            if (ch[j].pos >= ch[j].size) {
+                ch[j].pos = 0;
 #ifndef SV_DISABLE_SUPER_DUPER_WAVE
-                    // Transition from off to on
-                    if (channel->on) {
-                        memcpy(&ch[j], channel, sizeof(ch[j]));
-                        channel->on = FALSE;
-                    }
-#endif
+                // Transition from off to on
+                if (channel->on) {
+                    memcpy(&ch[j], channel, sizeof(ch[j]));
+                    channel->on = FALSE;
                 }
+#endif
             }
         }
+    }
 
-        if (m_noise.on && (m_noise.play || m_noise.count != 0)) {
-            s = m_noise.value * m_noise.volume;
-            if (m_noise.left)
-                *left += s;
-            if (m_noise.right)
-                *right += s;
-            m_noise.pos += m_noise.step;
-            while (m_noise.pos >= 1.0) { // if/while difference - Pacific Battle
-                // LFSR: x^2 + x + 1
-                uint16 feedback;
-                m_noise.value = m_noise.state & 1;
-                feedback = ((m_noise.state >> 1) ^ m_noise.state) & 0x0001;
-                feedback <<= m_noise.type;
-                m_noise.state = (m_noise.state >> 1) | feedback;
-                m_noise.pos -= 1.0;
-            }
+    if (m_noise.on && (m_noise.play || m_noise.count != 0)) {
+        s = m_noise.value * m_noise.volume;
+        if (m_noise.left)
+            out[SV_SOUND_NOISE][0] = s;
+        if (m_noise.right)
+            out[SV_SOUND_NOISE][1] = s;
+        m_noise.pos += m_noise.step;
+        while (m_noise.pos >= 1.0) { // if/while difference - Pacific Battle
+            // LFSR: x^2 + x + 1
+            uint16 feedback;
+            m_noise.value = m_noise.state & 1;
+            feedback = ((m_noise.state >> 1) ^ m_noise.state) & 0x0001;
+            feedback <<= m_noise.type;
+            m_noise.state = (m_noise.state >> 1) | feedback;
+            m_noise.pos -= 1.0;
         }
+    }
 
-        if (m_dma.on) {
-            uint8 sample;
-            uint16 addr = m_dma.start + (uint16)m_dma.pos / 2;
-            if (addr >= 0x8000 && addr < 0xc000) {
-                sample = memorymap_getRomPointer()[(addr & 0x3fff) | m_dma.ca14to16];
-            }
-            else {
-                sample = Rd6502(addr);
+    if (m_dma.on) {
+        // Unpacked by dma_unpack()
+        s = dma_samples[(uint16)m_dma.pos];
+        if (m_dma.left)
+            out[SV_SOUND_DMA][0] = s;
+        if (m_dma.right)
+            out[SV_SOUND_DMA][1] = s;
+        m_dma.pos += m_dma.step;
+        if (m_dma.pos >= m_dma.size) {
+            m_dma.on = FALSE; // IRQ is raised by sound_exec()
+        }
+    }
+}
+
+// Generate one sample of all enabled channels, U8 (0 - 45) per side
+static void mix_sample(uint8 *left, uint8 *right)
+{
+    uint8 s[SV_SOUND_CHANNEL_COUNT][2];
+
+    render_sample(s);
+    *left  = (s[SV_SOUND_SQUARE1][0] & channel_mask[SV_SOUND_SQUARE1])
+           + (s[SV_SOUND_SQUARE2][0] & channel_mask[SV_SOUND_SQUARE2])
+           + (s[SV_SOUND_NOISE  ][0] & channel_mask[SV_SOUND_NOISE  ])
+           + (s[SV_SOUND_DMA    ][0] & channel_mask[SV_SOUND_DMA    ]);
+    *right = (s[SV_SOUND_SQUARE1][1] & channel_mask[SV_SOUND_SQUARE1])
+           + (s[SV_SOUND_SQUARE2][1] & channel_mask[SV_SOUND_SQUARE2])
+           + (s[SV_SOUND_NOISE  ][1] & channel_mask[SV_SOUND_NOISE  ])
+           + (s[SV_SOUND_DMA    ][1] & channel_mask[SV_SOUND_DMA    ]);
+}
+
+// U8 -> S16 range with master gain and DC removal
+static int32 scale_sample(uint8 s, int32 *dc)
+{
+    int32 v = s * sound_volume;
+    if (sound_dc_filter) {
+        // One-pole high-pass, time constant 1024 samples (~23 ms)
+        *dc += ((v << 8) - *dc) >> 10;
+        v -= *dc >> 8;
+    }
+    if (v > 32767)
+        v = 32767;
+    else if (v < -32768)
+        v = -32768;
+    return v;
+}
+
+void sound_stream_update(uint8 *stream, uint32 len)
+{
+    uint32 i;
+
+    if (!synthesis) {
+        memset(stream, 0, len);
+        return;
+    }
+
+    dma_unpack(len >> 1);
+    for (i = 0; i < len >> 1; i++, stream += 2) {
+        mix_sample(stream + 0, stream + 1);
+    }
+}
+
+void sound_stream_update_s16(int16 *stream, uint32 len)
+{
+    uint32 i;
+    uint8 left, right;
+
+    if (!synthesis) {
+        memset(stream, 0, len);
+        return;
+    }
+
+    dma_unpack(len >> 2);
+    for (i = 0; i < len >> 2; i++, stream += 2) {
+        mix_sample(&left, &right);
+        stream[0] = (int16)scale_sample(left,  &dc_left);
+        stream[1] = (int16)scale_sample(right, &dc_right);
+    }
+}
+
+void sound_stream_update_f32(float *stream, uint32 len)
+{
+    uint32 i;
+    uint8 left, right;
+
+    if (!synthesis) {
+        for (i = 0; i < len >> 2; i++) {
+            stream[i] = 0.0f;
+        }
+        return;
+    }
+
+    dma_unpack(len >> 3);
+    for (i = 0; i < len >> 3; i++, stream += 2) {
+        mix_sample(&left, &right);
+        stream[0] = scale_sample(left,  &dc_left)  * (1.0f / 32768);
+        stream[1] = scale_sample(right, &dc_right) * (1.0f / 32768);
+    }
+}
+
+void sound_stream_update_stems(uint8 **streams, uint32 len)
+{
+    uint32 i;
+    int c;
+    uint8 s[SV_SOUND_CHANNEL_COUNT][2];
+
+    if (!synthesis) {
+        memset(s, 0, sizeof(s));
+    }
+    else {
+        dma_unpack(len >> 1);
+    }
+    for (i = 0; i < len >> 1; i++) {
+        if (synthesis) {
+            render_sample(s);
+        }
+        for (c = 0; c < SV_SOUND_CHANNEL_COUNT; c++) {
+            if (streams[c] != NULL) {
+                streams[c][2 * i + 0] = s[c][0];
+                streams[c][2 * i + 1] = s[c][1];
             }
-            if (((uint16)m_dma.pos) & 1)
-                s = (sample & 0xf);
-            else
-                s = (sample & 0xf0) >> 4;
-            if (m_dma.left)
-                *left += s;
-            if (m_dma.right)
-                *right += s;
-            m_dma.pos += m_dma.step;
-            if (m_dma.pos >= m_dma.size) {
+        }
+    }
+}
+
+void sound_set_synthesis(BOOL enable)
+{
+    synthesis = enable;
+}
+
+void sound_set_channel_mask(uint8 mask)
+{
+    int c;
+    for (c = 0; c < SV_SOUND_CHANNEL_COUNT; c++) {
+        channel_mask[c] = ((mask >> c) & 1) ? 0xff : 0x00;
+    }
+}
+
+void sound_set_gain(real gain)
+{
+    if (gain < 0)
+        gain = 0;
+    sound_volume = (int32)(gain * 512);
+}
+
+void sound_set_dc_filter(BOOL enable)
+{
+    sound_dc_filter = enable;
+    dc_left = dc_right = 0;
+}
+
+void sound_exec(uint32 cycles)
+{
+    if (m_dma.cycles > 0) {
+        m_dma.cycles -= cycles;
+
+        if (m_dma.cycles <= 0) {
+            m_dma.cycles = 0;
+            if (!synthesis) {
                 m_dma.on = FALSE;
-                memorymap_set_dma_finished();
             }
+            memorymap_set_dma_finished();
         }
     }
 }
@@ -207,11 +444,13 @@ void sound_wave_write(int which, int offset, uint8 data)
 
 void sound_dma_write(int offset, uint8 data)
 {
+    uint8 prev = m_dma.reg[offset];
     m_dma.reg[offset] = data;
     switch (offset) {
         case 0:
         case 1:
             m_dma.start = (m_dma.reg[0] | (m_dma.reg[1] << 8));
+            dma_resolve();
             break;
         case 2:
             m_dma.size = (data ? data : 0x100) * 32; // Number of 4-bit samples
@@ -224,11 +463,23 @@ void sound_dma_write(int offset, uint8 data)
             m_dma.right = data & 4;
             m_dma.left  = data & 8;
             m_dma.ca14to16 = ((data & 0x70) >> 4) << 14;
+            dma_resolve();
+            // Rate change during the transfer
+            m_dma.cycles = (m_dma.cycles >> (prev & 3)) << (data & 3);
             break;
         case 4:
             m_dma.on = data & 0x80;
             if (m_dma.on) {
                 m_dma.pos = 0.0;
+                // 256 << (0 - 3) CPU cycles per 4-bit sample
+                m_dma.cycles = m_dma.size * (256 << (m_dma.reg[3] & 3));
+                // Length not written since reset: nothing to play, the
+                // transfer ends (and raises its IRQ) on the next sound_exec()
+                if (m_dma.cycles == 0)
+                    m_dma.cycles = 1;
+            }
+            else {
+                m_dma.cycles = 0;
             }
             break;
     }
@@ -297,47 +548,96 @@ void sound_noise_write(int offset, uint8 data)
     X(uint16, start) \
     X(uint16, size) \
     X(real, pos) \
-    X(real, step)
+    X(real, step) \
+    X(int32, cycles)
 
-void sound_save_state(FILE *fp)
+void sound_save_state(SV_STREAM *st)
 {
     int i;
     for (i = 0; i < 2; i++) {
-        fwrite(m_channel[i].reg, sizeof(m_channel[i].reg), 1, fp);
-#define X(type, member) WRITE_##type(m_channel[i].member, fp);
+        WRITE_BYTES(m_channel[i].reg, sizeof(m_channel[i].reg), st);
+#define X(type, member) WRITE_##type(m_channel[i].member, st);
         EXPAND_CHANNEL
 #undef X
     }
 
-    fwrite(m_noise.reg, sizeof(m_noise.reg), 1, fp);
-#define X(type, member) WRITE_##type(m_noise.member, fp);
+    WRITE_BYTES(m_noise.reg, sizeof(m_noise.reg), st);
+#define X(type, member) WRITE_##type(m_noise.member, st);
     EXPAND_NOISE
 #undef X
-    fwrite(m_dma.reg, sizeof(m_dma.reg), 1, fp);
-#define X(type, member) WRITE_##type(m_dma.member, fp);
+    WRITE_BYTES(m_dma.reg, sizeof(m_dma.reg), st);
+#define X(type, member) WRITE_##type(m_dma.member, st);
     EXPAND_DMA
 #undef X
+    // Appended: the playback copy, so that a load doesn't restart waves
+    for (i = 0; i < 2; i++) {
+#define X(type, member) WRITE_##type(ch[i].member, st);
+        EXPAND_CHANNEL
+#undef X
+    }
 }
 
-void sound_load_state(FILE *fp)
+// Only what the CPU can observe, directly or through the DMA IRQ timing.
+// Sample positions, the LFSR and the 'on' flags the mixer clears depend
+// on how much audio the host pulled, so the same frames would hash
+// differently between machines or with another resampling ratio.
+// The registers cover everything derived from them.
+uint32 sound_hash(uint32 hash)
 {
-    int i;
+    uint8 data[32];
+    SV_STREAM st;
+    uint32 i;
 
-    sound_reset();
+    SV_STREAM_INIT(&st, data, sizeof(data));
+    for (i = 0; i < 2; i++) {
+        WRITE_BYTES(m_channel[i].reg, sizeof(m_channel[i].reg), &st);
+        WRITE_uint16(m_channel[i].count, &st);
+    }
+    WRITE_BYTES(m_noise.reg, sizeof(m_noise.reg), &st);
+    WRITE_uint16(m_noise.count, &st);
+    WRITE_BYTES(m_dma.reg, sizeof(m_dma.reg), &st);
+    WRITE_int32(m_dma.cycles, &st);
+
+    for (i = 0; i < st.pos; i++) {
+        hash = SV_FNV_BYTE(hash, data[i]);
+    }
+    return hash;
+}
+
+// Host-side state (the DC filter, the unpacked DMA samples) is left as
+// it is: loading a state to run ahead, rewind or replay a frame must not
+// change what is heard.
+void sound_load_state(SV_STREAM *st)
+{
+    int i;
 
     for (i = 0; i < 2; i++) {
-        fread(m_channel[i].reg, sizeof(m_channel[i].reg), 1, fp);
-#define X(type, member) READ_##type(m_channel[i].member, fp);
+        READ_BYTES(m_channel[i].reg, sizeof(m_channel[i].reg), st);
+#define X(type, member) READ_##type(m_channel[i].member, st);
         EXPAND_CHANNEL
 #undef X
     }
  
-    fread(m_noise.reg, sizeof(m_noise.reg), 1, fp);
-#define X(type, member) READ_##type(m_noise.member, fp);
+    READ_BYTES(m_noise.reg, sizeof(m_noise.reg), st);
+#define X(type, member) READ_##type(m_noise.member, st);
     EXPAND_NOISE
 #undef X
-    fread(m_dma.reg, sizeof(m_dma.reg), 1, fp);
-#define X(type, member) READ_##type(m_dma.member, fp);
+    READ_BYTES(m_dma.reg, sizeof(m_dma.reg), st);
+#define X(type, member) READ_##type(m_dma.member, st);
     EXPAND_DMA
 #undef X
+    // Older states have no 'cycles', only the synthesis position
+    if (st->pos > st->size && m_dma.on && m_dma.pos < m_dma.size) {
+        m_dma.cycles = (int32)((m_dma.size - m_dma.pos) * (256 << (m_dma.reg[3] & 3)));
+    }
+    for (i = 0; i < 2; i++) {
+#define X(type, member) READ_##type(ch[i].member, st);
+        EXPAND_CHANNEL
+#undef X
+    }
+    // Older states have no playback copy: it follows the registers
+    if (st->pos > st->size) {
+        memcpy(ch, m_channel, sizeof(ch));
+    }
+    dma_resolve();
 }
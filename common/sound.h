@@ -11,12 +11,37 @@ void sound_reset(void);
  * \param len in bytes.
  */
 void sound_stream_update(uint8 *stream, uint32 len);
+/*!
+ * Generate S16, 2 channels.
+ * \param len in bytes.
+ */
+void sound_stream_update_s16(int16 *stream, uint32 len);
+/*!
+ * Generate F32 (-1.0 - 1.0), 2 channels.
+ * \param len in bytes.
+ */
+void sound_stream_update_f32(float *stream, uint32 len);
+/*!
+ * Generate each channel into its own U8 (0 - 15) stream, 2 channels.
+ * \param streams SV_SOUND_CHANNEL_COUNT pointers, NULL - skip the channel.
+ * \param len in bytes (of each stream).
+ */
+void sound_stream_update_stems(uint8 **streams, uint32 len);
+void sound_set_synthesis(BOOL enable);
+void sound_set_channel_mask(uint8 mask);
+void sound_set_gain(real gain);
+void sound_set_dc_filter(BOOL enable);
+/*!
+ * Sound DMA completion (IRQ) is driven by CPU cycles, not by synthesis.
+ */
+void sound_exec(uint32 cycles);
 void sound_decrement(void);
 void sound_wave_write(int which, int offset, uint8 data);
 void sound_dma_write(int offset, uint8 data);
 void sound_noise_write(int offset, uint8 data);
 
-void sound_save_state(FILE *fp);
-void sound_load_state(FILE *fp);
+void sound_save_state(SV_STREAM *st);
+void sound_load_state(SV_STREAM *st);
+uint32 sound_hash(uint32 hash);
 
 #endif
@@ -11,7 +11,7 @@
 extern "C" {
 #endif
 
-#define SV_CORE_VERSION 0x01000005U
+#define SV_CORE_VERSION 0x01002000U
 #define SV_CORE_VERSION_MAJOR ((SV_CORE_VERSION >> 24) & 0xFF)
 #define SV_CORE_VERSION_MINOR ((SV_CORE_VERSION >> 12) & 0xFFF)
 #define SV_CORE_VERSION_PATCH ((SV_CORE_VERSION >>  0) & 0xFFF)
@@ -20,6 +20,11 @@ extern "C" {
 #define SV_W 160
 /*! Screen height. */
 #define SV_H 160
+/*!
+ * Size of a frame packed at 2 bits per pixel.
+ * \sa supervision_get_frame_2bpp()
+ */
+#define SV_FRAME_2BPP_SIZE (SV_W * SV_H / 4)
 /*!
  * \sa supervision_set_map_func()
  */
@@ -45,6 +50,18 @@ enum SV_COLOR {
   * \sa supervision_update_sound()
   */
 #define SV_SAMPLE_RATE 44100
+/*!
+ * \sa supervision_set_sound_channels(), supervision_update_sound_stems()
+ */
+enum SV_SOUND_CHANNEL {
+      SV_SOUND_SQUARE1 // right
+    , SV_SOUND_SQUARE2 // left
+    , SV_SOUND_NOISE
+    , SV_SOUND_DMA
+
+    , SV_SOUND_CHANNEL_COUNT
+};
+#define SV_SOUND_CHANNELS_ALL ((1 << SV_SOUND_CHANNEL_COUNT) - 1)
 
 void supervision_init(void);
 void supervision_reset(void);
@@ -53,6 +70,10 @@ void supervision_done(void);
  * \return TRUE - success, FALSE - error
  */
 BOOL supervision_load(const uint8 *rom, uint32 romSize);
+/*!
+ * Emulate one frame.
+ * \param backbuffer NULL - skip rendering (e.g. when re-emulating frames).
+ */
 void supervision_exec(uint16 *backbuffer);
 void supervision_exec_ex(uint16 *backbuffer, int16 backbufferWidth);
 
@@ -74,12 +95,96 @@ void supervision_set_color_scheme(int colorScheme);
  * \param frameCount in range [0, SV_GHOSTING_MAX]. 0 - disable.
  */
 void supervision_set_ghosting(int frameCount);
+/*!
+ * Copy the visible window of the last frame as color indices (0 - 3),
+ * 4 pixels per byte, leftmost pixel in the most significant bits (as in
+ * 2-bit PNG). Columns beyond XSIZE are 0. Ghosting is not applied.
+ * \param frame SV_FRAME_2BPP_SIZE bytes.
+ * \sa supervision_get_palette()
+ */
+void supervision_get_frame_2bpp(uint8 *frame);
+/*!
+ * \param rgb 4 RGB888 colors of the current color scheme, by index.
+ */
+void supervision_get_palette(uint8 rgb[12]);
 /*!
  * Generate U8 (0 - 45), 2 channels.
  * \param len in bytes.
  */
 void supervision_update_sound(uint8 *stream, uint32 len);
+/*!
+ * Generate S16, 2 channels. Master gain and DC removal are applied.
+ * \param len in bytes.
+ * \sa supervision_set_sound_gain(), supervision_set_sound_dc_filter()
+ */
+void supervision_update_sound_s16(int16 *stream, uint32 len);
+/*!
+ * Generate F32 (-1.0 - 1.0), 2 channels. Master gain and DC removal are applied.
+ * \param len in bytes.
+ * \sa supervision_set_sound_gain(), supervision_set_sound_dc_filter()
+ */
+void supervision_update_sound_f32(float *stream, uint32 len);
+/*!
+ * Master gain of S16/F32 output.
+ * \param gain Default: 1.0 (U8 << 9 for S16).
+ */
+void supervision_set_sound_gain(real gain);
+/*!
+ * Remove DC offset from S16/F32 output (one-pole high-pass).
+ * \param enable Default: TRUE.
+ */
+void supervision_set_sound_dc_filter(BOOL enable);
+/*!
+ * Generate each channel into its own stream in a single pass.
+ * The sum of all streams is the supervision_update_sound() output.
+ * \param streams SV_SOUND_CHANNEL_COUNT pointers to U8 (0 - 15), 2 channels.
+ *                NULL - skip the channel.
+ * \param len in bytes (of each stream).
+ * \sa SV_SOUND_CHANNEL
+ */
+void supervision_update_sound_stems(uint8 *streams[SV_SOUND_CHANNEL_COUNT], uint32 len);
+/*!
+ * Mute/solo channels of the mixed output. Stems are not affected.
+ * \param mask Bit (1 << SV_SOUND_*) set - enabled. Default: SV_SOUND_CHANNELS_ALL.
+ * \sa SV_SOUND_CHANNEL
+ */
+void supervision_set_sound_channels(uint8 mask);
+/*!
+ * Turn off sound synthesis, e.g. in headless or fast-forward mode.
+ * supervision_update_sound*() then output silence. Sound DMA completion
+ * (IRQ, 0x2027) is scheduled from CPU cycles in both modes, so the game
+ * sees no difference.
+ * \param enable Default: TRUE.
+ */
+void supervision_set_sound_synthesis(BOOL enable);
 
+/*!
+ * \return Size of a serialized state in bytes (constant for a build).
+ */
+uint32 supervision_state_size(void);
+/*!
+ * Save state to memory. Nothing is written to the filesystem.
+ * \param size >= supervision_state_size().
+ * \return TRUE - success, FALSE - buffer is too small
+ * \sa supervision_state_size()
+ */
+BOOL supervision_serialize(void *data, uint32 size);
+/*!
+ * Load state from memory written by supervision_serialize().
+ * Unknown chunks are skipped, headerless states of older versions are accepted.
+ * \return TRUE - success, FALSE - truncated or incompatible state (state is not touched)
+ */
+BOOL supervision_unserialize(const void *data, uint32 size);
+/*!
+ * Fingerprint of the machine state (CPU, RAM, VRAM, registers, sound, timer)
+ * to detect desyncs in netplay or movie playback. Equal states give equal
+ * hashes within a build. Sound synthesis state (sample positions, noise
+ * LFSR) is left out: it depends on how much audio the host pulls, not on
+ * emulation. Only the 256-byte memory pages written since the last call
+ * are rehashed, so it's cheap to call every frame.
+ * \return FNV-1a based hash.
+ */
+uint32 supervision_state_hash(void);
 /*!
  * Save state to '{statePath}{id}.svst' if id >= 0, otherwise '{statePath}'.
  * \return TRUE - success, FALSE - error
@@ -35,14 +35,14 @@ void timer_exec(uint32 cycles)
     }
 }
 
-void timer_save_state(FILE *fp)
+void timer_save_state(SV_STREAM *st)
 {
-    WRITE_int32(timer_cycles, fp);
-    WRITE_BOOL(timer_activated, fp);
+    WRITE_int32(timer_cycles, st);
+    WRITE_BOOL(timer_activated, st);
 }
 
-void timer_load_state(FILE *fp)
+void timer_load_state(SV_STREAM *st)
 {
-    READ_int32(timer_cycles, fp);
-    READ_BOOL(timer_activated, fp);
+    READ_int32(timer_cycles, st);
+    READ_BOOL(timer_activated, st);
 }
@@ -9,7 +9,7 @@ void timer_reset(void);
 void timer_write(uint8 data);
 void timer_exec(uint32 cycles);
 
-void timer_save_state(FILE *fp);
-void timer_load_state(FILE *fp);
+void timer_save_state(SV_STREAM *st);
+void timer_load_state(SV_STREAM *st);
 
 #endif
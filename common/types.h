@@ -85,51 +85,99 @@ static double SV_SwapDouble(const double x)
 #endif
 
 /*
- * File
+ * Alignment
  */
 
-#define WRITE_BOOL(x, fp) do { \
+#if defined(_MSC_VER)
+#define SV_ALIGNED(n) __declspec(align(n))
+#elif defined(__GNUC__)
+#define SV_ALIGNED(n) __attribute__((aligned(n)))
+#else
+#define SV_ALIGNED(n)
+#endif
+
+/* PSP (Allegrex) data cache line */
+#define SV_CACHE_LINE 64
+
+/*
+ * FNV-1a (state hash)
+ */
+
+#define SV_FNV_BASIS 0x811C9DC5U
+#define SV_FNV_PRIME 0x01000193U
+
+#define SV_FNV_BYTE(h, b) (((h) ^ (uint8)(b)) * SV_FNV_PRIME)
+
+/*
+ * State stream
+ */
+
+#include <string.h>
+
+typedef struct {
+    uint8 *data; // NULL - only measure the size
+    uint32 size;
+    uint32 pos;  // > size - overflow
+} SV_STREAM;
+
+#define SV_STREAM_INIT(st, buf, len) do { \
+    (st)->data = (uint8*)(buf); \
+    (st)->size = (uint32)(len); \
+    (st)->pos  = 0; } while (0)
+
+#define SV_STREAM_OK(st) ((st)->pos <= (st)->size)
+
+#define WRITE_BYTES(p, n, st) do { \
+    if ((st)->data && (st)->pos + (n) <= (st)->size) \
+        memcpy((st)->data + (st)->pos, p, n); \
+    (st)->pos += (n); } while (0)
+#define  READ_BYTES(p, n, st) do { \
+    if ((st)->pos + (n) <= (st)->size) \
+        memcpy(p, (st)->data + (st)->pos, n); \
+    (st)->pos += (n); } while (0)
+
+#define WRITE_BOOL(x, st) do { \
     uint8 _ = x ? 1 : 0; \
-    fwrite(&_, 1, 1, fp); } while (0)
-#define  READ_BOOL(x, fp) do { \
-    uint8 _; \
-     fread(&_, 1, 1, fp); \
+    WRITE_BYTES(&_, 1, st); } while (0)
+#define  READ_BOOL(x, st) do { \
+    uint8 _ = 0; \
+     READ_BYTES(&_, 1, st); \
     x = _ ? TRUE : FALSE; } while (0)
 
-#define WRITE_uint8(x, fp)        do { \
-    fwrite(&x, sizeof(x), 1, fp); } while (0)
-#define  READ_uint8(x, fp)        do { \
-     fread(&x, sizeof(x), 1, fp); } while (0)
+#define WRITE_uint8(x, st)        do { \
+    WRITE_BYTES(&x, sizeof(x), st); } while (0)
+#define  READ_uint8(x, st)        do { \
+     READ_BYTES(&x, sizeof(x), st); } while (0)
 
-#define WRITE_int8(x, fp)  WRITE_uint8(x, fp)
-#define  READ_int8(x, fp)   READ_uint8(x, fp)
+#define WRITE_int8(x, st)  WRITE_uint8(x, st)
+#define  READ_int8(x, st)   READ_uint8(x, st)
 
-#define WRITE_uint16(x, fp)       do { \
+#define WRITE_uint16(x, st)       do { \
     uint16 _ = SV_SwapLE16(x); \
-    fwrite(&_, sizeof(x), 1, fp); } while (0)
-#define  READ_uint16(x, fp)       do { \
-     fread(&x, sizeof(x), 1, fp); \
+    WRITE_BYTES(&_, sizeof(x), st); } while (0)
+#define  READ_uint16(x, st)       do { \
+     READ_BYTES(&x, sizeof(x), st); \
     x = SV_SwapLE16(x);           } while (0)
 
-#define WRITE_int16(x, fp)  WRITE_uint16(x, fp)
-#define  READ_int16(x, fp)   READ_uint16(x, fp)
+#define WRITE_int16(x, st)  WRITE_uint16(x, st)
+#define  READ_int16(x, st)   READ_uint16(x, st)
 
-#define WRITE_uint32(x, fp)       do { \
+#define WRITE_uint32(x, st)       do { \
     uint32 _ = SV_SwapLE32(x); \
-    fwrite(&_, sizeof(x), 1, fp); } while (0)
-#define  READ_uint32(x, fp)       do { \
-     fread(&x, sizeof(x), 1, fp); \
+    WRITE_BYTES(&_, sizeof(x), st); } while (0)
+#define  READ_uint32(x, st)       do { \
+     READ_BYTES(&x, sizeof(x), st); \
     x = SV_SwapLE32(x);           } while (0)
 
-#define WRITE_int32(x, fp)  WRITE_uint32(x, fp)
-#define  READ_int32(x, fp)   READ_uint32(x, fp)
+#define WRITE_int32(x, st)  WRITE_uint32(x, st)
+#define  READ_int32(x, st)   READ_uint32(x, st)
 
-#define WRITE_real(x, fp)         do { \
+#define WRITE_real(x, st)         do { \
     double _ = SV_SwapLEDouble(x); \
-    fwrite(&_, sizeof(_), 1, fp); } while (0)
-#define  READ_real(x, fp)         do { \
-    double _; \
-     fread(&_, sizeof(_), 1, fp); \
+    WRITE_BYTES(&_, sizeof(_), st); } while (0)
+#define  READ_real(x, st)         do { \
+    double _ = 0; \
+     READ_BYTES(&_, sizeof(_), st); \
     x = (real)SV_SwapLEDouble(_); } while (0)
 
 #ifdef __cplusplus
@@ -17,6 +17,8 @@
 
 static M6502 m6502_registers;
 static BOOL irq = FALSE;
+// supervision_state_hash(): holds the largest chunk without a hash function
+static uint8 *hashBuffer;
 
 void m6502_set_irq_line(BOOL assertLine)
 {
@@ -59,6 +61,8 @@ void supervision_done(void)
 {
     gpu_done();
     memorymap_done();
+    free(hashBuffer);
+    hashBuffer = NULL;
 }
 
 BOOL supervision_load(const uint8 *rom, uint32 romSize)
@@ -75,26 +79,35 @@ void supervision_exec(uint16 *backbuffer)
     supervision_exec_ex(backbuffer, SV_W);
 }
 
+// Visible window: VRAM offset of the first line, pixel offset within
+// its first byte and width
+static void get_window(uint32 *scan, uint8 *innerx, uint8 *size)
+{
+    uint8 *regs = memorymap_getRegisters();
+
+    *scan   = regs[XPOS] / 4 + regs[YPOS] * 0x30;
+    *innerx = regs[XPOS] & 3;
+    *size   = regs[XSIZE]; // regs[XSIZE] <= SV_W
+    if (*size > SV_W)
+        *size = SV_W; // 192: Chimera, Matta Blatta, Tennis Pro '92
+}
+
 void supervision_exec_ex(uint16 *backbuffer, int16 backbufferWidth)
 {
     uint32 i, scan;
-    uint8 *regs = memorymap_getRegisters();
     uint8 innerx, size;
 
     // Number of iterations = 256 * 256 / m6502_registers.IPeriod
     for (i = 0; i < 256; i++) {
         Run6502(&m6502_registers);
         timer_exec(m6502_registers.IPeriod);
+        sound_exec(m6502_registers.IPeriod);
     }
 
     //if (!(regs[BANK] & 0x8)) { printf("LCD off\n"); }
-    scan   = regs[XPOS] / 4 + regs[YPOS] * 0x30;
-    innerx = regs[XPOS] & 3;
-    size   = regs[XSIZE]; // regs[XSIZE] <= SV_W
-    if (size > SV_W)
-        size = SV_W; // 192: Chimera, Matta Blatta, Tennis Pro '92
+    get_window(&scan, &innerx, &size);
 
-    for (i = 0; i < SV_H; i++) {
+    for (i = 0; i < SV_H && backbuffer != NULL; i++) {
         if (scan >= 0x1fe0)
             scan -= 0x1fe0; // SSSnake
         gpu_render_scanline(scan, backbuffer, innerx, size);
@@ -108,6 +121,27 @@ void supervision_exec_ex(uint16 *backbuffer, int16 backbufferWidth)
     sound_decrement();
 }
 
+void supervision_get_frame_2bpp(uint8 *frame)
+{
+    uint32 i, scan;
+    uint8 innerx, size;
+
+    get_window(&scan, &innerx, &size);
+
+    for (i = 0; i < SV_H; i++) {
+        if (scan >= 0x1fe0)
+            scan -= 0x1fe0;
+        gpu_get_scanline_2bpp(scan, frame, innerx, size);
+        frame += SV_W / 4;
+        scan += 0x30;
+    }
+}
+
+void supervision_get_palette(uint8 rgb[12])
+{
+    gpu_get_palette(rgb);
+}
+
 void supervision_set_map_func(SV_MapRGBFunc func)
 {
     gpu_set_map_func(func);
@@ -133,6 +167,41 @@ void supervision_update_sound(uint8 *stream, uint32 len)
     sound_stream_update(stream, len);
 }
 
+void supervision_update_sound_s16(int16 *stream, uint32 len)
+{
+    sound_stream_update_s16(stream, len);
+}
+
+void supervision_update_sound_f32(float *stream, uint32 len)
+{
+    sound_stream_update_f32(stream, len);
+}
+
+void supervision_update_sound_stems(uint8 *streams[SV_SOUND_CHANNEL_COUNT], uint32 len)
+{
+    sound_stream_update_stems(streams, len);
+}
+
+void supervision_set_sound_channels(uint8 mask)
+{
+    sound_set_channel_mask(mask);
+}
+
+void supervision_set_sound_synthesis(BOOL enable)
+{
+    sound_set_synthesis(enable);
+}
+
+void supervision_set_sound_gain(real gain)
+{
+    sound_set_gain(gain);
+}
+
+void supervision_set_sound_dc_filter(BOOL enable)
+{
+    sound_set_dc_filter(enable);
+}
+
 static void get_state_path(const char *statePath, int8 id, char **newPath)
 {
     if (id < 0) {
@@ -161,57 +230,263 @@ static void get_state_path(const char *statePath, int8 id, char **newPath)
     X(uint8, AfterCLI) \
     X(int32, IBackup)
 
+static void cpu_save_state(SV_STREAM *st)
+{
+#define X(type, member) WRITE_##type(m6502_registers.member, st);
+    EXPAND_M6502
+#undef X
+    WRITE_BOOL(irq, st);
+}
+
+static void cpu_load_state(SV_STREAM *st)
+{
+#define X(type, member) READ_##type(m6502_registers.member, st);
+    EXPAND_M6502
+#undef X
+    READ_BOOL(irq, st);
+}
+
+/*
+ * State format:
+ *   "SVST", uint32 SV_CORE_VERSION,
+ *   then chunks: char tag[4], uint32 length, length bytes.
+ * A chunk may be longer than this build reads (fields appended later),
+ * unknown chunks are skipped. The major version is bumped on
+ * incompatible changes. States without the magic are pre-chunk (1.0.5)
+ * states: MEM, SND, TMR, CPU without headers.
+ * There is no GPU chunk: LCD state lives in the registers and VRAM (MEM).
+ */
+#define STATE_MAGIC       "SVST"
+#define STATE_HEADER_SIZE 8
+#define CHUNK_HEADER_SIZE 8
+
+typedef struct {
+    char tag[4];
+    void (*save)(SV_STREAM *st);
+    void (*load)(SV_STREAM *st);
+    uint32 (*hash)(uint32 hash); // NULL - hash the saved chunk
+    uint32 appended; // Bytes added after 1.0.5; older states lack them
+} STATE_CHUNK;
+
+// In load order
+static const STATE_CHUNK chunks[] = {
+    { {'M', 'E', 'M', ' '}, memorymap_save_state, memorymap_load_state, memorymap_hash, 0 },
+    { {'S', 'N', 'D', ' '}, sound_save_state,     sound_load_state,     sound_hash,     4 + 18 }, // DMA cycles (1.1), playback copy (1.2)
+    { {'T', 'M', 'R', ' '}, timer_save_state,     timer_load_state,     NULL,           0 },
+    { {'C', 'P', 'U', ' '}, cpu_save_state,       cpu_load_state,       NULL,           0 },
+};
+#define CHUNK_COUNT (sizeof(chunks) / sizeof(chunks[0]))
+
+static uint32 chunk_size(const STATE_CHUNK *chunk)
+{
+    SV_STREAM st;
+    SV_STREAM_INIT(&st, NULL, 0);
+    chunk->save(&st);
+    return st.pos;
+}
+
+// The shortest chunk a load function accepts
+static uint32 chunk_min_size(const STATE_CHUNK *chunk)
+{
+    return chunk_size(chunk) - chunk->appended;
+}
+
+static void save_state(SV_STREAM *st)
+{
+    uint32 version = SV_CORE_VERSION;
+    size_t i;
+
+    WRITE_BYTES(STATE_MAGIC, 4, st);
+    WRITE_uint32(version, st);
+    for (i = 0; i < CHUNK_COUNT; i++) {
+        uint32 lengthPos, length = 0;
+        WRITE_BYTES(chunks[i].tag, 4, st);
+        lengthPos = st->pos;
+        WRITE_uint32(length, st);
+        chunks[i].save(st);
+        length = st->pos - lengthPos - 4;
+        if (st->data && SV_STREAM_OK(st)) {
+            SV_STREAM lst;
+            SV_STREAM_INIT(&lst, st->data + lengthPos, 4);
+            WRITE_uint32(length, &lst);
+        }
+    }
+}
+
+// Returns NULL if there is no such chunk or it's truncated
+static const uint8 *find_chunk(const uint8 *data, uint32 size, const char tag[4], uint32 *length)
+{
+    uint32 pos = STATE_HEADER_SIZE;
+    while (size - pos >= CHUNK_HEADER_SIZE) {
+        SV_STREAM st;
+        uint32 len;
+        SV_STREAM_INIT(&st, data + pos + 4, 4);
+        READ_uint32(len, &st);
+        pos += CHUNK_HEADER_SIZE;
+        if (len > size - pos)
+            return NULL;
+        if (memcmp(data + pos - CHUNK_HEADER_SIZE, tag, 4) == 0) {
+            *length = len;
+            return data + pos;
+        }
+        pos += len;
+    }
+    return NULL;
+}
+
+static BOOL load_state(const uint8 *data, uint32 size)
+{
+    const uint8 *chunkData[CHUNK_COUNT];
+    uint32 chunkLength[CHUNK_COUNT];
+    uint32 version;
+    SV_STREAM st;
+    size_t i;
+
+    if (size < STATE_HEADER_SIZE || memcmp(data, STATE_MAGIC, 4) != 0) {
+        // Legacy
+        uint32 legacySize = 0;
+        for (i = 0; i < CHUNK_COUNT; i++)
+            legacySize += chunk_min_size(&chunks[i]);
+        if (size < legacySize)
+            return FALSE;
+        for (i = 0; i < CHUNK_COUNT; i++) {
+            SV_STREAM_INIT(&st, data, chunk_min_size(&chunks[i]));
+            chunks[i].load(&st);
+            data += chunk_min_size(&chunks[i]);
+        }
+        return TRUE;
+    }
+
+    SV_STREAM_INIT(&st, data + 4, 4);
+    READ_uint32(version, &st);
+    if (((version >> 24) & 0xFF) > SV_CORE_VERSION_MAJOR)
+        return FALSE;
+
+    // Check before anything is overwritten
+    for (i = 0; i < CHUNK_COUNT; i++) {
+        chunkData[i] = find_chunk(data, size, chunks[i].tag, &chunkLength[i]);
+        if (chunkData[i] == NULL || chunkLength[i] < chunk_min_size(&chunks[i]))
+            return FALSE;
+    }
+    for (i = 0; i < CHUNK_COUNT; i++) {
+        SV_STREAM_INIT(&st, chunkData[i], chunkLength[i]);
+        chunks[i].load(&st);
+    }
+    return TRUE;
+}
+
+uint32 supervision_state_size(void)
+{
+    static uint32 size = 0;
+    if (size == 0) {
+        SV_STREAM st;
+        SV_STREAM_INIT(&st, NULL, 0);
+        save_state(&st);
+        size = st.pos;
+    }
+    return size;
+}
+
+BOOL supervision_serialize(void *data, uint32 size)
+{
+    SV_STREAM st;
+    if (size < supervision_state_size())
+        return FALSE;
+    SV_STREAM_INIT(&st, data, size);
+    save_state(&st);
+    return TRUE;
+}
+
+BOOL supervision_unserialize(const void *data, uint32 size)
+{
+    return load_state((const uint8 *)data, size);
+}
+
+uint32 supervision_state_hash(void)
+{
+    uint32 hash = SV_FNV_BASIS;
+    size_t i;
+
+    if (hashBuffer == NULL) {
+        uint32 size = 0;
+        for (i = 0; i < CHUNK_COUNT; i++) {
+            if (!chunks[i].hash && chunk_size(&chunks[i]) > size)
+                size = chunk_size(&chunks[i]);
+        }
+        hashBuffer = (uint8 *)malloc(size > 0 ? size : 1);
+        if (hashBuffer == NULL)
+            return 0;
+    }
+
+    for (i = 0; i < CHUNK_COUNT; i++) {
+        if (chunks[i].hash) {
+            hash = chunks[i].hash(hash);
+        }
+        else {
+            SV_STREAM st;
+            uint32 j;
+            SV_STREAM_INIT(&st, hashBuffer, chunk_size(&chunks[i]));
+            chunks[i].save(&st);
+            for (j = 0; j < st.pos; j++) {
+                hash = SV_FNV_BYTE(hash, hashBuffer[j]);
+            }
+        }
+    }
+    return hash;
+}
+
 BOOL supervision_save_state(const char *statePath, int8 id)
 {
     FILE *fp;
     char *newPath;
+    uint8 *data;
+    uint32 size = supervision_state_size();
+    BOOL ret;
+
+    data = (uint8 *)malloc(size);
+    if (data == NULL)
+        return FALSE;
+    supervision_serialize(data, size);
 
     get_state_path(statePath, id, &newPath);
     fp = fopen(newPath, "wb");
     if (id >= 0)
         free(newPath);
     if (fp) {
-        memorymap_save_state(fp);
-        sound_save_state(fp);
-        timer_save_state(fp);
-
-#define X(type, member) WRITE_##type(m6502_registers.member, fp);
-        EXPAND_M6502
-#undef X
-        WRITE_BOOL(irq, fp);
-
+        ret = fwrite(data, size, 1, fp) == 1;
         fflush(fp);
         fclose(fp);
     }
     else {
-        return FALSE;
+        ret = FALSE;
     }
-    return TRUE;
+    free(data);
+    return ret;
 }
 
 BOOL supervision_load_state(const char *statePath, int8 id)
 {
     FILE *fp;
     char *newPath;
+    uint8 *data;
+    long size;
+    BOOL ret;
 
     get_state_path(statePath, id, &newPath);
     fp = fopen(newPath, "rb");
     if (id >= 0)
         free(newPath);
-    if (fp) {
-        memorymap_load_state(fp);
-        sound_load_state(fp);
-        timer_load_state(fp);
-
-#define X(type, member) READ_##type(m6502_registers.member, fp);
-        EXPAND_M6502
-#undef X
-        READ_BOOL(irq, fp);
-
-        fclose(fp);
-    }
-    else {
+    if (!fp)
         return FALSE;
-    }
-    return TRUE;
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = size > 0 ? (uint8 *)malloc(size) : NULL;
+    ret = data != NULL && fread(data, size, 1, fp) == 1;
+    fclose(fp);
+    if (ret)
+        ret = supervision_unserialize(data, (uint32)size);
+    free(data);
+    return ret;
 }
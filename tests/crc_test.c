@@ -0,0 +1,123 @@
+/* CRC-32 of psplib/pl_util, against a byte-at-a-time reference
+
+   The library works 8 bytes at a time, then finishes byte by byte. Any
+   split of a buffer - odd lengths, starting at any alignment, and files
+   read in chunks - must give the same CRC as the reference. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pl_util.h"
+
+#define BUFFER_SIZE (64 * 1024)
+#define FILE_SIZE   (3 * 64 * 1024 + 13) /* reads of 64KB, then the rest */
+
+static uint32_t RefTable[256];
+static int Failed;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    Failed++; \
+  } } while (0)
+
+/* Built from the polynomial, not taken from the library */
+static void init_reference()
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++)
+  {
+    for (c = i, k = 0; k < 8; k++)
+      c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+    RefTable[i] = c;
+  }
+}
+
+static uint32_t reference_crc(const unsigned char *buf, size_t len)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  while (len--)
+    crc = (crc >> 8) ^ RefTable[(crc ^ *buf++) & 0xFF];
+  return crc ^ 0xFFFFFFFF;
+}
+
+/* Reproducible, so a failure can be rerun */
+static void fill_random(unsigned char *buf, size_t len, uint32_t seed)
+{
+  while (len--)
+  {
+    seed = seed * 1664525 + 1013904223;
+    *buf++ = (unsigned char)(seed >> 24);
+  }
+}
+
+int main()
+{
+  static unsigned char buffer[BUFFER_SIZE + 8];
+  static const size_t lengths[] =
+    { 0, 1, 3, 7, 8, 9, 15, 17, 63, 255, 1023, 4097, 65535 };
+  uint32_t crc;
+  size_t i, offset;
+  FILE *file = NULL;
+  int before;
+
+  init_reference();
+
+  /* Check value */
+  pl_util_compute_crc32_buffer("123456789", 9, &crc);
+  CHECK(crc == 0xCBF43926);
+  CHECK(reference_crc((const unsigned char*)"123456789", 9) == 0xCBF43926);
+  printf("%-24s %s\n", "check value", Failed ? "FAIL" : "ok");
+
+  /* Odd lengths at every alignment */
+  before = Failed;
+  fill_random(buffer, sizeof(buffer), 1);
+  for (offset = 0; offset < 8; offset++)
+  {
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+      pl_util_compute_crc32_buffer(buffer + offset, lengths[i], &crc);
+      if (crc != reference_crc(buffer + offset, lengths[i]))
+      {
+        printf("  FAIL length %u at offset %u\n",
+          (unsigned)lengths[i], (unsigned)offset);
+        Failed++;
+      }
+    }
+  }
+  printf("%-24s %s\n", "unaligned buffers", Failed > before ? "FAIL" : "ok");
+
+  /* Random lengths and offsets */
+  before = Failed;
+  for (i = 0; i < 1000; i++)
+  {
+    size_t len;
+    fill_random(buffer, sizeof(buffer), (uint32_t)i + 2);
+    offset = buffer[0] & 7;
+    len = (buffer[1] | (buffer[2] << 8)) % (BUFFER_SIZE + 1);
+    pl_util_compute_crc32_buffer(buffer + offset, len, &crc);
+    CHECK(crc == reference_crc(buffer + offset, len));
+  }
+  printf("%-24s %s\n", "random buffers", Failed > before ? "FAIL" : "ok");
+
+  /* A file is read in chunks, the CRC carried from one to the next */
+  before = Failed;
+  unsigned char *data = (unsigned char*)malloc(FILE_SIZE);
+  CHECK(data && (file = tmpfile()));
+  if (data && file)
+  {
+    fill_random(data, FILE_SIZE, 3);
+    CHECK(fwrite(data, FILE_SIZE, 1, file) == 1);
+    rewind(file);
+    CHECK(pl_util_compute_crc32_fd(file, &crc) == 0);
+    CHECK(crc == reference_crc(data, FILE_SIZE));
+    fclose(file);
+  }
+  free(data);
+  printf("%-24s %s\n", "file in chunks", Failed > before ? "FAIL" : "ok");
+
+  return Failed ? 1 : 0;
+}
@@ -0,0 +1,18 @@
+/* Host stand-in for the PSP kernel headers: just enough for the psplib
+   modules the tests build. Everything runs on one thread, so semaphores
+   never block; a test that simulates another thread sets
+   test_wait_sema_hook, which then runs whenever the caller would block. */
+
+#ifndef _TEST_PSPKERNEL_H
+#define _TEST_PSPKERNEL_H
+
+static inline int sceKernelCreateSema(const char *name, int attr,
+  int init, int max, void *opt) { return 1; }
+static inline int sceKernelDeleteSema(int id) { return 0; }
+extern void (*test_wait_sema_hook)(int id);
+
+static inline int sceKernelWaitSema(int id, int count, void *timeout)
+  { if (test_wait_sema_hook) test_wait_sema_hook(id); return 0; }
+static inline int sceKernelSignalSema(int id, int count) { return 0; }
+
+#endif
@@ -0,0 +1,19 @@
+/* Host stand-in for psprtc.h: a monotonic clock in microseconds */
+
+#ifndef _TEST_PSPRTC_H
+#define _TEST_PSPRTC_H
+
+#include <time.h>
+#include <psptypes.h>
+
+static inline int sceRtcGetCurrentTick(u64 *tick)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  *tick = (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  return 0;
+}
+
+static inline u32 sceRtcGetTickResolution() { return 1000000; }
+
+#endif
@@ -0,0 +1 @@
+#include <pspkernel.h>
@@ -0,0 +1,25 @@
+/* Host stand-in for psptypes.h */
+
+#ifndef _TEST_PSPTYPES_H
+#define _TEST_PSPTYPES_H
+
+#include <stdint.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t  s64;
+
+typedef struct ScePspDateTime
+{
+  u16 year;
+  u16 month;
+  u16 day;
+  u16 hour;
+  u16 minute;
+  u16 second;
+  u32 microsecond;
+} ScePspDateTime;
+
+#endif
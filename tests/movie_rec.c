@@ -0,0 +1,112 @@
+// Records the movie regression set: writes the test ROM and a few movies
+// recorded against it into a directory, and prints "movie hash audio" for
+// each: the hash of the state after the last frame, and that of the audio
+// rendered while recording. svmv_play must reproduce the hashes however
+// the movie is played back.
+//
+// movie_rec dir
+
+#include "supervision.h"
+#include "pl_movie.h"
+#include "pl_util.h"
+#include "testrom.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAMES 900
+// Audio pulled per frame, as svmv_play does
+#define FRAME_SAMPLES 735
+
+static uint8 rom[TESTROM_SIZE];
+
+// Held inputs of varying length, so the movie has runs of all sizes
+static uint8 input_at(uint32 frame, uint32 seed)
+{
+    uint32 x = (frame / (1 + (frame * seed) % 23) + seed) * 2654435761U;
+    return (uint8)(x >> 24);
+}
+
+static BOOL record(const char *dir, const char *name, uint32 warmup, uint32 seed)
+{
+    static int16 audio[FRAME_SAMPLES * 2];
+    char path[1024];
+    pl_movie movie;
+    uint8 *state = NULL;
+    uint32 stateSize = 0, audioHash = SV_FNV_BASIS, crc, i, j;
+
+    supervision_reset();
+    supervision_set_sound_synthesis(TRUE);
+    for (i = 0; i < warmup; i++) {
+        supervision_set_input(input_at(i, seed + 1));
+        supervision_exec_ex(NULL, 0);
+        supervision_update_sound_s16(audio, sizeof(audio));
+    }
+    if (warmup) {
+        stateSize = supervision_state_size();
+        state = (uint8 *)malloc(stateSize);
+        supervision_serialize(state, stateSize);
+    }
+    else {
+        // Power-on: playback starts from a reset
+        supervision_reset();
+    }
+    // The DC filter isn't part of the state: start it from rest, as a
+    // player does
+    supervision_set_sound_dc_filter(TRUE);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    pl_movie_init(&movie);
+    pl_util_compute_crc32_buffer(rom, sizeof(rom), &crc);
+    if (!pl_movie_record(&movie, path, crc, state, stateSize))
+        return FALSE;
+    free(state);
+
+    for (i = 0; i < FRAMES; i++) {
+        uint8 input = input_at(i, seed);
+        pl_movie_update(&movie, &input);
+        supervision_set_input(input);
+        supervision_exec_ex(NULL, 0);
+        supervision_update_sound_s16(audio, sizeof(audio));
+        for (j = 0; j < FRAME_SAMPLES * 2; j++) {
+            audioHash = SV_FNV_BYTE(audioHash, audio[j] & 0xff);
+            audioHash = SV_FNV_BYTE(audioHash, (uint16)audio[j] >> 8);
+        }
+    }
+    if (!pl_movie_stop(&movie))
+        return FALSE;
+
+    printf("%s %08x %08x\n", name, supervision_state_hash(), audioHash);
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    char path[1024];
+    FILE *f;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s dir\n", argv[0]);
+        return 2;
+    }
+
+    testrom_build(rom);
+    snprintf(path, sizeof(path), "%s/testrom.bin", argv[1]);
+    if (!(f = fopen(path, "wb")) || fwrite(rom, sizeof(rom), 1, f) != 1 || fclose(f) != 0) {
+        fprintf(stderr, "%s: can't write\n", path);
+        return 1;
+    }
+
+    supervision_init();
+    if (!supervision_load(rom, sizeof(rom)))
+        return 1;
+    if (!record(argv[1], "power_on.svm", 0, 1)
+        || !record(argv[1], "from_state.svm", 300, 2)
+        || !record(argv[1], "fast_input.svm", 120, 0)) {
+        fprintf(stderr, "movie not recorded\n");
+        return 1;
+    }
+    supervision_done();
+    return 0;
+}
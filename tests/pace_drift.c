@@ -0,0 +1,148 @@
+/* Audio/video clock drift simulation for psplib/pl_pace
+
+   The emulation thread writes one frame of audio per video frame, the
+   sound thread drains fixed-size blocks at the audio clock. The two
+   clocks are run against each other with a simulated time base. Once
+   the rate control has settled, the queue must neither underrun nor
+   overflow, and must stay around the target fill level. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pl_pace.h"
+
+#define SAMPLE_RATE    44100
+#define FRAME_RATE     60
+#define CAPACITY       4096
+#define LATENCY_FRAMES 2
+#define BLOCK_SAMPLES  384  /* PL_SND_ALIGN_SAMPLE(SOUND_BUFFER_SIZE) */
+#define SECONDS        600
+#define SETTLE_SECONDS 60
+
+typedef struct
+{
+  const char *name;
+  double audio_drift;  /* audio clock error, relative */
+  double video_rate;   /* 0 - frames are paced by the audio queue (limiter) */
+} scenario;
+
+static const scenario Scenarios[] =
+{
+  { "limiter, exact clocks",        0.0,     0     },
+  { "limiter, audio +0.3%",         0.003,   0     },
+  { "limiter, audio -0.3%",        -0.003,   0     },
+  { "vsync 59.94Hz",                0.0,     59.94 },
+  { "vsync 59.8Hz, audio +0.1%",    0.001,   59.8  },
+  { "vsync 60.2Hz, audio -0.1%",   -0.001,   60.2  },
+};
+
+/* The limiter's wait stands in for the sound thread running meanwhile */
+void (*test_wait_sema_hook)(int id);
+
+static pl_pace Pace;
+static double AudioPeriod, NextRead;
+static int Settled;
+static unsigned int Underruns, MinFill, MaxFill;
+
+static void fill(pl_snd_sample *buffer, unsigned int samples, void *userdata)
+{
+  memset(buffer, 0, samples * sizeof(pl_snd_sample));
+}
+
+static void read_block()
+{
+  static pl_snd_sample block[BLOCK_SAMPLES];
+  unsigned int before = Pace.underruns, queued;
+
+  pl_pace_read(&Pace, block, BLOCK_SAMPLES);
+  NextRead += AudioPeriod;
+
+  if (Settled)
+  {
+    Underruns += Pace.underruns - before;
+    queued = Pace.write_pos - Pace.read_pos;
+    if (queued < MinFill) MinFill = queued;
+    if (queued > MaxFill) MaxFill = queued;
+  }
+}
+
+static void wait_sema(int id)
+{
+  read_block();
+}
+
+static int run(const scenario *s)
+{
+  double video_period = (s->video_rate > 0) ? 1.0 / s->video_rate : 0;
+  double next_frame = 0;
+  double min_ratio = 2, max_ratio = 0;
+  unsigned int overflows = 0, pinned = 0, band;
+
+  if (!pl_pace_init(&Pace, CAPACITY))
+    return 0;
+  pl_pace_reset(&Pace, SAMPLE_RATE, FRAME_RATE, LATENCY_FRAMES);
+
+  AudioPeriod = BLOCK_SAMPLES / (SAMPLE_RATE * (1.0 + s->audio_drift));
+  NextRead = AudioPeriod;
+  Settled = 0;
+  Underruns = 0;
+  MinFill = CAPACITY;
+  MaxFill = 0;
+
+  while (NextRead < SECONDS)
+  {
+    Settled = NextRead > SETTLE_SECONDS;
+
+    /* With VSync, frames come at the video rate, and the writer never */
+    /* blocks; without it, the limiter blocks the writer, while the */
+    /* sound thread drains the queue */
+    if (!video_period || next_frame <= NextRead)
+    {
+      unsigned int before = Pace.write_pos;
+      int produced = pl_pace_write_frame(&Pace, fill, NULL, !video_period);
+
+      if (Settled)
+      {
+        if (Pace.write_pos - before < (unsigned int)produced)
+          overflows++;
+        if (Pace.ratio < min_ratio) min_ratio = Pace.ratio;
+        if (Pace.ratio > max_ratio) max_ratio = Pace.ratio;
+        if (Pace.ratio <= 1.0f - PL_PACE_MAX_DEVIATION
+          || Pace.ratio >= 1.0f + PL_PACE_MAX_DEVIATION)
+          pinned++;
+      }
+
+      next_frame += video_period;
+      continue;
+    }
+
+    read_block();
+  }
+
+  /* Once settled, the fill may only swing by what a frame adds and a */
+  /* block takes away, around target; and the ratio has to be steering, */
+  /* not resting against a limit */
+  band = (unsigned int)Pace.frame_samples + BLOCK_SAMPLES;
+  int ok = !Underruns && !overflows
+    && MinFill + band >= Pace.target && MaxFill <= Pace.target + band
+    && !pinned;
+  printf("%-30s %s  fill %4u-%4u (target %u)  ratio %.4f-%.4f"
+         "  pinned %u  underruns %u  overflows %u\n",
+         s->name, ok ? "ok  " : "FAIL", MinFill, MaxFill, Pace.target,
+         min_ratio, max_ratio, pinned, Underruns, overflows);
+
+  pl_pace_destroy(&Pace);
+  return ok;
+}
+
+int main()
+{
+  int i, failed = 0;
+
+  test_wait_sema_hook = wait_sema;
+  for (i = 0; i < (int)(sizeof(Scenarios) / sizeof(Scenarios[0])); i++)
+    if (!run(&Scenarios[i]))
+      failed++;
+
+  return failed ? 1 : 0;
+}
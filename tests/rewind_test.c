@@ -0,0 +1,159 @@
+/* Rewind history for psplib/pl_rewind, over the emulator core
+
+   Every step back must land on the exact state the emulator was in
+   before that frame, in both backends. The replay backend rebuilds most
+   of its states by re-emulating the logged input from a keyframe, so
+   this also checks that emulation is deterministic across a load.
+
+   The second pass plays the frontend's loop, which runs a frame with
+   live input after every step back, through a rewind, a resume and
+   another rewind past the point of resumption. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "supervision.h"
+#include "pl_rewind.h"
+#include "testrom.h"
+
+#define BUDGET   (4 << 20)
+#define WARMUP   60
+#define FRAMES   400
+#define INTERVAL 15
+
+/* Frontend session: frames played, rewound, played, rewound */
+static const int Session[] = { 300, -20, 100, -200 };
+
+static uint8 Rom[TESTROM_SIZE];
+static uint32 Hashes[FRAMES];
+
+static int save_state(void *data)
+{
+  return supervision_serialize((uint8 *)data, supervision_state_size());
+}
+
+static int load_state(void *data)
+{
+  return supervision_unserialize((const uint8 *)data,
+    supervision_state_size());
+}
+
+static int get_state_size()
+{
+  return (int)supervision_state_size();
+}
+
+static void run_frame(unsigned char input)
+{
+  supervision_set_input(input);
+  supervision_exec_ex(NULL, 0);
+}
+
+static int run(const char *name, int mode)
+{
+  static int16 audio[800 * 2];
+  pl_rewind rewind;
+  int i, mismatches = 0;
+
+  supervision_reset();
+  supervision_set_sound_synthesis(TRUE);
+  for (i = 0; i < WARMUP; i++)
+    run_frame((unsigned char)(i * 13));
+
+  if (!pl_rewind_init_ex(&rewind, BUDGET, mode, INTERVAL,
+    save_state, load_state, get_state_size, run_frame))
+  {
+    printf("%-8s FAIL  out of memory\n", name);
+    return 0;
+  }
+
+  /* Record; audio is pulled as the host would, which must not matter */
+  for (i = 0; i < FRAMES; i++)
+  {
+    unsigned char input = (unsigned char)(i * 37 + (i >> 4));
+    pl_rewind_save(&rewind, input);
+    Hashes[i] = supervision_state_hash();
+    run_frame(input);
+    supervision_update_sound_s16(audio, (733 + i % 5) * 4);
+  }
+
+  /* Step back all the way */
+  for (i = FRAMES - 1; i >= 0; i--)
+  {
+    if (!pl_rewind_restore(&rewind) || supervision_state_hash() != Hashes[i])
+      mismatches++;
+  }
+
+  printf("%-8s %s  %d frames, %d mismatched\n",
+    name, mismatches ? "FAIL" : "ok  ", FRAMES, mismatches);
+
+  pl_rewind_destroy(&rewind);
+  return !mismatches;
+}
+
+/* One pass of the frontend's loop; the state logged at each position */
+/* is kept in Hashes, which every step back must come back to */
+static int step(pl_rewind *rewind, int rewinding, unsigned char input)
+{
+  static int16 audio[800 * 2];
+  int ok = 1;
+
+  if (rewinding)
+    ok = pl_rewind_restore(rewind)
+      && supervision_state_hash() == Hashes[rewind->state_count];
+
+  pl_rewind_save(rewind, input);
+  Hashes[rewind->state_count - 1] = supervision_state_hash();
+  run_frame(input);
+  supervision_update_sound_s16(audio, (733 + rewind->state_count % 5) * 4);
+
+  return ok;
+}
+
+static int run_session(const char *name, int mode)
+{
+  pl_rewind rewind;
+  int i, j, frames = 0, mismatches = 0;
+
+  supervision_reset();
+  supervision_set_sound_synthesis(TRUE);
+
+  if (!pl_rewind_init_ex(&rewind, BUDGET, mode, INTERVAL,
+    save_state, load_state, get_state_size, run_frame))
+  {
+    printf("%-8s FAIL  out of memory\n", name);
+    return 0;
+  }
+
+  for (i = 0; i < (int)(sizeof(Session) / sizeof(Session[0])); i++)
+  {
+    int count = (Session[i] < 0) ? -Session[i] : Session[i];
+    for (j = 0; j < count; j++, frames++)
+      if (!step(&rewind, Session[i] < 0, (unsigned char)(frames * 29 + i)))
+        mismatches++;
+  }
+
+  printf("%-8s %s  %d frames, rewound twice, %d mismatched\n",
+    name, mismatches ? "FAIL" : "ok  ", frames, mismatches);
+
+  pl_rewind_destroy(&rewind);
+  return !mismatches;
+}
+
+int main()
+{
+  int failed = 0;
+
+  testrom_build(Rom);
+  supervision_init();
+  if (!supervision_load(Rom, sizeof(Rom)))
+    return 1;
+
+  if (!run("delta", PL_REWIND_DELTA)) failed++;
+  if (!run("replay", PL_REWIND_REPLAY)) failed++;
+  if (!run_session("delta", PL_REWIND_DELTA)) failed++;
+  if (!run_session("replay", PL_REWIND_REPLAY)) failed++;
+
+  supervision_done();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+/* Shared ROM images for psplib/pl_rom, on a host that maps files
+
+   Opening a ROM maps the file; opening it again while it's unchanged
+   shares the mapping. Replacing the file (as a new ROM swapped in) gets
+   a new image, while the old one stays intact for as long as it's
+   referenced, and is unmapped with the last reference. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pl_rom.h"
+
+#define ROM_SIZE 0x8000
+#define BANK     0x4000
+
+static const char *Path = "rom_test.bin";
+static int Failed;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { \
+    printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+    Failed++; \
+  } } while (0)
+
+/* Writes a new file and renames it over the old one, as a copy would */
+static int write_rom(unsigned int size, unsigned char fill)
+{
+  static unsigned char data[ROM_SIZE * 2];
+  FILE *file;
+
+  memset(data, fill, size);
+  if (!(file = fopen("rom_test.tmp", "wb"))
+    || fwrite(data, size, 1, file) != 1 || fclose(file) != 0)
+    return 0;
+
+  return rename("rom_test.tmp", Path) == 0;
+}
+
+/* Mappings of the test ROM in this process */
+static int count_mappings()
+{
+  char line[1024];
+  int count = 0;
+  FILE *maps = fopen("/proc/self/maps", "r");
+
+  if (!maps)
+    return -1;
+  while (fgets(line, sizeof(line), maps))
+    if (strstr(line, Path))
+      count++;
+  fclose(maps);
+
+  return count;
+}
+
+static int all_bytes(const pl_rom *rom, unsigned char value)
+{
+  unsigned int i;
+  for (i = 0; i < rom->size; i++)
+    if (rom->data[i] != value)
+      return 0;
+  return 1;
+}
+
+int main()
+{
+  pl_rom *first, *shared, *swapped;
+
+  if (!write_rom(ROM_SIZE, 0x11))
+  {
+    printf("FAIL  can't write %s\n", Path);
+    return 1;
+  }
+
+  /* Map */
+  first = pl_rom_open(Path, BANK);
+  CHECK(first && first->mapped && first->size == ROM_SIZE);
+  CHECK(first && all_bytes(first, 0x11));
+  CHECK(count_mappings() == 1);
+  printf("%-24s %s\n", "mapped", Failed ? "FAIL" : "ok");
+
+  /* Share while unchanged; a size refused up front is refused again */
+  int before = Failed;
+  shared = pl_rom_open(Path, BANK);
+  CHECK(shared == first && first->refs == 2);
+  CHECK(pl_rom_open(Path, 0x3000) == NULL && first->refs == 2);
+  pl_rom_release(shared);
+  CHECK(first->refs == 1 && count_mappings() == 1);
+  printf("%-24s %s\n", "shared", Failed > before ? "FAIL" : "ok");
+
+  /* Swapped: a new image; the old one is unmapped once released */
+  before = Failed;
+  usleep(10000);
+  CHECK(write_rom(ROM_SIZE, 0x22));
+  swapped = pl_rom_open(Path, BANK);
+  CHECK(swapped && swapped != first && swapped->mapped);
+  CHECK(swapped && all_bytes(swapped, 0x22));
+  CHECK(all_bytes(first, 0x11));
+  CHECK(count_mappings() == 2);
+  pl_rom_release(first);
+  CHECK(count_mappings() == 1);
+  CHECK(pl_rom_open(Path, BANK) == swapped && swapped->refs == 2);
+  pl_rom_release(swapped);
+  pl_rom_release(swapped);
+  CHECK(count_mappings() == 0);
+  printf("%-24s %s\n", "unmapped on swap", Failed > before ? "FAIL" : "ok");
+
+  /* Refused before anything is mapped */
+  before = Failed;
+  CHECK(write_rom(ROM_SIZE + 1, 0x33));
+  CHECK(pl_rom_open(Path, BANK) == NULL);
+  CHECK(count_mappings() == 0);
+  printf("%-24s %s\n", "bad size refused", Failed > before ? "FAIL" : "ok");
+
+  unlink(Path);
+  return Failed ? 1 : 0;
+}
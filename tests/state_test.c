@@ -0,0 +1,382 @@
+// Save state format compatibility: chunked states round-trip, legacy
+// (headerless 1.0.5) states load, unknown chunks are skipped, truncated
+// or too new states are rejected without touching the emulator.
+
+#include "supervision.h"
+#include "memorymap.h"
+#include "testrom.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAMES 120
+// Bytes appended to SND: DMA cycles (1.1), playback copy of the channels (1.2)
+#define SND_CYCLES   4
+#define SND_PLAYBACK 18
+
+static int failed;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failed++; \
+    } } while (0)
+
+static uint8 rom[TESTROM_SIZE];
+static uint8 *ref;     // state after FRAMES frames
+static uint32 refSize;
+
+static uint32 get_u32(const uint8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24);
+}
+
+static void put_u32(uint8 *p, uint32 v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+// Offset of the chunk header, -1 - no such chunk
+static int find_chunk(const uint8 *data, uint32 size, const char *tag)
+{
+    uint32 pos = 8;
+    while (pos + 8 <= size) {
+        if (memcmp(data + pos, tag, 4) == 0)
+            return (int)pos;
+        pos += 8 + get_u32(data + pos + 4);
+    }
+    return -1;
+}
+
+// pull: audio samples taken per frame (plus 0 - 4), as a host would
+static void run_frames(int first, int count, BOOL synthesis, int pull)
+{
+    static int16 audio[1000 * 2];
+    int i;
+    supervision_set_sound_synthesis(synthesis);
+    for (i = first; i < first + count; i++) {
+        supervision_set_input((uint8)(i * 37));
+        supervision_exec_ex(NULL, 0);
+        supervision_update_sound_s16(audio, (pull + i % 5) * 4);
+    }
+}
+
+// Load data; the current state is checked to be ref on success and
+// unchanged on failure
+static BOOL load(const uint8 *data, uint32 size)
+{
+    uint8 *before = (uint8 *)malloc(refSize);
+    uint8 *after  = (uint8 *)malloc(refSize);
+    BOOL ok;
+
+    supervision_reset();
+    supervision_serialize(before, refSize);
+    ok = supervision_unserialize(data, size);
+    supervision_serialize(after, refSize);
+    CHECK(memcmp(after, ok ? ref : before, refSize) == 0);
+
+    free(before);
+    free(after);
+    return ok;
+}
+
+static void test_round_trip(void)
+{
+    CHECK(load(ref, refSize));
+    CHECK(memcmp(ref, "SVST", 4) == 0);
+    CHECK(get_u32(ref + 4) == SV_CORE_VERSION);
+}
+
+// 1.0.5: the chunk payloads back to back, SND without the appended fields
+static void test_legacy(void)
+{
+    static const char *tags[] = { "MEM ", "SND ", "TMR ", "CPU " };
+    uint8 *legacy = (uint8 *)malloc(refSize);
+    uint8 *state  = (uint8 *)malloc(refSize);
+    uint32 size = 0, i;
+    int snd = find_chunk(ref, refSize, "SND ");
+    uint32 end = snd + 8 + get_u32(ref + snd + 4);
+
+    for (i = 0; i < 4; i++) {
+        int pos = find_chunk(ref, refSize, tags[i]);
+        uint32 len = get_u32(ref + pos + 4);
+        if (i == 1)
+            len -= SND_CYCLES + SND_PLAYBACK;
+        memcpy(legacy + size, ref + pos + 8, len);
+        size += len;
+    }
+
+    supervision_reset();
+    CHECK(supervision_unserialize(legacy, size));
+    supervision_serialize(state, refSize);
+    // Same apart from the appended fields, which are estimated
+    CHECK(memcmp(state, ref, end - SND_CYCLES - SND_PLAYBACK) == 0);
+    CHECK(memcmp(state + end, ref + end, refSize - end) == 0);
+
+    // Too short for a legacy state
+    CHECK(!load(legacy, size - 1));
+
+    free(legacy);
+    free(state);
+}
+
+static void test_unknown_chunk(void)
+{
+    static const uint8 extra[8 + 13] = { 'X', 'T', 'R', 'A', 13 };
+    uint8 *data = (uint8 *)malloc(refSize + 2 * sizeof(extra));
+    int snd = find_chunk(ref, refSize, "SND ");
+
+    // Before SND and at the end
+    memcpy(data, ref, snd);
+    memcpy(data + snd, extra, sizeof(extra));
+    memcpy(data + snd + sizeof(extra), ref + snd, refSize - snd);
+    memcpy(data + refSize + sizeof(extra), extra, sizeof(extra));
+    CHECK(load(data, refSize + 2 * sizeof(extra)));
+
+    free(data);
+}
+
+// Fields appended by a later minor version are ignored
+static void test_longer_chunk(void)
+{
+    uint8 *data = (uint8 *)malloc(refSize + 6);
+    int cpu = find_chunk(ref, refSize, "CPU ");
+
+    memcpy(data, ref, refSize);
+    memset(data + refSize, 0xa5, 6);
+    put_u32(data + cpu + 4, get_u32(ref + cpu + 4) + 6);
+    CHECK(load(data, refSize + 6));
+
+    free(data);
+}
+
+// SND cut by 'cut' bytes at the end
+static uint32 cut_snd(uint8 *data, uint32 cut)
+{
+    int snd = find_chunk(ref, refSize, "SND ");
+    uint32 end = snd + 8 + get_u32(ref + snd + 4);
+
+    memcpy(data, ref, end - cut);
+    memcpy(data + end - cut, ref + end, refSize - end);
+    put_u32(data + snd + 4, get_u32(ref + snd + 4) - cut);
+    return refSize - cut;
+}
+
+// Chunked, from before fields were appended to SND
+static void test_short_snd(void)
+{
+    uint8 *data = (uint8 *)malloc(refSize);
+    uint8 *state = (uint8 *)malloc(refSize);
+    int snd = find_chunk(ref, refSize, "SND ");
+    uint32 end = snd + 8 + get_u32(ref + snd + 4);
+    uint32 size;
+
+    // 1.1: all but the playback copy, which follows the registers
+    size = cut_snd(data, SND_PLAYBACK);
+    supervision_reset();
+    CHECK(supervision_unserialize(data, size));
+    supervision_serialize(state, refSize);
+    CHECK(memcmp(state, ref, end - SND_PLAYBACK) == 0);
+    CHECK(memcmp(state + end, ref + end, refSize - end) == 0);
+
+    // 1.0.x
+    size = cut_snd(data, SND_CYCLES + SND_PLAYBACK);
+    supervision_reset();
+    CHECK(supervision_unserialize(data, size));
+
+    // Anything shorter is truncated
+    size = cut_snd(data, SND_CYCLES + SND_PLAYBACK + 1);
+    CHECK(!load(data, size));
+
+    free(data);
+    free(state);
+}
+
+static void test_truncated(void)
+{
+    uint8 *data = (uint8 *)malloc(refSize);
+    int cpu = find_chunk(ref, refSize, "CPU ");
+
+    // Cut in the middle of the last chunk, or of a chunk header
+    CHECK(!load(ref, refSize - 1));
+    CHECK(!load(ref, cpu + 4));
+    CHECK(!load(ref, 8));
+    CHECK(!load(ref, 4));
+
+    // A chunk claiming more than there is
+    memcpy(data, ref, refSize);
+    put_u32(data + cpu + 4, get_u32(ref + cpu + 4) + 1);
+    CHECK(!load(data, refSize));
+
+    // A missing chunk
+    memcpy(data, ref, refSize);
+    memcpy(data + cpu, "XCPU", 4);
+    CHECK(!load(data, refSize));
+
+    free(data);
+}
+
+static void test_newer_major(void)
+{
+    uint8 *data = (uint8 *)malloc(refSize);
+
+    memcpy(data, ref, refSize);
+    put_u32(data + 4, SV_CORE_VERSION + (1U << 24));
+    CHECK(!load(data, refSize));
+    put_u32(data + 4, SV_CORE_VERSION + (1U << 12));
+    CHECK(load(data, refSize));
+
+    free(data);
+}
+
+// A lower ROM bank past the end of this ROM wraps, as bank switching does
+static void test_bad_bank(void)
+{
+    uint8 *data = (uint8 *)malloc(refSize);
+    int mem = find_chunk(ref, refSize, "MEM ");
+
+    memcpy(data, ref, refSize);
+    data[mem + 8 + 0x6000] = 0xff; // ibank, after regs and RAM
+    supervision_reset();
+    CHECK(supervision_unserialize(data, refSize));
+    CHECK(memorymap_getLowerRomBank() == rom + (0xff * 0x4000) % sizeof(rom));
+
+    free(data);
+}
+
+// Loading a state and going on must match never having stopped
+static void test_resume(void)
+{
+    uint8 *a = (uint8 *)malloc(refSize);
+    uint8 *b = (uint8 *)malloc(refSize);
+    uint32 hashA[FRAMES], hashB[FRAMES];
+    int i;
+
+    supervision_unserialize(ref, refSize);
+    for (i = 0; i < FRAMES; i++) {
+        run_frames(FRAMES + i, 1, TRUE, 733);
+        hashA[i] = supervision_state_hash();
+    }
+    supervision_serialize(a, refSize);
+
+    supervision_unserialize(ref, refSize);
+    for (i = 0; i < FRAMES; i++) {
+        supervision_serialize(b, refSize);
+        supervision_reset();
+        CHECK(supervision_unserialize(b, refSize));
+        run_frames(FRAMES + i, 1, TRUE, 733);
+        hashB[i] = supervision_state_hash();
+    }
+    CHECK(memcmp(hashA, hashB, sizeof(hashA)) == 0);
+    supervision_serialize(b, refSize);
+    CHECK(memcmp(a, b, refSize) == 0);
+
+    free(a);
+    free(b);
+}
+
+// The hash follows emulation only, not how much audio was synthesized
+static void test_hash(void)
+{
+    static const int pulls[] = { 733, 700, 780 };
+    uint32 hashA[FRAMES], hashB[FRAMES];
+    size_t i, j;
+
+    supervision_unserialize(ref, refSize);
+    for (i = 0; i < FRAMES; i++) {
+        run_frames(FRAMES + i, 1, FALSE, 733);
+        hashA[i] = supervision_state_hash();
+    }
+    for (j = 0; j < sizeof(pulls) / sizeof(pulls[0]); j++) {
+        supervision_unserialize(ref, refSize);
+        for (i = 0; i < FRAMES; i++) {
+            run_frames(FRAMES + i, 1, TRUE, pulls[j]);
+            hashB[i] = supervision_state_hash();
+        }
+        CHECK(memcmp(hashA, hashB, sizeof(hashA)) == 0);
+    }
+
+    // But it does follow emulation
+    supervision_unserialize(ref, refSize);
+    run_frames(FRAMES + 1, FRAMES, FALSE, 733);
+    CHECK(supervision_state_hash() != hashA[FRAMES - 1]);
+}
+
+// Running ahead - save, run frames, load - must not change the audio
+static void test_run_ahead(void)
+{
+    static int16 audioA[FRAMES * 800 * 2], audioB[FRAMES * 800 * 2];
+    uint8 *state = (uint8 *)malloc(refSize);
+    uint32 size = 0;
+    int i, j;
+
+    // The DC filter is host-side: both runs start it from rest
+    supervision_set_sound_synthesis(TRUE);
+    supervision_set_sound_dc_filter(TRUE);
+    supervision_unserialize(ref, refSize);
+    for (i = 0; i < FRAMES; i++) {
+        supervision_set_input((uint8)(i * 37));
+        supervision_exec_ex(NULL, 0);
+        supervision_update_sound_s16(audioA + size, (733 + i % 5) * 4);
+        size += (733 + i % 5) * 2;
+    }
+
+    size = 0;
+    supervision_set_sound_dc_filter(TRUE);
+    supervision_unserialize(ref, refSize);
+    for (i = 0; i < FRAMES; i++) {
+        supervision_set_input((uint8)(i * 37));
+        supervision_exec_ex(NULL, 0);
+        supervision_update_sound_s16(audioB + size, (733 + i % 5) * 4);
+        size += (733 + i % 5) * 2;
+
+        supervision_serialize(state, refSize);
+        for (j = 0; j < 2; j++)
+            supervision_exec_ex(NULL, 0);
+        CHECK(supervision_unserialize(state, refSize));
+    }
+    CHECK(memcmp(audioA, audioB, size * sizeof(int16)) == 0);
+
+    free(state);
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        void (*run)(void);
+    } tests[] = {
+        { "round trip",             test_round_trip    },
+        { "legacy 1.0.5 state",     test_legacy        },
+        { "unknown chunk skipped",  test_unknown_chunk },
+        { "longer chunk accepted",  test_longer_chunk  },
+        { "older SND chunks",       test_short_snd     },
+        { "truncated rejected",     test_truncated     },
+        { "newer major rejected",   test_newer_major   },
+        { "bad ROM bank wrapped",   test_bad_bank      },
+        { "resume after load",      test_resume        },
+        { "hash ignores synthesis", test_hash          },
+        { "run-ahead keeps audio",  test_run_ahead     },
+    };
+    size_t i;
+
+    testrom_build(rom);
+    supervision_init();
+    if (!supervision_load(rom, sizeof(rom)))
+        return 1;
+    run_frames(0, FRAMES, TRUE, 733);
+    refSize = supervision_state_size();
+    ref = (uint8 *)malloc(refSize);
+    supervision_serialize(ref, refSize);
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int before = failed;
+        tests[i].run();
+        printf("%-24s %s\n", tests[i].name, failed == before ? "ok" : "FAIL");
+    }
+
+    free(ref);
+    supervision_done();
+    return failed ? 1 : 0;
+}
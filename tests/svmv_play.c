@@ -0,0 +1,224 @@
+// Headless movie player: plays input movies (psplib/pl_movie) against
+// the emulator core and prints the state hash after the last frame, and
+// a hash of the audio rendered along the way.
+//
+// svmv_play [-nosound] [-reload] rom movie [hash [audio]]
+// svmv_play [-nosound] [-reload] [-j jobs] -l list rom
+//   -nosound  don't synthesize audio (the audio hash isn't checked)
+//   -reload   save, reset and load the state before every frame
+//   -j        movies played at once, from a list (default: one per CPU)
+//   -l        list of "movie hash [audio]" lines, movies relative to the
+//             list's directory
+//   hash      expected final hash (hex); exit status 1 on mismatch
+//   audio     expected audio hash (hex), the same
+
+#include "supervision.h"
+#include "pl_movie.h"
+#include "pl_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Audio pulled per frame; movie_rec pulls the same to hash the audio
+#define FRAME_SAMPLES 735
+
+static BOOL synthesis = TRUE, reload = FALSE;
+
+static uint8 *read_file(const char *path, uint32 *size)
+{
+    FILE *f = fopen(path, "rb");
+    uint8 *data = NULL;
+    long length;
+
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (length = ftell(f)) > 0
+        && fseek(f, 0, SEEK_SET) == 0
+        && (data = (uint8 *)malloc(length))
+        && fread(data, length, 1, f) == 1) {
+        *size = (uint32)length;
+    }
+    else {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+// Returns the exit status: 0 - ok, 1 - mismatch, 2 - error
+static int play(const uint8 *rom, uint32 romSize, const char *moviePath,
+                const char *expected, const char *expectedAudio)
+{
+    static int16 audio[FRAME_SAMPLES * 2];
+    uint8 *state;
+    uint32 stateSize, frames = 0, hash, audioHash = SV_FNV_BASIS, crc, i;
+    uint8 input = 0;
+    pl_movie movie;
+    int status = 0;
+
+    pl_movie_init(&movie);
+    if (!pl_movie_play(&movie, moviePath)) {
+        fprintf(stderr, "%s: not a movie\n", moviePath);
+        return 2;
+    }
+    pl_util_compute_crc32_buffer(rom, romSize, &crc);
+    if (movie.rom_crc != crc)
+        fprintf(stderr, "%s: recorded with a different ROM\n", moviePath);
+
+    supervision_init();
+    if (!supervision_load(rom, romSize)) {
+        fprintf(stderr, "%s: can't load the ROM\n", moviePath);
+        return 2;
+    }
+    // As the frontend does: no state - power-on
+    if (!movie.state)
+        supervision_reset();
+    else if (!supervision_unserialize((const uint8 *)movie.state, movie.state_size)) {
+        fprintf(stderr, "%s: starting state not loaded\n", moviePath);
+        return 2;
+    }
+
+    stateSize = supervision_state_size();
+    state = (uint8 *)malloc(stateSize);
+    supervision_set_sound_synthesis(synthesis);
+
+    while (pl_movie_update(&movie, &input)) {
+        if (reload) {
+            supervision_serialize(state, stateSize);
+            supervision_reset();
+            supervision_unserialize(state, stateSize);
+        }
+        supervision_set_input(input);
+        supervision_exec_ex(NULL, 0);
+        if (synthesis) {
+            supervision_update_sound_s16(audio, sizeof(audio));
+            for (i = 0; i < FRAME_SAMPLES * 2; i++) {
+                audioHash = SV_FNV_BYTE(audioHash, audio[i] & 0xff);
+                audioHash = SV_FNV_BYTE(audioHash, (uint16)audio[i] >> 8);
+            }
+        }
+        frames++;
+    }
+    hash = supervision_state_hash();
+
+    printf("%s: %u frames, hash %08x", moviePath, frames, hash);
+    if (synthesis)
+        printf(", audio %08x", audioHash);
+    if (expected && strtoul(expected, NULL, 16) != hash) {
+        printf(", expected %s", expected);
+        status = 1;
+    }
+    if (synthesis && expectedAudio && strtoul(expectedAudio, NULL, 16) != audioHash) {
+        printf(", expected audio %s", expectedAudio);
+        status = 1;
+    }
+    printf("\n");
+    fflush(stdout);
+
+    pl_movie_stop(&movie);
+    supervision_done();
+    free(state);
+    return status;
+}
+
+// The core is one global machine: each movie is played in a process of
+// its own, up to 'jobs' at a time. Returns the worst exit status.
+static int play_list(const uint8 *rom, uint32 romSize, const char *listPath, int jobs)
+{
+    char line[1024], path[1024], movie[1024], hash[16], audio[16];
+    const char *slash = strrchr(listPath, '/');
+    int dirLength = slash ? (int)(slash - listPath) + 1 : 0;
+    int running = 0, worst = 0, status;
+    FILE *list = fopen(listPath, "r");
+
+    if (!list) {
+        fprintf(stderr, "%s: can't read\n", listPath);
+        return 2;
+    }
+
+    while (fgets(line, sizeof(line), list)) {
+        int fields = sscanf(line, "%1023s %15s %15s", movie, hash, audio);
+        pid_t pid;
+
+        if (fields < 2 || snprintf(path, sizeof(path), "%.*s%s",
+                                   dirLength, listPath, movie) >= (int)sizeof(path))
+            continue;
+
+        if (running == jobs) {
+            if (wait(&status) > 0) {
+                status = WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+                worst = status > worst ? status : worst;
+            }
+            running--;
+        }
+
+        fflush(stdout);
+        if ((pid = fork()) == 0)
+            _exit(play(rom, romSize, path, hash, fields > 2 ? audio : NULL));
+        if (pid < 0) {
+            fprintf(stderr, "%s: can't start a worker\n", path);
+            worst = 2;
+            break;
+        }
+        running++;
+    }
+    fclose(list);
+
+    for (; running > 0; running--) {
+        if (wait(&status) > 0) {
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+            worst = status > worst ? status : worst;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *romPath, *listPath = NULL;
+    uint8 *rom;
+    uint32 romSize;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg = 1, status;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-nosound") == 0)
+            synthesis = FALSE;
+        else if (strcmp(argv[arg], "-reload") == 0)
+            reload = TRUE;
+        else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+            jobs = strtol(argv[++arg], NULL, 10);
+        else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc)
+            listPath = argv[++arg];
+        else
+            break;
+    }
+    if (listPath ? argc - arg != 1 : (argc - arg < 2 || argc - arg > 4)) {
+        fprintf(stderr, "usage: %s [-nosound] [-reload] rom movie [hash [audio]]\n"
+                        "       %s [-nosound] [-reload] [-j jobs] -l list rom\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    if (jobs < 1)
+        jobs = 1;
+
+    romPath = argv[arg];
+    if (!(rom = read_file(romPath, &romSize))) {
+        fprintf(stderr, "%s: can't read\n", romPath);
+        return 2;
+    }
+
+    if (listPath)
+        status = play_list(rom, romSize, listPath, (int)jobs);
+    else
+        status = play(rom, romSize, argv[arg + 1],
+                      argc - arg > 2 ? argv[arg + 2] : NULL,
+                      argc - arg > 3 ? argv[arg + 3] : NULL);
+
+    free(rom);
+    return status;
+}
@@ -0,0 +1,132 @@
+#include "testrom.h"
+
+#include <string.h>
+
+// ROM offset of CPU address 0xc000 (upper bank of a 32KB ROM)
+#define UPPER_BANK 0x4000
+
+static uint8 *code;
+static uint16 pc;
+
+static void emit(int count, const uint8 *bytes)
+{
+    memcpy(code + (pc - 0xc000), bytes, count);
+    pc += count;
+}
+
+#define OP(...) do { \
+    const uint8 _[] = { __VA_ARGS__ }; \
+    emit(sizeof(_), _); } while (0)
+
+#define LO(a) ((a) & 0xff)
+#define HI(a) ((a) >> 8)
+
+#define LDA_IMM(v)  OP(0xa9, v)
+#define LDA_ABS(a)  OP(0xad, LO(a), HI(a))
+#define LDA_ZP(a)   OP(0xa5, a)
+#define LDX_IMM(v)  OP(0xa2, v)
+#define LDX_ZP(a)   OP(0xa6, a)
+#define STA_ABS(a)  OP(0x8d, LO(a), HI(a))
+#define STA_ABSX(a) OP(0x9d, LO(a), HI(a))
+#define STA_ZP(a)   OP(0x85, a)
+#define EOR_ZP(a)   OP(0x45, a)
+#define AND_IMM(v)  OP(0x29, v)
+#define ORA_IMM(v)  OP(0x09, v)
+#define INC_ZP(a)   OP(0xe6, a)
+#define JMP(a)      OP(0x4c, LO(a), HI(a))
+
+// Forward branch: returns the offset byte to patch with branch_here()
+static uint16 branch(uint8 opcode)
+{
+    OP(opcode, 0);
+    return pc - 1;
+}
+
+static void branch_here(uint16 at)
+{
+    code[at - 0xc000] = (uint8)(pc - (at + 1));
+}
+
+#define BEQ() branch(0xf0)
+#define BNE() branch(0xd0)
+
+// Zero page
+#define INPUT    0x10
+#define COUNTER  0x11 // 16-bit main loop counter
+#define DMA_IRQS 0x13
+#define TMR_IRQS 0x14
+
+void testrom_build(uint8 *rom)
+{
+    uint16 reset, main, irq, skip;
+
+    memset(rom, 0xea, TESTROM_SIZE); // NOP
+    code = rom + UPPER_BANK;
+    pc = 0xc000;
+
+    reset = pc;
+    OP(0x78);            // SEI
+    OP(0xd8);            // CLD
+    LDX_IMM(0xff);
+    OP(0x9a);            // TXS
+    LDA_IMM(0xa0); STA_ABS(0x2000); // XSIZE
+    LDA_IMM(0x00); STA_ABS(0x2002); STA_ABS(0x2003);
+    // Sound DMA: 4 * 32 samples of the code itself, 256 cycles each
+    STA_ABS(0x2018);
+    LDA_IMM(0xc0); STA_ABS(0x2019);
+    LDA_IMM(0x04); STA_ABS(0x201a);
+    LDA_IMM(0x0c); STA_ABS(0x201b);
+    // Timer and DMA IRQs on
+    LDA_IMM(0x06); STA_ABS(0x2026);
+    LDA_IMM(0x80); STA_ABS(0x201c);
+    LDA_IMM(0x20); STA_ABS(0x2023);
+    // A square wave (audible: period 0x3xx) and noise, for the
+    // synthesis-side state
+    LDA_IMM(0x03); STA_ABS(0x2011);
+    LDA_IMM(0x4f); STA_ABS(0x2012);
+    LDA_IMM(0x10); STA_ABS(0x2013);
+    LDA_IMM(0x3f); STA_ABS(0x2028);
+    LDA_IMM(0x1e); STA_ABS(0x202a);
+    OP(0x58);            // CLI
+
+    main = pc;
+    LDA_ABS(0x2020); STA_ZP(INPUT);
+    LDX_ZP(COUNTER);
+    EOR_ZP(COUNTER + 1);
+    STA_ABSX(0x4000);
+    INC_ZP(COUNTER);
+    skip = BNE();
+    INC_ZP(COUNTER + 1);
+    branch_here(skip);
+    LDA_ZP(INPUT); STA_ABS(0x2010);
+    JMP(main);
+
+    irq = pc;
+    OP(0x48, 0x8a, 0x48); // PHA, TXA, PHA
+    // DMA finished: log the loop counter, restart with the input's
+    // length and rate
+    LDA_ABS(0x2027); AND_IMM(0x02);
+    skip = BEQ();
+    LDA_ABS(0x2025);
+    INC_ZP(DMA_IRQS);
+    LDX_ZP(DMA_IRQS);
+    LDA_ZP(COUNTER); STA_ABSX(0x0200);
+    LDA_ZP(INPUT); AND_IMM(0x07); ORA_IMM(0x01); STA_ABS(0x201a);
+    LDA_ZP(INPUT); AND_IMM(0x03); ORA_IMM(0x0c); STA_ABS(0x201b);
+    LDA_IMM(0x80); STA_ABS(0x201c);
+    branch_here(skip);
+    // Timer: the same
+    LDA_ABS(0x2027); AND_IMM(0x01);
+    skip = BEQ();
+    LDA_ABS(0x2024);
+    INC_ZP(TMR_IRQS);
+    LDX_ZP(TMR_IRQS);
+    LDA_ZP(COUNTER); STA_ABSX(0x0300);
+    LDA_ZP(INPUT); ORA_IMM(0x10); STA_ABS(0x2023);
+    branch_here(skip);
+    OP(0x68, 0xaa, 0x68); // PLA, TAX, PLA
+    OP(0x40);             // RTI
+
+    pc = 0xfffa;
+    OP(LO(irq), HI(irq), LO(reset), HI(reset), LO(irq), HI(irq));
+}
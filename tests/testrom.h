@@ -0,0 +1,17 @@
+#ifndef __TESTROM_H__
+#define __TESTROM_H__
+
+#include "types.h"
+
+#define TESTROM_SIZE 0x8000
+
+/*!
+ * Build a 32KB ROM that keeps the sound DMA and the timer busy. The DMA
+ * and timer IRQ handlers restart them with lengths and rates taken from
+ * the input, and log the main loop counter at each IRQ into RAM. So RAM
+ * depends on the exact cycle on which each IRQ fires.
+ * \param rom TESTROM_SIZE bytes.
+ */
+void testrom_build(uint8 *rom);
+
+#endif